@@ -0,0 +1,52 @@
+#pragma once
+
+struct AssetGraphNode_t
+{
+	uint64_t guid = 0;
+	const AssetTypeHandler_t* handler = nullptr;
+	rapidjson::Value* mapEntry = nullptr;
+
+	// guids of every asset referenced by this asset, including ones that aren't built into this pak
+	std::vector<uint64_t> dependencies;
+
+	// indices of the nodes this node references that are built into this pak,
+	// and of the nodes that reference this one
+	std::vector<uint32_t> usedNodes;
+	std::vector<uint32_t> userNodes;
+
+	// length of the longest chain of dependencies below this node
+	// nodes on the same level never depend on each other, so each level can be built concurrently
+	uint32_t level = 0;
+
+	// index of the built asset entry, -1 if the asset hasn't been built (or was skipped by its handler)
+	uint32_t assetIdx = -1;
+};
+
+//
+// dependency graph of all assets defined in a map file
+// used to build assets in an order where every asset comes after the assets it references,
+// and to generate the file relations from the declared references instead of from handler order
+//
+class AssetGraph
+{
+	std::vector<AssetGraphNode_t> nodes;
+	std::unordered_map<uint64_t, uint32_t> guidToNode;
+	std::vector<uint32_t> buildOrder;
+
+public:
+	uint32_t AddNode(const AssetTypeHandler_t* handler, rapidjson::Value* mapEntry);
+	void AddMapFileEntries(rapidjson::Value& files, std::vector<const AssetTypeHandler_t*>& usedAssetTypes);
+	bool Resolve();
+
+	AssetGraphNode_t& GetNode(uint32_t idx) { return nodes[idx]; };
+	AssetGraphNode_t* GetNodeByGuid(uint64_t guid);
+	size_t GetNodeCount() { return nodes.size(); };
+
+	// node indices in the order that they should be built in
+	const std::vector<uint32_t>& GetBuildOrder() { return buildOrder; };
+	std::vector<std::vector<uint32_t>> GetLevels();
+	std::vector<uint32_t> GetGroups();
+	std::vector<uint32_t> GetLoadOrder();
+
+	void GenerateFileRelations(std::vector<RPakAssetEntryV8>& assetEntries);
+};
@@ -7,18 +7,114 @@
 #define RMDL_VERSION 9
 #define MATL_VERSION 16
 
+// size of the cpu data that is written for every material
+#define MATL_CPU_DATA_SIZE 544
+
+// a page that an asset will add, see AssetPlan_t
+struct PlannedPage_t
+{
+	uint32_t size;
+	uint32_t flags;
+	uint32_t alignment;
+	uint32_t vsegAlignment = -1;
+};
+
+// what an asset will add to the rpak, worked out from the map file entry and the headers of its source files
+// used by RePak::PlanMapFile to estimate the layout of a map without building it
+struct AssetPlan_t
+{
+	std::vector<PlannedPage_t> pages; // in the order the handler creates them
+	std::vector<uint64_t> starpakBlockSizes; // before padding
+	size_t descriptorCount = 0;
+	size_t guidDescriptorCount = 0; // upper bound, guids that turn out to be 0 aren't registered
+};
+
+typedef bool(*AssetAddFunc_t)(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry);
+typedef void(*AssetBatchFunc_t)(std::vector<RPakAssetEntryV8>* assetEntries);
+typedef uint64_t(*AssetGuidFunc_t)(const char* assetPath, rapidjson::Value& mapEntry);
+typedef void(*AssetDependenciesFunc_t)(const char* assetPath, rapidjson::Value& mapEntry, std::vector<uint64_t>& dependencies);
+typedef void(*AssetSourceFilesFunc_t)(const char* assetPath, rapidjson::Value& mapEntry, std::vector<std::string>& sourceFiles);
+typedef bool(*AssetPlanFunc_t)(const char* assetPath, rapidjson::Value& mapEntry, AssetPlan_t& plan);
+typedef uint64_t(*AssetSourceHashFunc_t)(const char* assetPath, rapidjson::Value& mapEntry);
+
+// describes how map file entries of a single asset type are turned into assets
+struct AssetTypeHandler_t
+{
+	uint32_t mapType = 0; // fourcc of the "$type" string used in map files
+	AssetType type; // fourcc of the asset type as written to the rpak
+
+	// adds the asset to the build state. assets that can't be used are skipped with a warning,
+	// false is only returned when the whole build has to fail, such as when other assets would be left pointing at a missing one
+	AssetAddFunc_t AddAsset = nullptr;
+
+	// used for building the asset graph before any asset is added
+	// GetGuid returns the guid that the asset will have, GetDependencies gives the guids of every asset it references
+	AssetGuidFunc_t GetGuid = nullptr;
+	AssetDependenciesFunc_t GetDependencies = nullptr;
+
+	// gives the paths of every file the handler reads when adding the asset
+	// used by the build cache to tell whether a cached asset is still up to date
+	AssetSourceFilesFunc_t GetSourceFiles = nullptr;
+
+	// optional hooks that run once around the whole group of entries for this type
+	// BeginBatch is called before the first entry of the type is added and EndBatch after the last one,
+	// so that work can be shared across every asset of the type instead of being redone per asset
+	AssetBatchFunc_t BeginBatch = nullptr;
+	AssetBatchFunc_t EndBatch = nullptr;
+
+	// gives what the asset will add to the rpak without reading the payload of its source files
+	// returns false if the asset would be skipped. types without it can't be estimated by RePak::PlanMapFile
+	AssetPlanFunc_t PlanAsset = nullptr;
+
+	// optional replacement for hashing every file from GetSourceFiles when making the asset's build cache key
+	// for types whose source files are too large to look at for every asset, such as the rpaks that copied assets come from
+	AssetSourceHashFunc_t GetSourceHash = nullptr;
+};
+
 namespace Assets
 {
-	void AddTextureAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry);
-	void AddUIImageAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry);
-	void AddDataTableAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry);
-	void AddPatchAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry);
-	void AddModelAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry);
-	void AddMaterialAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry);
-
-	extern std::string g_sAssetsDir;
-	extern std::vector<std::string> g_vsStarpakPaths;
-	extern std::vector<std::string> g_vsOptStarpakPaths;
-	extern std::vector<SRPkDataEntry> g_vSRPkDataEntries;
+	bool AddTextureAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry);
+	bool AddUIImageAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry);
+	bool AddDataTableAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry);
+	bool AddPatchAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry);
+	bool AddModelAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry);
+	bool AddMaterialAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry);
+	bool AddCopiedAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry);
+
+	uint64_t GetTextureGuid(const char* assetPath, rapidjson::Value& mapEntry);
+	uint64_t GetUIImageGuid(const char* assetPath, rapidjson::Value& mapEntry);
+	uint64_t GetDataTableGuid(const char* assetPath, rapidjson::Value& mapEntry);
+	uint64_t GetPatchGuid(const char* assetPath, rapidjson::Value& mapEntry);
+	uint64_t GetModelGuid(const char* assetPath, rapidjson::Value& mapEntry);
+	uint64_t GetMaterialGuid(const char* assetPath, rapidjson::Value& mapEntry);
+	uint64_t GetCopiedAssetGuid(const char* assetPath, rapidjson::Value& mapEntry);
+
+	void GetUIImageDependencies(const char* assetPath, rapidjson::Value& mapEntry, std::vector<uint64_t>& dependencies);
+	void GetModelDependencies(const char* assetPath, rapidjson::Value& mapEntry, std::vector<uint64_t>& dependencies);
+	void GetMaterialDependencies(const char* assetPath, rapidjson::Value& mapEntry, std::vector<uint64_t>& dependencies);
+	void GetCopiedAssetDependencies(const char* assetPath, rapidjson::Value& mapEntry, std::vector<uint64_t>& dependencies);
+
+	void GetTextureSourceFiles(const char* assetPath, rapidjson::Value& mapEntry, std::vector<std::string>& sourceFiles);
+	void GetUIImageSourceFiles(const char* assetPath, rapidjson::Value& mapEntry, std::vector<std::string>& sourceFiles);
+	void GetPatchSourceFiles(const char* assetPath, rapidjson::Value& mapEntry, std::vector<std::string>& sourceFiles);
+	void GetDataTableSourceFiles(const char* assetPath, rapidjson::Value& mapEntry, std::vector<std::string>& sourceFiles);
+	void GetModelSourceFiles(const char* assetPath, rapidjson::Value& mapEntry, std::vector<std::string>& sourceFiles);
+	void GetCopiedAssetSourceFiles(const char* assetPath, rapidjson::Value& mapEntry, std::vector<std::string>& sourceFiles);
+
+	uint64_t GetCopiedAssetSourceHash(const char* assetPath, rapidjson::Value& mapEntry);
+
+	bool PlanTextureAsset(const char* assetPath, rapidjson::Value& mapEntry, AssetPlan_t& plan);
+	bool PlanUIImageAsset(const char* assetPath, rapidjson::Value& mapEntry, AssetPlan_t& plan);
+	bool PlanDataTableAsset(const char* assetPath, rapidjson::Value& mapEntry, AssetPlan_t& plan);
+	bool PlanPatchAsset(const char* assetPath, rapidjson::Value& mapEntry, AssetPlan_t& plan);
+	bool PlanModelAsset(const char* assetPath, rapidjson::Value& mapEntry, AssetPlan_t& plan);
+	bool PlanMaterialAsset(const char* assetPath, rapidjson::Value& mapEntry, AssetPlan_t& plan);
+
+	void BeginUIImageBatch(std::vector<RPakAssetEntryV8>* assetEntries);
+	void EndUIImageBatch(std::vector<RPakAssetEntryV8>* assetEntries);
+	void EndCopiedAssetBatch(std::vector<RPakAssetEntryV8>* assetEntries);
+
+	void RegisterAssetType(const AssetTypeHandler_t& handler);
+	const AssetTypeHandler_t* GetAssetTypeHandler(uint32_t mapType);
 };
 
@@ -0,0 +1,107 @@
+#pragma once
+#include <string_view>
+
+// a run of values inside a BinaryReader's buffer, returned by BinaryReader::readSpan
+// the values aren't copied, so the span is only valid for as long as the reader's buffer is
+template <typename T>
+struct BinarySpan_t
+{
+	const T* data;
+	size_t count;
+
+	const T* begin() const { return data; };
+	const T* end() const { return data + count; };
+	size_t size() const { return count; };
+	const T& operator[](size_t idx) const { return data[idx]; };
+};
+
+//
+// input stream for binary data, which reads from a memory mapped file or from a buffer that is already in memory
+// values are read straight out of the buffer, strings and spans are returned without copying them,
+// and every read is bounds checked, throwing a message (the same way as rmem) instead of reading past the end
+//
+class BinaryReader
+{
+	MappedFile_t mapped; // used when the reader maps its own file
+
+	const uint8_t* buffer = nullptr;
+	size_t bufferSize = 0;
+	size_t position = 0;
+
+	const uint8_t* take(size_t size)
+	{
+		if (size > bufferSize - position)
+			throw "failed to read from buffer: attempted to read past the end of the buffer";
+
+		const uint8_t* data = buffer + position;
+		position += size;
+
+		return data;
+	}
+
+public:
+	BinaryReader() = default;
+	BinaryReader(const void* data, size_t size) : buffer(static_cast<const uint8_t*>(data)), bufferSize(size) {};
+	~BinaryReader();
+
+	BinaryReader(const BinaryReader&) = delete;
+	BinaryReader& operator=(const BinaryReader&) = delete;
+
+	bool open(const std::string& path);
+	void close();
+
+	void readBytes(void* out, size_t size);
+	std::string_view readString();
+	void readStrings(size_t tableSize, std::vector<std::string>& strings);
+
+	template <typename T>
+	T read()
+	{
+		T value;
+		memcpy(&value, take(sizeof(T)), sizeof(T));
+
+		return value;
+	}
+
+	template <typename T>
+	void read(T& value)
+	{
+		memcpy(&value, take(sizeof(T)), sizeof(T));
+	}
+
+	template <typename T>
+	BinarySpan_t<T> readSpan(size_t count)
+	{
+		if (count > (bufferSize - position) / sizeof(T))
+			throw "failed to read from buffer: attempted to read past the end of the buffer";
+
+		return { reinterpret_cast<const T*>(take(count * sizeof(T))), count };
+	}
+
+	// replaces the contents of the vector with the next count values, copied in one go
+	template <typename T>
+	void readVector(std::vector<T>& out, size_t count)
+	{
+		BinarySpan_t<T> span = readSpan<T>(count);
+		out.resize(count);
+
+		if (count)
+			memcpy(out.data(), span.data, count * sizeof(T));
+	}
+
+	void seek(size_t pos)
+	{
+		if (pos > bufferSize)
+			throw "failed to seek in buffer: attempted to seek past the end of the buffer";
+
+		position = pos;
+	}
+
+	void skip(size_t size) { take(size); };
+
+	const uint8_t* data() const { return buffer; };
+	size_t size() const { return bufferSize; };
+	size_t tell() const { return position; };
+	size_t remaining() const { return bufferSize - position; };
+	bool eof() const { return position == bufferSize; };
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+// large enough that tables and small pages are written to the stream in a few big writes
+#define BUFFERED_WRITER_DEFAULT_SIZE (4 * 1024 * 1024)
+
+// buffers are aligned to the page size, so flushes never start in the middle of a page of memory
+#define BUFFERED_WRITER_ALIGNMENT 4096
+
+// a block of data for BufferedWriter::writeBlocks
+struct BufferedWriteBlock_t
+{
+	const void* data;
+	size_t size;
+};
+
+//
+// output stream for binary data, which collects writes in a large buffer and only passes them to the stream once it is full
+// whole tables are written in one go, blocks bigger than the buffer skip it, and padding is written without allocating
+//
+class BufferedWriter
+{
+	std::ofstream file; // used when the writer opens its own file
+	std::ostream* out = nullptr;
+
+	uint8_t* buffer = nullptr;
+	size_t bufferSize = 0;
+	size_t bufferUsed = 0;
+
+	uint64_t position = 0;
+	bool bFailed = false;
+
+	void writeDirect(const void* data, size_t size);
+
+public:
+	BufferedWriter(size_t bufferSize = BUFFERED_WRITER_DEFAULT_SIZE);
+	BufferedWriter(std::ostream& out, size_t bufferSize = BUFFERED_WRITER_DEFAULT_SIZE);
+	~BufferedWriter();
+
+	BufferedWriter(const BufferedWriter&) = delete;
+	BufferedWriter& operator=(const BufferedWriter&) = delete;
+
+	bool open(const std::string& path);
+	bool close();
+	void flush();
+
+	void writeBytes(const void* data, size_t size);
+	void writeBlocks(const BufferedWriteBlock_t* blocks, size_t count);
+	void writePadding(size_t size, uint8_t value = 0);
+	size_t writeStrings(const std::vector<std::string>& strings);
+
+	template <typename T>
+	void write(const T& value)
+	{
+		writeBytes(&value, sizeof(T));
+	}
+
+	template <typename T>
+	void writeSpan(const T* data, size_t count)
+	{
+		writeBytes(data, count * sizeof(T));
+	}
+
+	template <typename T>
+	void writeVector(const std::vector<T>& data)
+	{
+		writeBytes(data.data(), data.size() * sizeof(T));
+	}
+
+	// writes the string with its null terminator
+	void writeString(const std::string& str)
+	{
+		writeBytes(str.c_str(), str.length() + 1);
+	}
+
+	// number of bytes written since the writer was opened
+	uint64_t tell() const { return position; };
+	bool fail() const { return bFailed; };
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+// a single page produced by an asset handler
+struct AssetRecordPage_t
+{
+	uint32_t segFlags = 0; // DataFlag of the segment that the page was in
+	uint32_t segAlignment = 0; // SomeType of the segment that the page was in
+	uint32_t alignment = 0; // SomeType of the page
+	std::vector<uint8_t> data;
+};
+
+// everything that an asset handler produced for a single asset, in relocatable form:
+// - page indices (in the asset entry, the descriptors and the RPakPtrs within the page data) are relative to the asset's first page
+// - the starpak offset in the asset entry is relative to the asset's first starpak data block
+// this allows the asset to be spliced into any pak without running its handler again
+struct AssetRecord_t
+{
+	RPakAssetEntryV8 asset;
+	std::vector<AssetRecordPage_t> pages;
+	std::vector<RPakDescriptor> descriptors;
+	std::vector<RPakGuidDescriptor> guidDescriptors;
+	std::vector<std::vector<uint8_t>> starpakBlocks;
+	std::vector<std::string> starpakPaths;
+};
+
+// sizes of the global build state, taken before an asset's handler is run
+// everything added after the mark belongs to that asset
+struct BuildStateMark_t
+{
+	size_t assetCount;
+	size_t pageCount;
+	size_t descriptorCount;
+	size_t guidDescriptorCount;
+	size_t rawDataBlockCount;
+	size_t starpakEntryCount;
+};
+
+struct BuildCacheKey_t
+{
+	uint64_t assetId = 0; // hash of the asset type and path. names the cache entry
+	uint64_t versionHash = 0; // hash of the RePak build that created the entry
+	uint64_t entryHash = 0; // hash of the asset's map file entry
+	uint64_t sourceHash = 0; // hash of the paths, sizes and write times of every source file the asset is built from
+};
+
+namespace RePak
+{
+	BuildStateMark_t MarkBuildState(std::vector<RPakAssetEntryV8>& assetEntries);
+	bool CaptureAssetRecord(const BuildStateMark_t& mark, std::vector<RPakAssetEntryV8>& assetEntries, AssetRecord_t& record);
+	bool CaptureAssetRecord(const BuildStateMark_t& mark, const BuildStateMark_t& endMark, std::vector<RPakAssetEntryV8>& assetEntries, AssetRecord_t& record);
+	uint32_t SpliceAssetRecord(const AssetRecord_t& record, std::vector<RPakAssetEntryV8>& assetEntries);
+	uint64_t HashAssetRecord(const AssetRecord_t& record);
+	uint64_t GetSourceFileHash(const std::string& path);
+
+	void WriteAssetRecord(BufferedWriter& out, const AssetRecord_t& record);
+	bool ReadAssetRecord(BinaryReader& in, AssetRecord_t& record);
+};
+
+//
+// persistent on-disk cache of built assets
+// each asset gets a single entry that is replaced whenever the asset is rebuilt,
+// and the least recently used entries are removed once the cache grows past its size limit
+// a single cache can be used by several builds at once
+//
+class BuildCache
+{
+	std::mutex mutex;
+
+	std::string cacheDir;
+	uint64_t maxSize;
+	bool bExplain;
+
+	size_t hits = 0;
+	size_t misses = 0;
+
+	std::string GetEntryPath(uint64_t assetId);
+
+public:
+	BuildCache(const std::string& dir, uint64_t maxSizeBytes, bool explain);
+
+	BuildCacheKey_t MakeKey(const AssetTypeHandler_t* handler, const char* assetPath, rapidjson::Value& mapEntry);
+
+	bool Load(const BuildCacheKey_t& key, const char* assetPath, AssetRecord_t& record);
+	void Store(const BuildCacheKey_t& key, const AssetRecord_t& record);
+
+	void Trim();
+	void PrintStats();
+};
@@ -0,0 +1,83 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+// direct writes have to start on a sector boundary, be a whole number of sectors long and come from memory aligned to a sector.
+// 4096 covers every sector size that drives use
+#define DIRECT_WRITER_ALIGNMENT 4096
+
+// size of each buffer in the arena, which is also the size of every write but the last one
+#define DIRECT_WRITER_BUFFER_SIZE (8 * 1024 * 1024)
+
+// buffers in the arena. one is filled while the rest are queued or being written
+#define DIRECT_WRITER_BUFFER_COUNT 4
+
+//
+// output stream for very large files, which writes to the file directly instead of through the file cache.
+// data is gathered into an arena of aligned buffers and every full buffer is queued for a writer thread, so the data that
+// comes next is copied while the last buffer is still being written. the final buffer is padded out to a whole sector and
+// the file is cut back to its real size when it is closed, so the file is the same as one written through the cache.
+// written files don't take up memory that source files could be cached in
+//
+class DirectWriter
+{
+	// a full buffer waiting for the writer thread
+	struct QueuedWrite_t
+	{
+		size_t bufferIdx;
+		uint64_t offset;
+		size_t size;
+	};
+
+	PlatformFile_t file = PLATFORM_INVALID_FILE;
+
+	uint8_t* arena = nullptr;
+	size_t currentBuffer = 0;
+	size_t bufferUsed = 0;
+
+	uint64_t position = 0;
+	uint64_t bufferOffset = 0; // file offset of the buffer being filled
+
+	std::thread writeThread;
+	std::mutex queueMutex;
+	std::condition_variable queueCondition;
+	std::deque<QueuedWrite_t> queue;
+	std::vector<size_t> freeBuffers;
+	bool bStopping = false;
+	bool bFailed = false;
+
+	uint8_t* getBuffer(size_t idx) const { return arena + idx * DIRECT_WRITER_BUFFER_SIZE; };
+
+	void submitBuffer();
+	void writeThreadMain();
+
+public:
+	DirectWriter();
+	~DirectWriter();
+
+	DirectWriter(const DirectWriter&) = delete;
+	DirectWriter& operator=(const DirectWriter&) = delete;
+
+	bool open(const std::string& path, uint64_t fileSize);
+	bool close();
+
+	void writeBytes(const void* data, size_t size);
+	void writePadding(size_t size, uint8_t value = 0);
+
+	template <typename T>
+	void write(const T& value)
+	{
+		writeBytes(&value, sizeof(T));
+	}
+
+	template <typename T>
+	void writeVector(const std::vector<T>& data)
+	{
+		writeBytes(data.data(), data.size() * sizeof(T));
+	}
+
+	// number of bytes written since the writer was opened
+	uint64_t tell() const { return position; };
+	bool fail() const { return bFailed; };
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+//
+// compile-time tables of where the pointers and guid references are within asset header structs
+// every header that gets written into a page declares the offsets of its RPakPtr and guid fields once here,
+// so that handlers can register all of a header's descriptors in one go instead of field by field
+// only pointers that the handler always sets are listed, since a null pointer can't be told apart from a pointer to
+// page 0 offset 0. a pointer that is only set sometimes is registered by the handler when it sets it
+//
+template<typename T>
+struct RPakHeaderLayout
+{
+	static constexpr std::array<uint32_t, 0> Pointers{};
+	static constexpr std::array<uint32_t, 0> Guids{};
+};
+
+template<>
+struct RPakHeaderLayout<TextureHeader>
+{
+	static constexpr std::array<uint32_t, 0> Pointers{}; // pDebugName is only set with "saveDebugName"
+	static constexpr std::array<uint32_t, 0> Guids{};
+};
+
+template<>
+struct RPakHeaderLayout<UIImageHeader>
+{
+	// pTextureNames is never set
+	static constexpr std::array<uint32_t, 3> Pointers{
+		offsetof(UIImageHeader, pTextureOffsets),
+		offsetof(UIImageHeader, pTextureDims),
+		offsetof(UIImageHeader, pTextureHashes)
+	};
+	static constexpr std::array<uint32_t, 1> Guids{ offsetof(UIImageHeader, atlasGuid) };
+};
+
+template<>
+struct RPakHeaderLayout<DataTableHeader>
+{
+	static constexpr std::array<uint32_t, 2> Pointers{ offsetof(DataTableHeader, ColumnHeaderPtr), offsetof(DataTableHeader, RowHeaderPtr) };
+	static constexpr std::array<uint32_t, 0> Guids{};
+};
+
+template<>
+struct RPakHeaderLayout<DataTableColumn>
+{
+	static constexpr std::array<uint32_t, 1> Pointers{ offsetof(DataTableColumn, NamePtr) };
+	static constexpr std::array<uint32_t, 0> Guids{};
+};
+
+template<>
+struct RPakHeaderLayout<PtchHeader>
+{
+	static constexpr std::array<uint32_t, 2> Pointers{ offsetof(PtchHeader, pPakNames), offsetof(PtchHeader, pPakPatchNums) };
+	static constexpr std::array<uint32_t, 0> Guids{};
+};
+
+template<>
+struct RPakHeaderLayout<ModelHeader>
+{
+	// PhyPtr, VGPtr, AnimRigRefPtr and AnimSequencePtr are never set
+	static constexpr std::array<uint32_t, 2> Pointers{ offsetof(ModelHeader, SkeletonPtr), offsetof(ModelHeader, NamePtr) };
+	static constexpr std::array<uint32_t, 0> Guids{};
+};
+
+template<>
+struct RPakHeaderLayout<MaterialHeader>
+{
+	// SurfaceName2 is never set
+	static constexpr std::array<uint32_t, 4> Pointers{
+		offsetof(MaterialHeader, Name),
+		offsetof(MaterialHeader, SurfaceName),
+		offsetof(MaterialHeader, TextureGUIDs),
+		offsetof(MaterialHeader, TextureGUIDs2)
+	};
+	static constexpr std::array<uint32_t, 6> Guids{
+		offsetof(MaterialHeader, GUIDRefs) + 0,
+		offsetof(MaterialHeader, GUIDRefs) + 8,
+		offsetof(MaterialHeader, GUIDRefs) + 16,
+		offsetof(MaterialHeader, GUIDRefs) + 24,
+		offsetof(MaterialHeader, GUIDRefs) + 32,
+		offsetof(MaterialHeader, ShaderSetGUID)
+	};
+};
+
+template<>
+struct RPakHeaderLayout<MaterialCPUHeader>
+{
+	static constexpr std::array<uint32_t, 1> Pointers{ offsetof(MaterialCPUHeader, Unknown) };
+	static constexpr std::array<uint32_t, 0> Guids{};
+};
+
+namespace RePak
+{
+	// purpose: register descriptors for every pointer and guid field of an array of headers
+	// every listed pointer is registered, and a guid is skipped if it is 0, since no asset has that guid
+	template<typename T>
+	void RegisterHeaderDescriptors(uint32_t pageIdx, uint32_t pageOffset, const T* headers, size_t count = 1)
+	{
+		using Layout = RPakHeaderLayout<T>;
+
+		RPakBuildContext_t* ctx = g_pBuildContext;
+
+		ctx->descriptors.reserve(ctx->descriptors.size() + Layout::Pointers.size() * count);
+		ctx->guidDescriptors.reserve(ctx->guidDescriptors.size() + Layout::Guids.size() * count);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const char* pHdr = reinterpret_cast<const char*>(&headers[i]);
+			uint32_t hdrOffset = pageOffset + static_cast<uint32_t>(sizeof(T) * i);
+
+			for (uint32_t offset : Layout::Pointers)
+				ctx->descriptors.push_back({ pageIdx, hdrOffset + offset });
+
+			for (uint32_t offset : Layout::Guids)
+			{
+				if (*reinterpret_cast<const uint64_t*>(pHdr + offset) != 0)
+					ctx->guidDescriptors.push_back({ pageIdx, hdrOffset + offset });
+			}
+		}
+	}
+};
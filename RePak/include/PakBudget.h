@@ -0,0 +1,54 @@
+#pragma once
+
+// the engine reads the page count into a uint16_t
+#define RPAK_MAX_PAGE_COUNT 0xFFFF
+
+// the engine keeps the segments on the stack, and writes past the end of the array when there are more than this
+#define RPAK_MAX_SEGMENT_COUNT 20
+
+// limits that a single rpak has to stay within
+// maps that don't fit are split into several rpaks
+struct PakBudget_t
+{
+	size_t maxPageCount = RPAK_MAX_PAGE_COUNT;
+	size_t maxSegmentCount = RPAK_MAX_SEGMENT_COUNT;
+	uint64_t maxPakSize = 0; // 0 for no limit
+	uint64_t maxStarpakSize = 0; // 0 for no limit
+};
+
+// what a range of the build state adds to an rpak
+struct PakStats_t
+{
+	size_t assetCount = 0;
+	size_t pageCount = 0;
+	size_t descriptorCount = 0;
+	size_t guidDescriptorCount = 0;
+	uint64_t pageDataSize = 0;
+	uint64_t starpakSize = 0;
+
+	// flags and alignment of every segment that is used, sorted
+	std::vector<uint64_t> segmentKeys;
+
+	void Add(const PakStats_t& other);
+	uint64_t GetPakSize() const;
+};
+
+// an rpak written from some of the assets of a map
+struct PartialPakOutput_t
+{
+	MapBuildResult_t result;
+	std::vector<uint64_t> guids; // every asset in the rpak
+	std::string starpakPath; // mandatory starpak path, empty if it doesn't have one
+};
+
+namespace RePak
+{
+	PakBudget_t GetPakBudget(rapidjson::Document& doc);
+	const char* CheckPakBudget(const PakStats_t& stats, const PakBudget_t& budget);
+	bool CheckBuildBudget(std::vector<RPakAssetEntryV8>& assetEntries, const PakBudget_t& budget);
+	bool WriteBudgetedMapOutput(AssetGraph& assetGraph, const std::vector<BuildStateMark_t>& marks, std::vector<RPakAssetEntryV8>& assetEntries,
+		const PakBudget_t& budget, const std::string& sOutputDir, const std::string& sRpakName, MapBuildResult_t& result);
+	void SetStarpakSuffix(std::vector<std::string>& starpakPaths, const std::string& suffix);
+	bool WritePartialMapOutput(AssetGraph& assetGraph, const std::vector<BuildStateMark_t>& marks, std::vector<RPakAssetEntryV8>& assetEntries,
+		const std::vector<size_t>& positions, const std::string& sOutputDir, const std::string& sPakName, const std::string& starpakSuffix, PartialPakOutput_t& output);
+};
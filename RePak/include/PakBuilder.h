@@ -0,0 +1,50 @@
+#pragma once
+
+// public interface of the RePak library
+// this header only uses the standard library, so that tools embedding RePak don't need any of its other headers
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+//
+// builds an rpak (and its starpak) from assets that are given to it directly instead of through a map file
+// source files can be given in memory, so a pak can be built without anything touching the disk
+// every builder has its own build context, so builders on different threads don't interfere with each other
+//
+class PakBuilder
+{
+	struct Impl;
+	std::unique_ptr<Impl> pImpl;
+
+public:
+	// called with each chunk of output in order, return false to stop the build
+	typedef std::function<bool(const void* data, size_t size)> WriteFunc_t;
+
+	PakBuilder();
+	~PakBuilder();
+
+	PakBuilder(const PakBuilder&) = delete;
+	PakBuilder& operator=(const PakBuilder&) = delete;
+
+	// directory that asset paths are relative to, same as "assetsDir" in a map file
+	void SetAssetsDir(const std::string& dir);
+
+	// provide the contents of a source file in memory. used instead of the file at that path on disk
+	void AddSourceFile(const std::string& path, std::vector<uint8_t> data);
+
+	// set map file options, given as a json object with the same members as a map file, e.g. "reproducible", "stableLayout" or "loadOrder"
+	// replaces any options that were set before. "files" is ignored, assets are added with AddAsset
+	bool SetOptions(const std::string& optionsJson);
+
+	// add an asset, described by the same json object that would be used for it in a map file's "files" array
+	bool AddAsset(const std::string& mapEntryJson);
+
+	// build the rpak. the starpak writer is only called if any asset has starpak data
+	bool Build(const WriteFunc_t& rpakWriter, const WriteFunc_t& starpakWriter);
+	bool Build(std::vector<uint8_t>& rpak, std::vector<uint8_t>& starpak);
+
+	// message for the last failed call
+	const std::string& GetError() const;
+};
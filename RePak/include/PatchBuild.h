@@ -0,0 +1,28 @@
+#pragma once
+
+struct PakBudget_t;
+struct MapBuildResult_t;
+
+// the Ptch asset stores patch numbers as uint8_t
+#define MAX_PATCH_NUMBER 0xFF
+
+// the base release of an rpak and the number of the last patch written for it, used to find what has changed in the next build of it
+struct ReleaseManifest_t
+{
+	std::string rpakName;
+	uint32_t patchNum = 0; // number of the last patch, 0 if only the base rpak has been written
+
+	// content hash of every asset in the base rpak (see RePak::HashAssetRecord), keyed by guid
+	// patches don't change it, so every patch holds all of the changes since the base rpak
+	std::map<uint64_t, uint64_t> assetHashes;
+};
+
+namespace RePak
+{
+	bool ReadReleaseManifest(const std::string& path, ReleaseManifest_t& manifest);
+	bool WriteReleaseManifest(const std::string& path, const ReleaseManifest_t& manifest);
+	std::string GetPatchRPakName(const std::string& sRpakName, uint32_t patchNum);
+
+	bool WritePatchMapOutput(AssetGraph& assetGraph, const std::vector<BuildStateMark_t>& marks, std::vector<RPakAssetEntryV8>& assetEntries,
+		const PakBudget_t& budget, const std::string& sManifestPath, const std::string& sOutputDir, const std::string& sRpakName, MapBuildResult_t& result);
+};
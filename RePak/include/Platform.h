@@ -0,0 +1,188 @@
+#pragma once
+
+//
+// everything that RePak does differently on each platform
+// windows builds use the windows sdk. other platforms get the few windows types and functions that the rest of RePak uses
+// from here instead, so that the rest of RePak, and everything it writes, is the same on every platform
+//
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <sysinfoapi.h>
+#include <dxgiformat.h>
+
+#define PATH_SEPARATOR "\\"
+
+// msvc only checks format strings against their arguments through its code analysis
+#define PRINTF_FORMAT(fmtIdx, argIdx)
+#else
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#define __fastcall
+#define __int64 long long
+#define MAX_PATH 260
+
+#define PATH_SEPARATOR "/"
+
+// lets the compiler check the arguments of a printf style function against its format string
+#define PRINTF_FORMAT(fmtIdx, argIdx) __attribute__((format(printf, fmtIdx, argIdx)))
+
+using std::min;
+using std::max;
+
+typedef uint32_t DWORD;
+
+struct FILETIME
+{
+	DWORD dwLowDateTime;
+	DWORD dwHighDateTime;
+};
+
+// values are the same as in dxgiformat.h
+enum DXGI_FORMAT
+{
+	DXGI_FORMAT_UNKNOWN = 0,
+	DXGI_FORMAT_R32G32B32A32_FLOAT = 2,
+	DXGI_FORMAT_R32G32B32A32_UINT = 3,
+	DXGI_FORMAT_R32G32B32A32_SINT = 4,
+	DXGI_FORMAT_R32G32B32_FLOAT = 6,
+	DXGI_FORMAT_R32G32B32_UINT = 7,
+	DXGI_FORMAT_R32G32B32_SINT = 8,
+	DXGI_FORMAT_R16G16B16A16_FLOAT = 10,
+	DXGI_FORMAT_R16G16B16A16_UNORM = 11,
+	DXGI_FORMAT_R16G16B16A16_UINT = 12,
+	DXGI_FORMAT_R16G16B16A16_SNORM = 13,
+	DXGI_FORMAT_R16G16B16A16_SINT = 14,
+	DXGI_FORMAT_R32G32_FLOAT = 16,
+	DXGI_FORMAT_R32G32_UINT = 17,
+	DXGI_FORMAT_R32G32_SINT = 18,
+	DXGI_FORMAT_R10G10B10A2_UNORM = 24,
+	DXGI_FORMAT_R10G10B10A2_UINT = 25,
+	DXGI_FORMAT_R11G11B10_FLOAT = 26,
+	DXGI_FORMAT_R8G8B8A8_UNORM = 28,
+	DXGI_FORMAT_R8G8B8A8_UNORM_SRGB = 29,
+	DXGI_FORMAT_R8G8B8A8_UINT = 30,
+	DXGI_FORMAT_R8G8B8A8_SNORM = 31,
+	DXGI_FORMAT_R8G8B8A8_SINT = 32,
+	DXGI_FORMAT_R16G16_FLOAT = 34,
+	DXGI_FORMAT_R16G16_UNORM = 35,
+	DXGI_FORMAT_R16G16_UINT = 36,
+	DXGI_FORMAT_R16G16_SNORM = 37,
+	DXGI_FORMAT_R16G16_SINT = 38,
+	DXGI_FORMAT_D32_FLOAT = 40,
+	DXGI_FORMAT_R32_FLOAT = 41,
+	DXGI_FORMAT_R32_UINT = 42,
+	DXGI_FORMAT_R32_SINT = 43,
+	DXGI_FORMAT_R8G8_UNORM = 49,
+	DXGI_FORMAT_R8G8_UINT = 50,
+	DXGI_FORMAT_R8G8_SNORM = 51,
+	DXGI_FORMAT_R8G8_SINT = 52,
+	DXGI_FORMAT_R16_FLOAT = 54,
+	DXGI_FORMAT_D16_UNORM = 55,
+	DXGI_FORMAT_R16_UNORM = 56,
+	DXGI_FORMAT_R16_UINT = 57,
+	DXGI_FORMAT_R16_SNORM = 58,
+	DXGI_FORMAT_R16_SINT = 59,
+	DXGI_FORMAT_R8_UNORM = 61,
+	DXGI_FORMAT_R8_UINT = 62,
+	DXGI_FORMAT_R8_SNORM = 63,
+	DXGI_FORMAT_R8_SINT = 64,
+	DXGI_FORMAT_A8_UNORM = 65,
+	DXGI_FORMAT_R9G9B9E5_SHAREDEXP = 67,
+	DXGI_FORMAT_BC1_UNORM = 71,
+	DXGI_FORMAT_BC1_UNORM_SRGB = 72,
+	DXGI_FORMAT_BC2_UNORM = 74,
+	DXGI_FORMAT_BC2_UNORM_SRGB = 75,
+	DXGI_FORMAT_BC3_UNORM = 77,
+	DXGI_FORMAT_BC3_UNORM_SRGB = 78,
+	DXGI_FORMAT_BC4_UNORM = 80,
+	DXGI_FORMAT_BC4_SNORM = 81,
+	DXGI_FORMAT_BC5_UNORM = 83,
+	DXGI_FORMAT_BC5_SNORM = 84,
+	DXGI_FORMAT_R10G10B10_XR_BIAS_A2_UNORM = 89,
+	DXGI_FORMAT_BC6H_UF16 = 95,
+	DXGI_FORMAT_BC6H_SF16 = 96,
+	DXGI_FORMAT_BC7_UNORM = 98,
+	DXGI_FORMAT_BC7_UNORM_SRGB = 99,
+};
+
+#define sprintf_s snprintf
+
+inline int memcpy_s(void* dest, size_t destSize, const void* src, size_t count)
+{
+	if (count > destSize)
+		return -1;
+
+	memcpy(dest, src, count);
+	return 0;
+}
+
+inline unsigned char _BitScanReverse(unsigned long* index, unsigned long mask)
+{
+	if (!mask)
+		return 0;
+
+	*index = 63 - __builtin_clzll(mask);
+	return 1;
+}
+
+void GetSystemTimeAsFileTime(FILETIME* ft);
+DWORD GetEnvironmentVariableA(const char* name, char* buffer, DWORD size);
+#endif
+
+// difference between the FILETIME epoch (1601) and the unix epoch (1970), in 100 nanosecond intervals
+#define FILETIME_UNIX_EPOCH 116444736000000000ull
+
+#ifdef _WIN32
+typedef HANDLE PlatformFile_t;
+#define PLATFORM_INVALID_FILE INVALID_HANDLE_VALUE
+#else
+typedef int PlatformFile_t;
+#define PLATFORM_INVALID_FILE -1
+#endif
+
+// a file that has been mapped into memory for reading, see Platform::MapInputFile
+struct MappedFile_t
+{
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+
+	PlatformFile_t file = PLATFORM_INVALID_FILE;
+#ifdef _WIN32
+	HANDLE hMapping = NULL;
+#endif
+};
+
+// a process started by Platform::StartProcess
+struct PlatformProcess_t
+{
+#ifdef _WIN32
+	HANDLE hProcess = NULL;
+	HANDLE hThread = NULL;
+#else
+	int pid = -1;
+#endif
+};
+
+namespace Platform
+{
+	PlatformFile_t CreateOutputFile(const std::string& path, uint64_t fileSize, bool bDirect = false);
+	PlatformFile_t OpenOutputFile(const std::string& path);
+	bool WriteFileAt(PlatformFile_t file, uint64_t offset, const void* data, uint64_t size);
+	bool SetFileSize(PlatformFile_t file, uint64_t fileSize);
+	void CloseFile(PlatformFile_t file);
+
+	bool MapInputFile(const std::string& path, MappedFile_t& mapped);
+	void UnmapInputFile(MappedFile_t& mapped);
+
+	std::string GetExecutablePath();
+	bool StartProcess(const std::string& exePath, const std::vector<std::string>& args, PlatformProcess_t& process);
+	int WaitForProcess(PlatformProcess_t& process);
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#define PAGE_OWNER_NONE   0xFFFFFFFF
+#define PAGE_OWNER_SHARED 0xFFFFFFFE
+
+// an uncompressed v8 rpak that has been read back from disk
+struct RPakFile_t
+{
+	std::vector<uint8_t> fileData;
+
+	RPakFileHeaderV8 header{};
+	std::vector<std::string> starpakPaths;
+	std::vector<std::string> optStarpakPaths;
+	std::vector<RPakVirtualSegment> segments;
+	std::vector<RPakPageInfo> pages;
+	std::vector<RPakDescriptor> descriptors;
+	std::vector<RPakAssetEntryV8> assets;
+	std::vector<RPakGuidDescriptor> guidDescriptors;
+	std::vector<RPakRelationBlock> relations;
+
+	// offset of every page's data within fileData
+	std::vector<size_t> pageOffsets;
+
+	// index of the asset that owns each page
+	// PAGE_OWNER_SHARED if more than one asset's page range contains the page
+	std::vector<uint32_t> pageOwners;
+};
+
+namespace RePak
+{
+	bool ReadRPakFile(const std::string& path, RPakFile_t& pak);
+	bool ExtractAssetRecord(const RPakFile_t& pak, uint32_t assetIdx, AssetRecord_t& record);
+};
@@ -2,13 +2,148 @@
 
 #define DEFAULT_RPAK_NAME "new"
 
-static std::vector<RPakVirtualSegment> g_vvSegments{};
-static std::vector<RPakPageInfo> g_vPages{};
-static std::vector<RPakDescriptor> g_vDescriptors{};
-static std::vector<RPakGuidDescriptor> g_vGuidDescriptors{};
-static std::vector<RPakRelationBlock> g_vFileRelations{};
-static std::vector<RPakRawDataBlock> g_vSubHeaderBlocks{};
-static std::vector<RPakRawDataBlock> g_vRawDataBlocks{};
+struct SharedBuildState_t;
+struct AssetTypeHandler_t;
+class AssetGraph;
+class BuildCache;
+struct BuildStateMark_t;
+
+//
+// everything that goes into a single rpak and its starpaks
+// each build has its own context, so that several rpaks can be built at the same time by one process
+//
+struct RPakBuildContext_t
+{
+	std::vector<RPakVirtualSegment> segments;
+	std::vector<RPakPageInfo> pages;
+	std::vector<RPakDescriptor> descriptors;
+	std::vector<RPakGuidDescriptor> guidDescriptors;
+	std::vector<RPakRelationBlock> fileRelations;
+	std::vector<RPakRawDataBlock> subHeaderBlocks;
+	std::vector<RPakRawDataBlock> rawDataBlocks;
+
+	std::string assetsDir;
+
+	// written to instead of the map's output directory when it isn't empty (see RePak::GetOutputDir)
+	std::string outputDir;
+
+	std::vector<std::string> starpakPaths;
+	std::vector<std::string> optStarpakPaths;
+	std::vector<SRPkDataEntry> starpakEntries;
+	uint64_t nextStarpakOffset = 0x1000;
+
+	// caches shared with every other build in the process, if there are any
+	SharedBuildState_t* pShared = nullptr;
+
+	// source files given to the build in memory, keyed by normalised path (see Utils::NormalisePath)
+	// these are read instead of the files on disk and are kept when the context is reset
+	std::unordered_map<std::string, std::shared_ptr<const std::vector<uint8_t>>> memoryFiles;
+
+	// layout options of the map, see RePak::ApplyStableLayout
+	bool bStableLayout = false;
+	uint32_t layoutSlotSize = 0; // only keeps page offsets while no asset is added or removed, the header tables aren't padded
+
+	// position of each asset guid in the expected load order, see RePak::SetLoadOrder
+	// assets with a load order come before the rest with the stable layout
+	std::unordered_map<uint64_t, uint32_t> loadOrder;
+
+	// reproducible builds write the same bytes for the same inputs (see RePak::GetCreatedTime)
+	bool bReproducible = false;
+	uint64_t inputHash = 0; // hash of the map file
+
+	// starpaks and large rpaks are written without going through the file cache (see DirectWriter)
+	bool bDirectIO = false;
+
+	// set for builds that have to run every asset handler, so the map's build cache isn't used (see RePak::VerifyReproducibleBuild)
+	bool bNoBuildCache = false;
+
+	// message of the last error printed during the build
+	std::string sLastError;
+
+	// hash of each source file that the build cache has looked at during the build, keyed by normalised path (see BuildCache::MakeKey)
+	std::unordered_map<std::string, uint64_t> sourceFileHashes;
+
+	RPakBuildContext_t() = default;
+	RPakBuildContext_t(const RPakBuildContext_t&) = delete;
+	RPakBuildContext_t& operator=(const RPakBuildContext_t&) = delete;
+
+	~RPakBuildContext_t() { Reset(); };
+
+	// purpose: copy the options and inputs of another context, but none of its build state
+	// used to write part of a build in its own context the same way as the build itself
+	void CopyOptions(const RPakBuildContext_t& other)
+	{
+		assetsDir = other.assetsDir;
+		outputDir = other.outputDir;
+		pShared = other.pShared;
+		memoryFiles = other.memoryFiles;
+
+		bStableLayout = other.bStableLayout;
+		layoutSlotSize = other.layoutSlotSize;
+		loadOrder = other.loadOrder;
+
+		bReproducible = other.bReproducible;
+		inputHash = other.inputHash;
+		bDirectIO = other.bDirectIO;
+		bNoBuildCache = other.bNoBuildCache;
+	}
+
+	// purpose: free the page data once the rpak has been written, keeping the tables and the starpak data
+	void ReleasePageData()
+	{
+		for (auto& it : rawDataBlocks)
+			delete[] it.dataPtr;
+
+		rawDataBlocks.clear();
+	}
+
+	// purpose: free every page and starpak data block and clear the context so another rpak can be built with it
+	void Reset()
+	{
+		for (auto& it : rawDataBlocks)
+			delete[] it.dataPtr;
+
+		for (auto& it : starpakEntries)
+			delete[] it.dataPtr;
+
+		segments.clear();
+		pages.clear();
+		descriptors.clear();
+		guidDescriptors.clear();
+		fileRelations.clear();
+		subHeaderBlocks.clear();
+		rawDataBlocks.clear();
+
+		starpakPaths.clear();
+		optStarpakPaths.clear();
+		starpakEntries.clear();
+		nextStarpakOffset = 0x1000;
+
+		sLastError.clear();
+		sourceFileHashes.clear();
+	}
+};
+
+// the build context that the calling thread is currently building into
+extern thread_local RPakBuildContext_t* g_pBuildContext;
+
+// makes a build context the current one for the calling thread until the scope ends
+class BuildContextScope
+{
+	RPakBuildContext_t* pPrevContext;
+
+public:
+	BuildContextScope(RPakBuildContext_t& ctx) : pPrevContext(g_pBuildContext) { g_pBuildContext = &ctx; };
+	~BuildContextScope() { g_pBuildContext = pPrevContext; };
+};
+
+// where everything in an rpak goes, worked out before any of it is written (see RePak::PlanRPakFile)
+struct RPakFilePlan_t
+{
+	uint64_t tablesSize = 0; // size of the header and tables, which the page data follows
+	uint64_t fileSize = 0;
+	std::vector<uint64_t> pageOffsets; // file offset of each raw data block
+};
 
 struct _vseginfo_t
 {
@@ -21,13 +156,50 @@ namespace RePak
 	_vseginfo_t CreateNewSegment(uint32_t size, uint32_t flags_maybe, uint32_t alignment, RPakVirtualSegment& seg, uint32_t vsegAlignment = -1);
 	void AddStarpakReference(std::string path);
 	uint64_t AddStarpakDataEntry(SRPkDataEntry block);
+	uint64_t AddPaddedStarpakDataEntry(SRPkDataEntry block);
+	void SetStarpakDataOffset(uint64_t offset);
+	uint64_t GetStarpakDataEnd(const std::string& path);
+	void WriteStarpak(std::ostream& out);
+	bool AppendStarpak(const std::string& path);
 	void AddRawDataBlock(RPakRawDataBlock block);
 	void RegisterDescriptor(uint32_t pageIdx, uint32_t pageOffset);
 	void RegisterGuidDescriptor(uint32_t pageIdx, uint32_t pageOffset);
 	size_t AddFileRelation(uint32_t assetIdx, uint32_t count = 1);
 	RPakAssetEntryV8* GetAssetByGuid(std::vector<RPakAssetEntryV8>* assets, uint64_t guid, uint32_t* idx);
-};
+	bool FinalizeDescriptors(std::vector<RPakAssetEntryV8>& assetEntries);
+	void GenerateFileRelationsFromGuids(std::vector<RPakAssetEntryV8>& assetEntries);
+	void GenerateFileRelationsFromGuids(std::vector<RPakAssetEntryV8>& assetEntries, const std::vector<const uint8_t*>& pageData);
+	uint32_t GetAssetTypeFourCC(const rapidjson::Value& type);
+
+	bool LoadMapFile(const std::filesystem::path& mapPath, std::vector<char>& mapBuf, rapidjson::Document& doc);
+	void SetAssetsDir(rapidjson::Document& doc, const std::filesystem::path& mapPath);
+	std::string GetRPakName(rapidjson::Document& doc);
+	std::string GetOutputDir(rapidjson::Document& doc, const std::filesystem::path& mapPath);
+	uint64_t GetRPakTablesSize(const std::vector<RPakAssetEntryV8>& assetEntries);
+	void WriteRPakTables(BufferedWriter& out, RPakFileHeaderV8& rpakHeader, std::vector<RPakAssetEntryV8>& assetEntries, uint64_t pageDataSize);
+	void WriteRPak(std::ostream& out, RPakFileHeaderV8& rpakHeader, std::vector<RPakAssetEntryV8>& assetEntries);
+	void PlanRPakFile(const std::vector<RPakAssetEntryV8>& assetEntries, RPakFilePlan_t& plan);
+	bool WriteRPakFile(const std::string& path, RPakFileHeaderV8& rpakHeader, std::vector<RPakAssetEntryV8>& assetEntries);
+	std::string WriteRPakImage(RPakFileHeaderV8& rpakHeader, std::vector<RPakAssetEntryV8>& assetEntries);
+	bool WriteStarpakFile(const std::string& path);
+	void SetOutputOptions(rapidjson::Document& doc);
+	size_t PatchFile(const std::string& path, const std::string& newData, const void* oldData, size_t oldSize, size_t headerSize);
+
+	void SetLayoutOptions(rapidjson::Document& doc);
+	void SetReproducibleOptions(rapidjson::Document& doc);
+	uint64_t GetCreatedTime();
+	int PlanMapFile(const char* mapFile);
+	int VerifyReproducibleBuild(const char* mapFile, uint32_t shardCount);
+	bool SetLoadOrder(rapidjson::Document& doc, const std::filesystem::path& mapPath, AssetGraph& assetGraph);
+	void ApplyStableLayout(const std::vector<BuildStateMark_t>& marks, std::vector<RPakAssetEntryV8>& assetEntries);
+	bool FinalizeLayout(AssetGraph* pAssetGraph, const std::vector<BuildStateMark_t>& marks, std::vector<RPakAssetEntryV8>& assetEntries);
+
+	std::shared_ptr<const std::vector<uint8_t>> ReadInputFile(const std::string& path);
+	bool ReadInputFileHeader(const std::string& path, void* header, size_t headerSize, uint64_t* pFileSize = nullptr);
+	bool BuildAssets(AssetGraph& assetGraph, const std::vector<const AssetTypeHandler_t*>& usedAssetTypes, std::vector<RPakAssetEntryV8>& assetEntries,
+		BuildCache* buildCache, bool bExplainCache, std::vector<BuildStateMark_t>* pMarks = nullptr);
 
-#define ASSET_HANDLER(ext, file, assetEntries, func) \
-	if (file["$type"].GetStdString() == std::string(ext)) \
-		func(&assetEntries, file["path"].GetString(), file);
\ No newline at end of file
+	int UpdateRPak(const char* rpakPath, const char* mapFile);
+	int MergeRPaks(const std::vector<std::string>& rpakPaths, const std::string& outPath);
+	int WatchMapFile(const char* mapFile);
+};
\ No newline at end of file
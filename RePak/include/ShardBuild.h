@@ -0,0 +1,29 @@
+#pragma once
+
+#define SHARD_FILE_MAGIC 'HSPR'
+#define SHARD_FILE_VERSION 1
+
+// what a shard did with one of the assets assigned to it
+enum class ShardAssetState : uint32_t
+{
+	SKIPPED = 0, // the handler didn't add anything
+	RECORD = 1, // the asset was built and is stored as a relocatable asset record
+	REBUILD = 2, // the asset was built but can't be relocated, so it is built again when the shards are linked
+};
+
+struct ShardFileHeader_t
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t mapHash; // hash of the map file that the shard was built from
+	uint32_t nodeCount; // number of assets in the whole map
+	uint32_t shardIdx;
+	uint32_t shardCount;
+};
+
+namespace RePak
+{
+	bool BuildShard(const char* mapFile, uint32_t shardIdx, uint32_t shardCount, const char* shardFile);
+	bool LinkShards(const char* mapFile, const std::vector<std::string>& shardFiles, MapBuildResult_t& result);
+	int BuildMapFileSharded(const char* mapFile, uint32_t shardCount);
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+//
+// in-memory cache of source files that are read by more than one build
+// the oldest files are dropped once the cache grows past its size limit
+//
+class InputFileCache
+{
+	std::mutex mutex;
+	std::unordered_map<std::string, std::shared_ptr<const std::vector<uint8_t>>> files;
+	std::vector<std::string> insertOrder;
+	size_t nextEvictIdx = 0;
+
+	uint64_t totalSize = 0;
+	uint64_t maxSize;
+
+public:
+	InputFileCache(uint64_t maxSizeBytes) : maxSize(maxSizeBytes) {};
+
+	std::shared_ptr<const std::vector<uint8_t>> Get(const std::string& path);
+};
+
+// result of building a single map file
+struct MapBuildResult_t
+{
+	std::string rpakName;
+	size_t assetCount = 0;
+	uint64_t rpakSize = 0;
+	uint64_t starpakSize = 0;
+};
+
+//
+// caches shared between every rpak built by the process
+//
+struct SharedBuildState_t
+{
+	InputFileCache inputFiles;
+
+	// build caches keyed by their directory, so that maps using the same cache directory share the same instance
+	std::mutex buildCacheMutex;
+	std::unordered_map<std::string, std::unique_ptr<BuildCache>> buildCaches;
+
+	SharedBuildState_t(uint64_t maxInputCacheSize) : inputFiles(maxInputCacheSize) {};
+
+	BuildCache* GetBuildCache(const std::string& dir, uint64_t maxSizeBytes, bool bExplain);
+};
+
+namespace RePak
+{
+	uint64_t GetAssetGuid(const AssetTypeHandler_t* handler, const char* assetPath, rapidjson::Value& mapEntry);
+
+	bool WriteMapOutput(const std::string& sOutputDir, const std::string& sRpakName, std::vector<RPakAssetEntryV8>& assetEntries, MapBuildResult_t& result);
+	bool WriteBuiltMap(rapidjson::Document& doc, const std::filesystem::path& mapPath, AssetGraph& assetGraph, const std::vector<BuildStateMark_t>& marks,
+		std::vector<RPakAssetEntryV8>& assetEntries, const std::string& sOutputDir, const std::string& sRpakName, MapBuildResult_t& result);
+	bool BuildMapFile(const char* mapFile, bool bExplainCache, MapBuildResult_t& result);
+	int BuildAll(const std::vector<const char*>& mapFiles, uint32_t nThreads, uint64_t maxInputCacheSize, bool bExplainCache);
+};
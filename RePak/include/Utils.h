@@ -2,29 +2,24 @@
 
 namespace Utils
 {
-	uintmax_t GetFileSize(std::string filename);
-	
 	size_t PadBuffer(char** buf, size_t size, size_t alignment);
 
-	size_t WriteStringVector(BinaryIO& out, std::vector<std::string>& dataVector);
-
 	FILETIME GetFileTimeBySystem();
 
+	uint64_t HashData(const void* data, size_t size, uint64_t seed = 0xcbf29ce484222325);
+	uint64_t HashFile(const std::string& filePath, uint64_t seed = 0xcbf29ce484222325);
+
 	void AppendSlash(std::string& in);
+	std::string NormalisePath(const std::filesystem::path& path);
 };
 
 // non-fatal errors/issues
-void Warning(const char* fmt, ...);
+void Warning(const char* fmt, ...) PRINTF_FORMAT(1, 2);
 // fatal errors
-void Error(const char* fmt, ...);
+void Error(const char* fmt, ...) PRINTF_FORMAT(1, 2);
 // general prints for Release
-void Log(const char* fmt, ...);
+void Log(const char* fmt, ...) PRINTF_FORMAT(1, 2);
 // any prints that shouldnt be used in Release
-void Debug(const char* fmt, ...);
-
-#define WRITE_VECTOR(out, dataVector) for (auto it = dataVector.begin(); it != dataVector.end(); ++it) \
-{ \
-	out.write(*it); \
-}
+void Debug(const char* fmt, ...) PRINTF_FORMAT(1, 2);
 
 #define FILE_EXISTS(path) std::filesystem::exists(path)
\ No newline at end of file
@@ -1,24 +1,27 @@
 #pragma once
 
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>
+#include "Platform.h"
 
 #include <filesystem>
 #include <iostream>
 #include <unordered_map>
-#include <sysinfoapi.h>
 #include <vector>
+#include <memory>
+#include <array>
 #include <cstdint>
+#include <cinttypes>
 #include <string>
 #include <fstream>
+#include <mutex>
 #include <rapidcsv/rapidcsv.h>
 #include <rapidjson/document.h>
-#include <rapidjson/istreamwrapper.h>
 
-#include "rmem.h"
 #include "rpak.h"
 #include "rtech.h"
 
-#include "BinaryIO.h"
+#include "BinaryReader.h"
+#include "BufferedWriter.h"
 #include "RePak.h"
+#include "rmem.h"
+#include "HeaderDescriptors.h"
 #include "Utils.h"
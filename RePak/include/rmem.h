@@ -1,27 +1,79 @@
 #pragma once
 
+// bounds checks on every rmem access are on in debug builds and compiled out of release builds,
+// unless a buffer asks for a policy explicitly
+#ifndef RMEM_CHECKED
+#ifdef _DEBUG
+#define RMEM_CHECKED 1
+#else
+#define RMEM_CHECKED 0
+#endif
+#endif
+
 enum class rseekdir : uint8_t {
 	beg, // from beginning
 	cur, // from current position
-	end  // from end of the buffer (requires size to be set)
+	end  // from end of the buffer
+};
+
+// throws on any access outside of the buffer
+struct rmem_checked
+{
+	static void check(bool inBounds, const char* err)
+	{
+		if (!inBounds)
+			throw err;
+	}
 };
 
-class rmem
+// trusts the caller, so reads and writes are plain loads and stores
+struct rmem_unchecked
+{
+	static void check(bool, const char*) {};
+};
+
+using rmem_default_policy = std::conditional_t<RMEM_CHECKED, rmem_checked, rmem_unchecked>;
+
+//
+// cursor over a page buffer (or any other block of memory) that values are written to and read from
+// Policy decides whether accesses are bounds checked, see rmem_checked and rmem_unchecked.
+// buffers that know which page they hold can write pointers that register their own descriptor (see writePtr)
+//
+template <typename Policy = rmem_default_policy>
+class rmem_t
 {
 private:
 	void* _pbase = nullptr; // the original pointer. equal to _pbuf - curpos
 	void* _pbuf = nullptr; // active buffer pointer. _pbase + _curpos
 	unsigned __int64 _curpos = 0;
 	unsigned __int64 _bufsize = 0;
+	uint32_t _pageidx = -1; // index of the page that the buffer holds, if it holds one
+
+	// purpose: check that size bytes from offset are inside of the buffer
+	void checkRange(unsigned __int64 offset, unsigned __int64 size, const char* err) const
+	{
+		Policy::check(offset <= _bufsize && size <= _bufsize - offset, err);
+	}
+
+	void advance(unsigned __int64 size)
+	{
+		_pbuf = static_cast<char*>(_pbuf) + size;
+		_curpos += size;
+	}
 
 public:
-	rmem(void* pbuf, unsigned __int64 bufsize = -1)
+	rmem_t(void* pbuf, unsigned __int64 bufsize)
 	{
 		this->_pbase = pbuf;
 		this->_pbuf = pbuf;
 		this->_bufsize = bufsize;
 	}
 
+	rmem_t(void* pbuf, unsigned __int64 bufsize, uint32_t pageIdx) : rmem_t(pbuf, bufsize)
+	{
+		this->_pageidx = pageIdx;
+	}
+
 	inline void setBufferSize(unsigned __int64 new_size)
 	{
 		this->_bufsize = new_size;
@@ -29,41 +81,51 @@ public:
 
 	void seek(unsigned __int64 pos, rseekdir dir)
 	{
-		if (dir == rseekdir::cur && (this->_curpos + pos) < this->_bufsize)
+		unsigned __int64 newpos = pos;
+
+		if (dir == rseekdir::cur)
 		{
-			this->_curpos += pos;
-			char* pbuf = (char*)this->_pbuf;
-			pbuf += pos;
+			checkRange(_curpos, pos, "failed to seek in buffer: attempted to seek past the end of the buffer");
+			newpos = _curpos + pos;
 		}
-		else if (dir == rseekdir::beg && pos < this->_bufsize)
+		else if (dir == rseekdir::end)
 		{
-			this->_curpos = pos;
-			char* pbase = (char*)this->_pbase;
-			this->_pbuf = pbase + pos;
+			Policy::check(pos <= _bufsize, "failed to seek in buffer: attempted to seek before the start of the buffer");
+			newpos = _bufsize - pos;
 		}
+		else
+			Policy::check(pos <= _bufsize, "failed to seek in buffer: attempted to seek past the end of the buffer");
+
+		_curpos = newpos;
+		_pbuf = static_cast<char*>(_pbase) + newpos;
+	}
+
+	// moves the position forward to the next multiple of alignment, filling the bytes that are skipped
+	void align(unsigned __int64 alignment, uint8_t value = 0)
+	{
+		unsigned __int64 padding = (alignment - (_curpos % alignment)) % alignment;
+		fill(value, padding);
 	}
 
 	void* getBasePtr() { return this->_pbase; };
 	void* getPtr() { return this->_pbuf; };
 	unsigned __int64 getPosition() { return this->_curpos; };
+	unsigned __int64 getBufferSize() { return this->_bufsize; };
 
 public: // read/write
-	
+
 	// params:
 	// advancebuf - whether the current position should be updated after reading
 	template <typename T>
 	T read(bool advancebuf=true)
 	{
-		if (_curpos + sizeof(T) > _bufsize)
-			throw "failed to read from buffer: attempted to read past the end of the buffer";
+		checkRange(_curpos, sizeof(T), "failed to read from buffer: attempted to read past the end of the buffer");
 
-		T val = *(T*)_pbuf;
+		T val;
+		memcpy(&val, _pbuf, sizeof(T));
 
 		if (advancebuf)
-		{
-			_pbuf = static_cast<char*>(_pbuf) + sizeof(T);
-			_curpos += sizeof(T);
-		}
+			advance(sizeof(T));
 
 		return val;
 	}
@@ -71,26 +133,58 @@ public: // read/write
 	template<typename T>
 	void write(T val)
 	{
-		if (_curpos + sizeof(T) > _bufsize)
-			throw "failed to write to buffer: attempted to write past the end of the buffer";
-
-		*(T*)_pbuf = val;
+		checkRange(_curpos, sizeof(T), "failed to write to buffer: attempted to write past the end of the buffer");
 
-		_pbuf = static_cast<char*>(_pbuf) + sizeof(T);
-		_curpos += sizeof(T);
+		memcpy(_pbuf, &val, sizeof(T));
+		advance(sizeof(T));
 	}
 
 	template<typename T>
 	void write(T val, unsigned __int64 offset)
 	{
-		if (offset > _bufsize)
-			throw "failed to write to buffer: attempted to write past the end of the buffer";
+		checkRange(offset, sizeof(T), "failed to write to buffer: attempted to write past the end of the buffer");
+
+		memcpy(static_cast<char*>(_pbase) + offset, &val, sizeof(T));
+	}
+
+	// writes count values in one go
+	template<typename T>
+	void writeSpan(const T* data, unsigned __int64 count)
+	{
+		Policy::check(count <= (_bufsize - min(_curpos, _bufsize)) / sizeof(T), "failed to write to buffer: attempted to write past the end of the buffer");
 
+		memcpy(_pbuf, data, count * sizeof(T));
+		advance(count * sizeof(T));
+	}
+
+	// writes the same byte size times
+	void fill(uint8_t value, unsigned __int64 size)
+	{
+		checkRange(_curpos, size, "failed to write to buffer: attempted to write past the end of the buffer");
 
-		*(T*)((char*)_pbase + offset) = val;
+		memset(_pbuf, value, size);
+		advance(size);
 	}
 
-//private: // internal helper stuff
-	//void _AdvanceBuffer(unsigned __int64 amount);
+	// writes a pointer and registers the descriptor for it, so it gets converted when the page is loaded
+	// the buffer has to have been given the index of its page
+	void writePtr(const RPakPtr& ptr)
+	{
+		Policy::check(_pageidx != -1, "failed to write pointer to buffer: buffer doesn't hold a page");
+
+		const unsigned __int64 offset = _curpos;
+
+		write(ptr);
+		RePak::RegisterDescriptor(_pageidx, (uint32_t)offset);
+	}
+
+	void writePtr(const RPakPtr& ptr, unsigned __int64 offset)
+	{
+		Policy::check(_pageidx != -1, "failed to write pointer to buffer: buffer doesn't hold a page");
+
+		write(ptr, offset);
+		RePak::RegisterDescriptor(_pageidx, (uint32_t)offset);
+	}
 };
 
+using rmem = rmem_t<>;
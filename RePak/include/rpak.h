@@ -1,6 +1,6 @@
 #pragma once
 
-#include <d3d11.h>
+#include "Platform.h"
 
 struct Vector3
 {
@@ -26,7 +26,7 @@ struct DDS_HEADER {
 	uint32_t caps3;
 	uint32_t caps4;
 	uint32_t reserved2;
-} dds_header;
+};
 
 struct SRPkFileEntry
 {
@@ -1,10 +1,34 @@
 #include "pch.h"
 #include "Assets.h"
 
-namespace Assets
+// all asset types that can be used in map files, keyed by the fourcc of their "$type" string
+// new asset types only need to be added here to become usable
+static std::unordered_map<uint32_t, AssetTypeHandler_t> s_AssetTypeHandlers =
 {
-	std::string g_sAssetsDir;
-	std::vector<std::string> g_vsStarpakPaths;
-	std::vector<std::string> g_vsOptStarpakPaths;
-	std::vector<SRPkDataEntry> g_vSRPkDataEntries;
+	{ 'rtxt', { 'rtxt', AssetType::TEXTURE, Assets::AddTextureAsset, Assets::GetTextureGuid, nullptr, Assets::GetTextureSourceFiles, nullptr, nullptr, Assets::PlanTextureAsset } },
+	{ 'gmiu', { 'gmiu', AssetType::UIMG, Assets::AddUIImageAsset, Assets::GetUIImageGuid, Assets::GetUIImageDependencies, Assets::GetUIImageSourceFiles, Assets::BeginUIImageBatch, Assets::EndUIImageBatch, Assets::PlanUIImageAsset } },
+	{ 'hctP', { 'hctP', AssetType::PTCH, Assets::AddPatchAsset, Assets::GetPatchGuid, nullptr, Assets::GetPatchSourceFiles, nullptr, nullptr, Assets::PlanPatchAsset } },
+	{ 'lbtd', { 'lbtd', AssetType::DTBL, Assets::AddDataTableAsset, Assets::GetDataTableGuid, nullptr, Assets::GetDataTableSourceFiles, nullptr, nullptr, Assets::PlanDataTableAsset } },
+	{ 'ldmr', { 'ldmr', AssetType::RMDL, Assets::AddModelAsset, Assets::GetModelGuid, Assets::GetModelDependencies, Assets::GetModelSourceFiles, nullptr, nullptr, Assets::PlanModelAsset } },
+	{ 'ltam', { 'ltam', AssetType::MATL, Assets::AddMaterialAsset, Assets::GetMaterialGuid, Assets::GetMaterialDependencies, nullptr, nullptr, nullptr, Assets::PlanMaterialAsset } },
+	// copies an already built asset of any type out of an existing rpak
+	{ 'ypoc', { 'ypoc', (AssetType)0, Assets::AddCopiedAsset, Assets::GetCopiedAssetGuid, Assets::GetCopiedAssetDependencies, Assets::GetCopiedAssetSourceFiles, nullptr, Assets::EndCopiedAssetBatch, nullptr, Assets::GetCopiedAssetSourceHash } },
+};
+
+// purpose: register a handler for a map file asset type, replacing any existing handler for it
+void Assets::RegisterAssetType(const AssetTypeHandler_t& handler)
+{
+	s_AssetTypeHandlers[handler.mapType] = handler;
+}
+
+// purpose: find the handler for a map file asset type
+// returns: pointer to the handler, or nullptr if the type isn't registered
+const AssetTypeHandler_t* Assets::GetAssetTypeHandler(uint32_t mapType)
+{
+	auto it = s_AssetTypeHandlers.find(mapType);
+
+	if (it == s_AssetTypeHandlers.end())
+		return nullptr;
+
+	return &it->second;
 }
\ No newline at end of file
@@ -0,0 +1,81 @@
+#include "pch.h"
+#include "BinaryReader.h"
+
+BinaryReader::~BinaryReader()
+{
+    close();
+}
+
+// purpose: map a file into memory for the reader to read from
+// returns: true on success
+bool BinaryReader::open(const std::string& path)
+{
+    close();
+
+    if (!Platform::MapInputFile(path, mapped))
+        return false;
+
+    buffer = mapped.data;
+    bufferSize = mapped.size;
+
+    return true;
+}
+
+// purpose: unmap the file, if the reader opened one
+void BinaryReader::close()
+{
+    Platform::UnmapInputFile(mapped);
+
+    buffer = nullptr;
+    bufferSize = 0;
+    position = 0;
+}
+
+// purpose: copy the next bytes of the buffer
+void BinaryReader::readBytes(void* out, size_t size)
+{
+    if (size)
+        memcpy(out, take(size), size);
+}
+
+// purpose: read a null terminated string
+// returns: view of the string inside the buffer, without its null terminator
+std::string_view BinaryReader::readString()
+{
+    const void* end = remaining() ? memchr(buffer + position, '\0', remaining()) : nullptr;
+
+    if (!end)
+        throw "failed to read from buffer: string isn't terminated before the end of the buffer";
+
+    size_t length = static_cast<const uint8_t*>(end) - (buffer + position);
+    const char* str = reinterpret_cast<const char*>(take(length + 1));
+
+    return std::string_view(str, length);
+}
+
+// purpose: read a table of null terminated strings that takes up tableSize bytes
+// empty strings are the padding at the end of the table, so they are skipped
+void BinaryReader::readStrings(size_t tableSize, std::vector<std::string>& strings)
+{
+    if (tableSize > remaining())
+        throw "failed to read from buffer: attempted to read past the end of the buffer";
+
+    const size_t tableEnd = position + tableSize;
+
+    while (position < tableEnd)
+    {
+        const void* end = memchr(buffer + position, '\0', tableEnd - position);
+
+        // anything after the last null terminator isn't part of a string
+        if (!end)
+        {
+            position = tableEnd;
+            break;
+        }
+
+        std::string_view str = readString();
+
+        if (!str.empty())
+            strings.emplace_back(str);
+    }
+}
@@ -0,0 +1,144 @@
+#include "pch.h"
+#include "BufferedWriter.h"
+
+BufferedWriter::BufferedWriter(size_t bufferSize) : bufferSize(bufferSize)
+{
+    buffer = static_cast<uint8_t*>(operator new[](bufferSize, std::align_val_t(BUFFERED_WRITER_ALIGNMENT)));
+}
+
+BufferedWriter::BufferedWriter(std::ostream& out, size_t bufferSize) : BufferedWriter(bufferSize)
+{
+    this->out = &out;
+}
+
+BufferedWriter::~BufferedWriter()
+{
+    close();
+    operator delete[](buffer, std::align_val_t(BUFFERED_WRITER_ALIGNMENT));
+}
+
+// purpose: open a file for the writer to write to, replacing its contents
+// the file stream isn't buffered itself, since everything written to it has already been through the writer's buffer
+// returns: true on success
+bool BufferedWriter::open(const std::string& path)
+{
+    close();
+
+    file.rdbuf()->pubsetbuf(nullptr, 0);
+    file.open(path, std::ios::binary);
+
+    if (!file.is_open())
+        return false;
+
+    out = &file;
+    position = 0;
+    bFailed = false;
+
+    return true;
+}
+
+// purpose: flush the buffer and close the file, if the writer opened one
+// returns: false if any write failed
+bool BufferedWriter::close()
+{
+    flush();
+
+    if (file.is_open())
+    {
+        file.close();
+        bFailed |= file.fail();
+    }
+
+    return !bFailed;
+}
+
+// purpose: pass everything in the buffer on to the stream
+void BufferedWriter::flush()
+{
+    if (bufferUsed == 0)
+        return;
+
+    const size_t size = bufferUsed;
+    bufferUsed = 0;
+
+    writeDirect(buffer, size);
+}
+
+void BufferedWriter::writeDirect(const void* data, size_t size)
+{
+    if (!out)
+    {
+        bFailed = true;
+        return;
+    }
+
+    out->write(static_cast<const char*>(data), size);
+
+    if (out->fail())
+        bFailed = true;
+}
+
+// purpose: write bytes to the stream
+// writes that don't fit in the rest of the buffer flush it first, and writes bigger than the buffer skip it
+void BufferedWriter::writeBytes(const void* data, size_t size)
+{
+    if (size == 0)
+        return;
+
+    position += size;
+
+    if (size > bufferSize - bufferUsed)
+    {
+        flush();
+
+        if (size >= bufferSize)
+        {
+            writeDirect(data, size);
+            return;
+        }
+    }
+
+    memcpy(buffer + bufferUsed, data, size);
+    bufferUsed += size;
+}
+
+// purpose: write many blocks one after another, such as every page of an rpak
+// small blocks are gathered in the buffer and written together, big blocks go to the stream as they are
+void BufferedWriter::writeBlocks(const BufferedWriteBlock_t* blocks, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        writeBytes(blocks[i].data, blocks[i].size);
+}
+
+// purpose: write the same byte a number of times
+void BufferedWriter::writePadding(size_t size, uint8_t value)
+{
+    position += size;
+
+    while (size > 0)
+    {
+        if (bufferUsed == bufferSize)
+            flush();
+
+        size_t chunkSize = min(size, bufferSize - bufferUsed);
+
+        memset(buffer + bufferUsed, value, chunkSize);
+        bufferUsed += chunkSize;
+        size -= chunkSize;
+    }
+}
+
+// purpose: write a table of null terminated strings
+// returns: size of the table in bytes
+size_t BufferedWriter::writeStrings(const std::vector<std::string>& strings)
+{
+    size_t length = 0;
+
+    for (auto& it : strings)
+    {
+        writeString(it);
+        length += it.length() + 1;
+    }
+
+    return length;
+}
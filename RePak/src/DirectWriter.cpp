@@ -0,0 +1,173 @@
+#include "pch.h"
+#include "DirectWriter.h"
+
+DirectWriter::DirectWriter()
+{
+    arena = static_cast<uint8_t*>(operator new[](DIRECT_WRITER_BUFFER_SIZE * DIRECT_WRITER_BUFFER_COUNT, std::align_val_t(DIRECT_WRITER_ALIGNMENT)));
+}
+
+DirectWriter::~DirectWriter()
+{
+    close();
+    operator delete[](arena, std::align_val_t(DIRECT_WRITER_ALIGNMENT));
+}
+
+// purpose: create a file for the writer to write to and start the writer thread
+// file systems that can't write directly get a file that goes through the cache instead, which the same aligned writes work on
+// returns: true on success
+bool DirectWriter::open(const std::string& path, uint64_t fileSize)
+{
+    close();
+
+    file = Platform::CreateOutputFile(path, fileSize, true);
+
+    if (file == PLATFORM_INVALID_FILE)
+    {
+        file = Platform::CreateOutputFile(path, fileSize);
+
+        if (file == PLATFORM_INVALID_FILE)
+            return false;
+
+        Warning("file system doesn't support direct writes, writing '%s' through the file cache\n", path.c_str());
+    }
+
+    currentBuffer = 0;
+    bufferUsed = 0;
+    position = 0;
+    bufferOffset = 0;
+
+    queue.clear();
+    freeBuffers.clear();
+
+    for (size_t i = 1; i < DIRECT_WRITER_BUFFER_COUNT; ++i)
+        freeBuffers.push_back(i);
+
+    bStopping = false;
+    bFailed = false;
+
+    writeThread = std::thread(&DirectWriter::writeThreadMain, this);
+    return true;
+}
+
+// purpose: write the last buffer, wait for every queued write and cut the file back to the size that was written
+// returns: false if any write failed
+bool DirectWriter::close()
+{
+    if (file == PLATFORM_INVALID_FILE)
+        return !bFailed;
+
+    // the last write is padded out to a whole sector, which SetFileSize removes again
+    if (bufferUsed > 0)
+    {
+        const size_t alignedSize = (bufferUsed + DIRECT_WRITER_ALIGNMENT - 1) & ~((size_t)DIRECT_WRITER_ALIGNMENT - 1);
+
+        memset(getBuffer(currentBuffer) + bufferUsed, 0, alignedSize - bufferUsed);
+        bufferUsed = alignedSize;
+
+        submitBuffer();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        bStopping = true;
+    }
+
+    queueCondition.notify_all();
+    writeThread.join();
+
+    if (!Platform::SetFileSize(file, position))
+        bFailed = true;
+
+    Platform::CloseFile(file);
+    file = PLATFORM_INVALID_FILE;
+
+    return !bFailed;
+}
+
+// purpose: queue the buffer being filled for the writer thread and carry on in the next free one
+// waits for the writer thread when every buffer is still queued
+void DirectWriter::submitBuffer()
+{
+    std::unique_lock<std::mutex> lock(queueMutex);
+
+    queue.push_back({ currentBuffer, bufferOffset, bufferUsed });
+    queueCondition.notify_all();
+
+    queueCondition.wait(lock, [this]() { return !freeBuffers.empty(); });
+
+    currentBuffer = freeBuffers.back();
+    freeBuffers.pop_back();
+
+    bufferOffset += bufferUsed;
+    bufferUsed = 0;
+}
+
+// purpose: write queued buffers to the file in the order they were queued, until the writer is closed
+void DirectWriter::writeThreadMain()
+{
+    std::unique_lock<std::mutex> lock(queueMutex);
+
+    while (true)
+    {
+        queueCondition.wait(lock, [this]() { return !queue.empty() || bStopping; });
+
+        if (queue.empty())
+            break;
+
+        QueuedWrite_t write = queue.front();
+        queue.pop_front();
+
+        // buffers keep being returned after a failed write, so that the writer never waits for one forever
+        const bool bSkip = bFailed;
+        lock.unlock();
+
+        const bool bSuccess = bSkip || Platform::WriteFileAt(file, write.offset, getBuffer(write.bufferIdx), write.size);
+
+        lock.lock();
+
+        if (!bSuccess)
+            bFailed = true;
+
+        freeBuffers.push_back(write.bufferIdx);
+        queueCondition.notify_all();
+    }
+}
+
+// purpose: write bytes to the file
+// everything is copied into the arena first, since the data that is written directly has to be aligned
+void DirectWriter::writeBytes(const void* data, size_t size)
+{
+    const uint8_t* pData = static_cast<const uint8_t*>(data);
+    position += size;
+
+    while (size > 0)
+    {
+        size_t chunkSize = min(size, DIRECT_WRITER_BUFFER_SIZE - bufferUsed);
+
+        memcpy(getBuffer(currentBuffer) + bufferUsed, pData, chunkSize);
+        bufferUsed += chunkSize;
+        pData += chunkSize;
+        size -= chunkSize;
+
+        if (bufferUsed == DIRECT_WRITER_BUFFER_SIZE)
+            submitBuffer();
+    }
+}
+
+// purpose: write the same byte a number of times
+void DirectWriter::writePadding(size_t size, uint8_t value)
+{
+    position += size;
+
+    while (size > 0)
+    {
+        size_t chunkSize = min(size, DIRECT_WRITER_BUFFER_SIZE - bufferUsed);
+
+        memset(getBuffer(currentBuffer) + bufferUsed, value, chunkSize);
+        bufferUsed += chunkSize;
+        size -= chunkSize;
+
+        if (bufferUsed == DIRECT_WRITER_BUFFER_SIZE)
+            submitBuffer();
+    }
+}
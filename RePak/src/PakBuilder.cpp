@@ -0,0 +1,241 @@
+#include "pch.h"
+#include "PakBuilder.h"
+#include "Assets.h"
+#include "AssetGraph.h"
+#include "BuildCache.h"
+#include "SharedBuildState.h"
+#include "PakBudget.h"
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
+
+//
+// stream buffer that passes everything written to it on to a write function
+// lets the rpak and starpak writers output to any destination without knowing about it
+//
+class WriteFuncStreamBuf : public std::streambuf
+{
+	const PakBuilder::WriteFunc_t& writeFunc;
+	bool bFailed = false;
+
+protected:
+	std::streamsize xsputn(const char* data, std::streamsize size) override
+	{
+		if (bFailed || !writeFunc(data, static_cast<size_t>(size)))
+		{
+			bFailed = true;
+			return 0;
+		}
+
+		return size;
+	}
+
+	int_type overflow(int_type c) override
+	{
+		if (traits_type::eq_int_type(c, traits_type::eof()))
+			return traits_type::not_eof(c);
+
+		char ch = traits_type::to_char_type(c);
+
+		return xsputn(&ch, 1) == 1 ? c : traits_type::eof();
+	}
+
+public:
+	WriteFuncStreamBuf(const PakBuilder::WriteFunc_t& func) : writeFunc(func) {};
+};
+
+struct PakBuilder::Impl
+{
+	RPakBuildContext_t ctx;
+
+	// map file that the added assets are collected into, so they can be built the same way as a map file's assets
+	rapidjson::Document mapDoc;
+
+	std::string sError;
+
+	Impl()
+	{
+		mapDoc.SetObject();
+		mapDoc.AddMember("files", rapidjson::Value(rapidjson::kArrayType), mapDoc.GetAllocator());
+
+		ctx.assetsDir = "." PATH_SEPARATOR;
+	}
+};
+
+PakBuilder::PakBuilder() : pImpl(std::make_unique<Impl>())
+{
+}
+
+PakBuilder::~PakBuilder() = default;
+
+void PakBuilder::SetAssetsDir(const std::string& dir)
+{
+	pImpl->ctx.assetsDir = dir;
+
+	// ensure that the path has a slash at the end
+	if (!dir.empty())
+		Utils::AppendSlash(pImpl->ctx.assetsDir);
+}
+
+void PakBuilder::AddSourceFile(const std::string& path, std::vector<uint8_t> data)
+{
+	pImpl->ctx.memoryFiles[Utils::NormalisePath(path)] = std::make_shared<const std::vector<uint8_t>>(std::move(data));
+}
+
+// purpose: set the map file options that the pak is built with
+// returns: true if the options are a valid json object
+bool PakBuilder::SetOptions(const std::string& optionsJson)
+{
+	rapidjson::Document& mapDoc = pImpl->mapDoc;
+	rapidjson::Document options(&mapDoc.GetAllocator());
+
+	if (options.Parse(optionsJson.c_str(), optionsJson.length()).HasParseError() || !options.IsObject())
+	{
+		pImpl->sError = "options are not a valid json object";
+		return false;
+	}
+
+	// assignment moves the value in rapidjson
+	rapidjson::Value files{};
+	files = mapDoc["files"];
+
+	mapDoc.SetObject();
+
+	for (auto& it : options.GetObject())
+	{
+		if (it.name != "files")
+			mapDoc.AddMember(it.name.Move(), it.value.Move(), mapDoc.GetAllocator());
+	}
+
+	mapDoc.AddMember("files", files, mapDoc.GetAllocator());
+
+	return true;
+}
+
+// purpose: add an asset from its map file entry
+// returns: true if the entry is valid json
+bool PakBuilder::AddAsset(const std::string& mapEntryJson)
+{
+	rapidjson::Document entry(&pImpl->mapDoc.GetAllocator());
+
+	if (entry.Parse(mapEntryJson.c_str(), mapEntryJson.length()).HasParseError() || !entry.IsObject())
+	{
+		pImpl->sError = "asset entry is not a valid json object";
+		return false;
+	}
+
+	// the entry was parsed with the map document's allocator, so it can be moved into the map without copying
+	pImpl->mapDoc["files"].PushBack(entry.Move(), pImpl->mapDoc.GetAllocator());
+
+	return true;
+}
+
+// purpose: build every added asset and write the rpak and starpak
+// the builder can be built again afterwards, with or without adding more assets
+// returns: true on success
+bool PakBuilder::Build(const WriteFunc_t& rpakWriter, const WriteFunc_t& starpakWriter)
+{
+	RPakBuildContext_t& ctx = pImpl->ctx;
+	BuildContextScope ctxScope(ctx);
+
+	ctx.Reset();
+	pImpl->sError.clear();
+
+	rapidjson::Document& mapDoc = pImpl->mapDoc;
+
+	// the options are set up the same way as for a map file, with the json of the builder's map standing in for the map file
+	rapidjson::StringBuffer mapJson{};
+	rapidjson::Writer<rapidjson::StringBuffer> writer(mapJson);
+	mapDoc.Accept(writer);
+
+	ctx.inputHash = Utils::HashData(mapJson.GetString(), mapJson.GetSize());
+	ctx.bReproducible = false;
+
+	RePak::SetLayoutOptions(mapDoc);
+	RePak::SetReproducibleOptions(mapDoc);
+	RePak::SetOutputOptions(mapDoc);
+
+	std::vector<RPakAssetEntryV8> assetEntries{ };
+
+	AssetGraph assetGraph{ };
+	std::vector<const AssetTypeHandler_t*> usedAssetTypes{ };
+
+	assetGraph.AddMapFileEntries(mapDoc["files"], usedAssetTypes);
+
+	if (!assetGraph.Resolve())
+	{
+		pImpl->sError = "failed to resolve asset dependencies";
+		return false;
+	}
+
+	// a load order file is relative to the working directory, since there is no map file for it to be next to
+	if (!RePak::SetLoadOrder(mapDoc, std::filesystem::path(), assetGraph))
+	{
+		pImpl->sError = ctx.sLastError;
+		return false;
+	}
+
+	std::vector<BuildStateMark_t> marks{ };
+
+	// the pak is written to a single stream, so it can't be split when it's over the engine limits
+	if (!RePak::BuildAssets(assetGraph, usedAssetTypes, assetEntries, nullptr, false, &marks) || !RePak::CheckBuildBudget(assetEntries, PakBudget_t{})
+		|| !RePak::FinalizeLayout(&assetGraph, marks, assetEntries))
+	{
+		pImpl->sError = ctx.sLastError.empty() ? "failed to build assets" : ctx.sLastError;
+		return false;
+	}
+
+	RPakFileHeaderV8 rpakHeader{ };
+	rpakHeader.CreatedTime = RePak::GetCreatedTime();
+
+	WriteFuncStreamBuf rpakBuf(rpakWriter);
+	std::ostream rpakOut(&rpakBuf);
+
+	RePak::WriteRPak(rpakOut, rpakHeader, assetEntries);
+
+	if (!rpakOut.good())
+	{
+		pImpl->sError = "failed to write rpak";
+		return false;
+	}
+
+	if (!ctx.starpakPaths.empty())
+	{
+		WriteFuncStreamBuf starpakBuf(starpakWriter);
+		std::ostream starpakOut(&starpakBuf);
+
+		RePak::WriteStarpak(starpakOut);
+
+		if (!starpakOut.good())
+		{
+			pImpl->sError = "failed to write starpak";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// purpose: build every added asset into memory
+// returns: true on success
+bool PakBuilder::Build(std::vector<uint8_t>& rpak, std::vector<uint8_t>& starpak)
+{
+	rpak.clear();
+	starpak.clear();
+
+	auto appendTo = [](std::vector<uint8_t>& out)
+	{
+		return [&out](const void* data, size_t size)
+		{
+			const uint8_t* bytes = static_cast<const uint8_t*>(data);
+			out.insert(out.end(), bytes, bytes + size);
+			return true;
+		};
+	};
+
+	return Build(appendTo(rpak), appendTo(starpak));
+}
+
+const std::string& PakBuilder::GetError() const
+{
+	return pImpl->sError;
+}
@@ -0,0 +1,354 @@
+#include "pch.h"
+#include "Platform.h"
+
+#ifndef _WIN32
+#include <chrono>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+
+#ifdef _WIN32
+// a single WriteFile call can't write more than 4GB, so big blocks are written in chunks
+#define PLATFORM_MAX_WRITE_SIZE ((uint64_t)1 << 30)
+
+// purpose: create an output file that is already at its final size, so the blocks in it can be written in any order
+// direct files bypass the file cache, so every write to them has to be sector aligned (see DirectWriter)
+// returns: the file, or PLATFORM_INVALID_FILE on failure
+PlatformFile_t Platform::CreateOutputFile(const std::string& path, uint64_t fileSize, bool bDirect)
+{
+    DWORD flags = bDirect ? FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH : FILE_ATTRIBUTE_NORMAL;
+
+    HANDLE hFile = CreateFileW(std::filesystem::path(path).wstring().c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+        CREATE_ALWAYS, flags, nullptr);
+
+    if (hFile == INVALID_HANDLE_VALUE)
+        return PLATFORM_INVALID_FILE;
+
+    if (!SetFileSize(hFile, fileSize))
+    {
+        CloseHandle(hFile);
+        return PLATFORM_INVALID_FILE;
+    }
+
+    return hFile;
+}
+
+// purpose: open an existing output file for writing, without changing it
+// returns: the file, or PLATFORM_INVALID_FILE on failure
+PlatformFile_t Platform::OpenOutputFile(const std::string& path)
+{
+    return CreateFileW(std::filesystem::path(path).wstring().c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+}
+
+// purpose: write a block at its offset in a file, without using or moving the file pointer
+// returns: true on success
+bool Platform::WriteFileAt(PlatformFile_t file, uint64_t offset, const void* data, uint64_t size)
+{
+    const char* pData = static_cast<const char*>(data);
+
+    for (uint64_t written = 0; written < size;)
+    {
+        OVERLAPPED ov{};
+        ov.Offset = static_cast<DWORD>(offset + written);
+        ov.OffsetHigh = static_cast<DWORD>((offset + written) >> 32);
+
+        DWORD chunkSize = static_cast<DWORD>(min(size - written, PLATFORM_MAX_WRITE_SIZE));
+        DWORD chunkWritten = 0;
+
+        if (!WriteFile(file, pData + written, chunkSize, &chunkWritten, &ov) || chunkWritten != chunkSize)
+            return false;
+
+        written += chunkWritten;
+    }
+
+    return true;
+}
+
+// purpose: extend or truncate a file
+// returns: true on success
+bool Platform::SetFileSize(PlatformFile_t file, uint64_t fileSize)
+{
+    LARGE_INTEGER size{};
+    size.QuadPart = fileSize;
+
+    return SetFilePointerEx(file, size, nullptr, FILE_BEGIN) && SetEndOfFile(file);
+}
+
+void Platform::CloseFile(PlatformFile_t file)
+{
+    if (file != PLATFORM_INVALID_FILE)
+        CloseHandle(file);
+}
+
+// purpose: map a file into memory for reading
+// empty files can't be mapped, so they give a mapping with no data
+// returns: true on success
+bool Platform::MapInputFile(const std::string& path, MappedFile_t& mapped)
+{
+    mapped = {};
+    mapped.file = CreateFileW(std::filesystem::path(path).wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+    if (mapped.file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize{};
+
+    if (!GetFileSizeEx(mapped.file, &fileSize))
+    {
+        UnmapInputFile(mapped);
+        return false;
+    }
+
+    if (fileSize.QuadPart == 0)
+        return true;
+
+    mapped.hMapping = CreateFileMappingW(mapped.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+    if (mapped.hMapping)
+        mapped.data = static_cast<const uint8_t*>(MapViewOfFile(mapped.hMapping, FILE_MAP_READ, 0, 0, 0));
+
+    if (!mapped.data)
+    {
+        UnmapInputFile(mapped);
+        return false;
+    }
+
+    mapped.size = fileSize.QuadPart;
+    return true;
+}
+
+void Platform::UnmapInputFile(MappedFile_t& mapped)
+{
+    if (mapped.data)
+        UnmapViewOfFile(mapped.data);
+
+    if (mapped.hMapping)
+        CloseHandle(mapped.hMapping);
+
+    CloseFile(mapped.file);
+    mapped = {};
+}
+
+// returns: path of the running executable
+std::string Platform::GetExecutablePath()
+{
+    wchar_t exePath[MAX_PATH];
+    GetModuleFileNameW(nullptr, exePath, MAX_PATH);
+
+    return std::filesystem::path(exePath).u8string();
+}
+
+// purpose: start a process with every argument quoted, so that arguments can contain spaces
+// returns: true on success
+bool Platform::StartProcess(const std::string& exePath, const std::vector<std::string>& args, PlatformProcess_t& process)
+{
+    std::wstring cmdLine = L"\"" + std::filesystem::u8path(exePath).wstring() + L"\"";
+
+    for (auto& it : args)
+        cmdLine += L" \"" + std::filesystem::u8path(it).wstring() + L"\"";
+
+    STARTUPINFOW si{ };
+    si.cb = sizeof(si);
+
+    PROCESS_INFORMATION pi{ };
+
+    if (!CreateProcessW(nullptr, cmdLine.data(), nullptr, nullptr, TRUE, 0, nullptr, nullptr, &si, &pi))
+        return false;
+
+    process.hProcess = pi.hProcess;
+    process.hThread = pi.hThread;
+
+    return true;
+}
+
+// purpose: wait for a process to exit
+// returns: exit code of the process
+int Platform::WaitForProcess(PlatformProcess_t& process)
+{
+    WaitForSingleObject(process.hProcess, INFINITE);
+
+    DWORD exitCode = EXIT_FAILURE;
+    GetExitCodeProcess(process.hProcess, &exitCode);
+
+    CloseHandle(process.hProcess);
+    CloseHandle(process.hThread);
+    process = {};
+
+    return exitCode;
+}
+#else
+void GetSystemTimeAsFileTime(FILETIME* ft)
+{
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    uint64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count() / 100 + FILETIME_UNIX_EPOCH;
+
+    ft->dwLowDateTime = static_cast<DWORD>(time);
+    ft->dwHighDateTime = static_cast<DWORD>(time >> 32);
+}
+
+DWORD GetEnvironmentVariableA(const char* name, char* buffer, DWORD size)
+{
+    const char* value = getenv(name);
+
+    if (!value)
+        return 0;
+
+    size_t length = strlen(value);
+
+    // like on windows, a buffer that is too small gets the size it would need, including the null terminator
+    if (length >= size)
+        return length + 1;
+
+    memcpy(buffer, value, length + 1);
+    return length;
+}
+
+PlatformFile_t Platform::CreateOutputFile(const std::string& path, uint64_t fileSize, bool bDirect)
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+#ifdef O_DIRECT
+    if (bDirect)
+        flags |= O_DIRECT;
+#endif
+
+    int fd = open(path.c_str(), flags, 0644);
+
+    if (fd == -1)
+        return PLATFORM_INVALID_FILE;
+
+    if (ftruncate(fd, fileSize) != 0)
+    {
+        close(fd);
+        return PLATFORM_INVALID_FILE;
+    }
+
+    return fd;
+}
+
+PlatformFile_t Platform::OpenOutputFile(const std::string& path)
+{
+    return open(path.c_str(), O_WRONLY | O_CLOEXEC);
+}
+
+// purpose: write a block at its offset in a file with pwrite, which doesn't use or move the file offset
+// returns: true on success
+bool Platform::WriteFileAt(PlatformFile_t file, uint64_t offset, const void* data, uint64_t size)
+{
+    const char* pData = static_cast<const char*>(data);
+
+    for (uint64_t written = 0; written < size;)
+    {
+        ssize_t chunkWritten = pwrite(file, pData + written, size - written, offset + written);
+
+        if (chunkWritten <= 0)
+            return false;
+
+        written += chunkWritten;
+    }
+
+    return true;
+}
+
+bool Platform::SetFileSize(PlatformFile_t file, uint64_t fileSize)
+{
+    return ftruncate(file, fileSize) == 0;
+}
+
+void Platform::CloseFile(PlatformFile_t file)
+{
+    if (file != PLATFORM_INVALID_FILE)
+        close(file);
+}
+
+bool Platform::MapInputFile(const std::string& path, MappedFile_t& mapped)
+{
+    mapped = {};
+    mapped.file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (mapped.file == -1)
+        return false;
+
+    struct stat st{};
+
+    if (fstat(mapped.file, &st) != 0)
+    {
+        UnmapInputFile(mapped);
+        return false;
+    }
+
+    if (st.st_size == 0)
+        return true;
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, mapped.file, 0);
+
+    if (data == MAP_FAILED)
+    {
+        UnmapInputFile(mapped);
+        return false;
+    }
+
+    // inputs are read from start to end
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    mapped.data = static_cast<const uint8_t*>(data);
+    mapped.size = st.st_size;
+
+    return true;
+}
+
+void Platform::UnmapInputFile(MappedFile_t& mapped)
+{
+    if (mapped.data)
+        munmap(const_cast<uint8_t*>(mapped.data), mapped.size);
+
+    CloseFile(mapped.file);
+    mapped = {};
+}
+
+std::string Platform::GetExecutablePath()
+{
+    std::error_code ec;
+    return std::filesystem::read_symlink("/proc/self/exe", ec).u8string();
+}
+
+bool Platform::StartProcess(const std::string& exePath, const std::vector<std::string>& args, PlatformProcess_t& process)
+{
+    std::vector<char*> argv{};
+    argv.push_back(const_cast<char*>(exePath.c_str()));
+
+    for (auto& it : args)
+        argv.push_back(const_cast<char*>(it.c_str()));
+
+    argv.push_back(nullptr);
+
+    pid_t pid = -1;
+
+    if (posix_spawn(&pid, exePath.c_str(), nullptr, nullptr, argv.data(), environ) != 0)
+        return false;
+
+    process.pid = pid;
+    return true;
+}
+
+int Platform::WaitForProcess(PlatformProcess_t& process)
+{
+    int status = 0;
+
+    if (waitpid(process.pid, &status, 0) == -1 || !WIFEXITED(status))
+        status = EXIT_FAILURE;
+    else
+        status = WEXITSTATUS(status);
+
+    process = {};
+    return status;
+}
+#endif
@@ -1,46 +1,55 @@
 #include "pch.h"
 #include "Assets.h"
+#include "AssetGraph.h"
+#include "BuildCache.h"
+#include "SharedBuildState.h"
+#include "PakBudget.h"
+#include "PatchBuild.h"
+#include <rapidjson/error/en.h>
 
 using namespace rapidjson;
 
-// purpose: create page and segment with the specified parameters
+thread_local RPakBuildContext_t* g_pBuildContext = nullptr;
+
+// purpose: find the segment that pages with the specified parameters go in
 // idk what the second field is so "a2" is good enough
-RPakVirtualSegment& GetMatchingSegment(uint32_t flags, uint32_t a2, uint32_t* segidx)
+// returns: index of the segment with these values, or -1 if there isn't one yet
+static uint32_t GetMatchingSegment(uint32_t flags, uint32_t a2)
 {
-    uint32_t i = 0;
-    for (auto& it : g_vvSegments)
+    for (uint32_t i = 0; i < g_pBuildContext->segments.size(); ++i)
     {
+        const RPakVirtualSegment& it = g_pBuildContext->segments[i];
+
         if (it.DataFlag == flags && it.SomeType == a2)
-        {
-            *segidx = i;
-            return it;
-        }
-        i++;
+            return i;
     }
-    RPakVirtualSegment ret{ flags, a2, 0 };
-    return ret;
+
+    return -1;
 }
 
 // purpose: create page and segment with the specified parameters
 // returns: page index
 _vseginfo_t RePak::CreateNewSegment(uint32_t size, uint32_t flags_maybe, uint32_t alignment, RPakVirtualSegment& seg_arg, uint32_t vsegAlignment)
 {
-    uint32_t vsegidx = g_vvSegments.size();
-    
+    const uint32_t segAlignment = vsegAlignment == (uint32_t)-1 ? alignment : vsegAlignment;
+
     // find existing "segment" with the same values or create a new one, this is to overcome the engine's limit of having max 20 of these
     // since otherwise we write into unintended parts of the stack, and that's bad
-    RPakVirtualSegment& seg = GetMatchingSegment(flags_maybe, vsegAlignment == -1 ? alignment : vsegAlignment, &vsegidx);
+    uint32_t vsegidx = GetMatchingSegment(flags_maybe, segAlignment);
 
-    bool bShouldAddVSeg = seg.DataSize == 0;
-    seg.DataSize += size;
+    if (vsegidx == (uint32_t)-1)
+    {
+        vsegidx = g_pBuildContext->segments.size();
+        g_pBuildContext->segments.push_back({ flags_maybe, segAlignment, 0 });
+    }
 
-    if(bShouldAddVSeg)
-        g_vvSegments.emplace_back(seg);
+    RPakVirtualSegment& seg = g_pBuildContext->segments[vsegidx];
+    seg.DataSize += size;
 
     RPakPageInfo vsegblock{ vsegidx, alignment, size };
 
-    g_vPages.emplace_back(vsegblock);
-    uint32_t pageidx = g_vPages.size() - 1;
+    g_pBuildContext->pages.emplace_back(vsegblock);
+    uint32_t pageidx = g_pBuildContext->pages.size() - 1;
 
     seg_arg = seg;
     return { pageidx, size};
@@ -48,27 +57,118 @@ _vseginfo_t RePak::CreateNewSegment(uint32_t size, uint32_t flags_maybe, uint32_
 
 void RePak::AddRawDataBlock(RPakRawDataBlock block)
 {
-    g_vRawDataBlocks.push_back(block);
+    g_pBuildContext->rawDataBlocks.push_back(block);
     return;
 };
 
 void RePak::RegisterDescriptor(uint32_t pageIdx, uint32_t pageOffset)
 {
-    g_vDescriptors.push_back({ pageIdx, pageOffset });
+    g_pBuildContext->descriptors.push_back({ pageIdx, pageOffset });
     return;
 }
 
 void RePak::RegisterGuidDescriptor(uint32_t pageIdx, uint32_t pageOffset)
 {
-    g_vGuidDescriptors.push_back({ pageIdx, pageOffset });
+    g_pBuildContext->guidDescriptors.push_back({ pageIdx, pageOffset });
     return;
 }
 
+static bool DescriptorLess(const RPakDescriptor& a, const RPakDescriptor& b)
+{
+    return a.PageIdx < b.PageIdx || (a.PageIdx == b.PageIdx && a.PageOffset < b.PageOffset);
+}
+
+static bool DescriptorEqual(const RPakDescriptor& a, const RPakDescriptor& b)
+{
+    return a.PageIdx == b.PageIdx && a.PageOffset == b.PageOffset;
+}
+
+// purpose: sort a descriptor table by page and offset and remove duplicate entries
+static void SortDescriptorTable(std::vector<RPakDescriptor>& descriptors)
+{
+    std::sort(descriptors.begin(), descriptors.end(), DescriptorLess);
+    descriptors.erase(std::unique(descriptors.begin(), descriptors.end(), DescriptorEqual), descriptors.end());
+}
+
+// purpose: check that no two descriptors overlap and that every descriptor fits in its page
+// both pointers and guids are 8 bytes, so descriptors on the same page must be at least 8 bytes apart
+// returns: true if the tables are valid
+static bool ValidateDescriptorTables()
+{
+    std::vector<RPakDescriptor> all{};
+    all.reserve(g_pBuildContext->descriptors.size() + g_pBuildContext->guidDescriptors.size());
+    std::merge(g_pBuildContext->descriptors.begin(), g_pBuildContext->descriptors.end(), g_pBuildContext->guidDescriptors.begin(), g_pBuildContext->guidDescriptors.end(), std::back_inserter(all), DescriptorLess);
+
+    bool bValid = true;
+    for (size_t i = 0; i < all.size(); ++i)
+    {
+        const RPakDescriptor& desc = all[i];
+
+        if (desc.PageIdx >= g_pBuildContext->pages.size() || desc.PageOffset + sizeof(uint64_t) > g_pBuildContext->pages[desc.PageIdx].DataSize)
+        {
+            Error("descriptor at page %u offset %u is outside of its page\n", desc.PageIdx, desc.PageOffset);
+            bValid = false;
+        }
+
+        if (i > 0 && all[i - 1].PageIdx == desc.PageIdx && desc.PageOffset - all[i - 1].PageOffset < sizeof(uint64_t))
+        {
+            Error("descriptors at page %u offsets %u and %u overlap\n", desc.PageIdx, all[i - 1].PageOffset, desc.PageOffset);
+            bValid = false;
+        }
+    }
+
+    return bValid;
+}
+
+// purpose: sort, deduplicate and validate the descriptor and guid descriptor tables
+// this makes the tables independent of the order that handlers registered their descriptors in,
+// and lets the engine walk the fixups for each page sequentially
+//
+// since sorting moves guid descriptors around, each asset's uses are recalculated afterwards.
+// every asset owns the pages from its subheader page up to PageEnd, so its guid descriptors are
+// the contiguous run of entries on those pages
+// returns: false if the tables are invalid, in which case the rpak must not be written
+bool RePak::FinalizeDescriptors(std::vector<RPakAssetEntryV8>& assetEntries)
+{
+    SortDescriptorTable(g_pBuildContext->descriptors);
+    SortDescriptorTable(g_pBuildContext->guidDescriptors);
+
+    if (!ValidateDescriptorTables())
+    {
+        Error("rpak descriptor tables are invalid\n");
+        return false;
+    }
+
+    for (auto& it : assetEntries)
+    {
+        auto first = std::lower_bound(g_pBuildContext->guidDescriptors.begin(), g_pBuildContext->guidDescriptors.end(), RPakDescriptor{ it.SubHeaderDataBlockIndex, 0 }, DescriptorLess);
+        auto last = std::lower_bound(first, g_pBuildContext->guidDescriptors.end(), RPakDescriptor{ it.PageEnd, 0 }, DescriptorLess);
+
+        it.UsesStartIndex = first - g_pBuildContext->guidDescriptors.begin();
+        it.UsesCount = last - first;
+    }
+
+    return true;
+}
+
 size_t RePak::AddFileRelation(uint32_t assetIdx, uint32_t count)
 {
     for(uint32_t i = 0; i < count; ++i)
-        g_vFileRelations.push_back({ assetIdx });
-    return g_vFileRelations.size()-count; // return the index of the file relation(s)
+        g_pBuildContext->fileRelations.push_back({ assetIdx });
+    return g_pBuildContext->fileRelations.size()-count; // return the index of the file relation(s)
+}
+
+// purpose: pack the "$type" string of a map file entry into a fourcc so it can be switched on
+// returns: fourcc of the type, or 0 if the value isn't a 4 character string
+uint32_t RePak::GetAssetTypeFourCC(const rapidjson::Value& type)
+{
+    if (!type.IsString() || type.GetStringLength() != 4)
+        return 0;
+
+    uint32_t fourcc = 0;
+    memcpy(&fourcc, type.GetString(), sizeof(fourcc));
+
+    return fourcc;
 }
 
 RPakAssetEntryV8* RePak::GetAssetByGuid(std::vector<RPakAssetEntryV8>* assets, uint64_t guid, uint32_t* idx)
@@ -87,75 +187,170 @@ RPakAssetEntryV8* RePak::GetAssetByGuid(std::vector<RPakAssetEntryV8>* assets, u
     return nullptr;
 }
 
-void WriteRPakRawDataBlock(BinaryIO& out, std::vector<RPakRawDataBlock>& rawDataBlock)
+// purpose: generate the file relations for every asset from the guids that each asset references
+// this gives the same relations as the asset graph, but works without a map file,
+// e.g. when assets are taken from an existing rpak
+// note: must run after FinalizeDescriptors, since it relies on each asset's uses
+void RePak::GenerateFileRelationsFromGuids(std::vector<RPakAssetEntryV8>& assetEntries)
 {
-    for (auto it = rawDataBlock.begin(); it != rawDataBlock.end(); ++it)
+    std::vector<const uint8_t*> pageData(g_pBuildContext->pages.size(), nullptr);
+
+    for (auto& it : g_pBuildContext->rawDataBlocks)
     {
-        out.getWriter()->write((char*)it->dataPtr, it->dataSize);
+        if (it.pageIdx < pageData.size())
+            pageData[it.pageIdx] = it.dataPtr;
     }
+
+    RePak::GenerateFileRelationsFromGuids(assetEntries, pageData);
 }
 
-int main(int argc, char** argv)
+// purpose: generate the file relations from the guids in the given page data
+// used when the page data isn't held by the build context
+void RePak::GenerateFileRelationsFromGuids(std::vector<RPakAssetEntryV8>& assetEntries, const std::vector<const uint8_t*>& pageData)
 {
-    if (argc < 2)
+    std::unordered_map<uint64_t, uint32_t> assetIndices{};
+
+    for (uint32_t i = 0; i < assetEntries.size(); ++i)
+        assetIndices.emplace(assetEntries[i].GUID, i);
+
+    std::vector<std::vector<uint32_t>> users(assetEntries.size());
+
+    for (uint32_t i = 0; i < assetEntries.size(); ++i)
+    {
+        const RPakAssetEntryV8& asset = assetEntries[i];
+
+        for (uint32_t j = 0; j < asset.UsesCount; ++j)
+        {
+            const RPakGuidDescriptor& desc = g_pBuildContext->guidDescriptors[asset.UsesStartIndex + j];
+
+            if (!pageData[desc.PageIdx])
+                continue;
+
+            uint64_t guid = *reinterpret_cast<const uint64_t*>(pageData[desc.PageIdx] + desc.PageOffset);
+            auto it = assetIndices.find(guid);
+
+            if (it != assetIndices.end() && it->second != i)
+                users[it->second].push_back(i);
+        }
+    }
+
+    for (uint32_t i = 0; i < assetEntries.size(); ++i)
     {
-        Error("invalid usage\n");
-        return EXIT_FAILURE;
+        RPakAssetEntryV8& asset = assetEntries[i];
+        std::vector<uint32_t>& assetUsers = users[i];
+
+        std::sort(assetUsers.begin(), assetUsers.end());
+        assetUsers.erase(std::unique(assetUsers.begin(), assetUsers.end()), assetUsers.end());
+
+        asset.RelationsStartIndex = 0;
+        asset.RelationsCount = assetUsers.size();
+
+        for (uint32_t j = 0; j < assetUsers.size(); ++j)
+        {
+            size_t relationIdx = RePak::AddFileRelation(assetUsers[j]);
+
+            if (j == 0)
+                asset.RelationsStartIndex = relationIdx;
+        }
     }
+}
 
-    std::filesystem::path mapPath(argv[1]);
-    if (!FILE_EXISTS(argv[1]))
+// purpose: read a map file and parse it in-situ
+// reading the whole file in one go is much faster than parsing through an IStreamWrapper,
+// which goes through the stream one character at a time
+// note: the buffer has to outlive the document, as in-situ string values point directly into it
+// returns: true if the map file was parsed and contains a 'files' array
+bool RePak::LoadMapFile(const std::filesystem::path& mapPath, std::vector<char>& mapBuf, rapidjson::Document& doc)
+{
+    if (!FILE_EXISTS(mapPath))
     {
         Error("couldn't find map file\n");
-        return EXIT_FAILURE;
+        return false;
     }
 
-    std::ifstream ifs(argv[1]);
+    std::ifstream ifs(mapPath, std::ios::binary | std::ios::ate);
 
     if (!ifs.is_open())
     {
         Error("couldn't open map file.\n");
-        return EXIT_FAILURE;
+        return false;
     }
 
-    // begin json parsing
-    IStreamWrapper isw{ ifs };
+    size_t nMapFileSize = ifs.tellg();
+    mapBuf.resize(nMapFileSize + 1);
 
-    Document doc{ };
+    ifs.seekg(0);
+    ifs.read(mapBuf.data(), nMapFileSize);
+    ifs.close();
 
-    doc.ParseStream(isw);
+    mapBuf[nMapFileSize] = '\0';
 
-    std::string sRpakName = DEFAULT_RPAK_NAME;
+    // taken before parsing, since the map is parsed in place
+    g_pBuildContext->inputHash = Utils::HashData(mapBuf.data(), nMapFileSize);
 
-    if (doc.HasMember("name") && doc["name"].IsString())
-        sRpakName = doc["name"].GetStdString();
-    else
-        Warning("Map file should have a 'name' field containing the string name for the new rpak, but none was provided. Defaulting to '%s.rpak' and continuing...\n", DEFAULT_RPAK_NAME);
+    doc.ParseInsitu(mapBuf.data());
+
+    if (doc.HasParseError())
+    {
+        Error("failed to parse map file: %s (offset %zu)\n", GetParseError_En(doc.GetParseError()), doc.GetErrorOffset());
+        return false;
+    }
+
+    if (!doc.HasMember("files") || !doc["files"].IsArray())
+    {
+        Error("map file doesn't contain a 'files' array\n");
+        return false;
+    }
 
+    return true;
+}
+
+// purpose: set the directory that asset paths are relative to from a parsed map file
+void RePak::SetAssetsDir(rapidjson::Document& doc, const std::filesystem::path& mapPath)
+{
     if (!doc.HasMember("assetsDir"))
     {
         Warning("No assetsDir field provided. Assuming that everything is relative to the working directory.\n");
         if (mapPath.has_parent_path())
         {
-            Assets::g_sAssetsDir = mapPath.parent_path().u8string();
+            g_pBuildContext->assetsDir = mapPath.parent_path().u8string();
         }
         else
         {
-            Assets::g_sAssetsDir = ".\\";
+            g_pBuildContext->assetsDir = "." PATH_SEPARATOR;
         }
     }
     else
     {
         std::filesystem::path assetsDirPath(doc["assetsDir"].GetStdString());
         if (assetsDirPath.is_relative() && mapPath.has_parent_path())
-            Assets::g_sAssetsDir = std::filesystem::canonical(mapPath.parent_path() / assetsDirPath).u8string();
+            g_pBuildContext->assetsDir = std::filesystem::canonical(mapPath.parent_path() / assetsDirPath).u8string();
         else
-            Assets::g_sAssetsDir = assetsDirPath.u8string();
+            g_pBuildContext->assetsDir = assetsDirPath.u8string();
 
         // ensure that the path has a slash at the end
-        Utils::AppendSlash(Assets::g_sAssetsDir);
-        Debug("assetsDir: %s\n", Assets::g_sAssetsDir.c_str());
+        Utils::AppendSlash(g_pBuildContext->assetsDir);
+        Debug("assetsDir: %s\n", g_pBuildContext->assetsDir.c_str());
     }
+}
+
+// purpose: get the name of the rpak from a parsed map file
+// returns: rpak name without extension
+std::string RePak::GetRPakName(rapidjson::Document& doc)
+{
+    if (doc.HasMember("name") && doc["name"].IsString())
+        return doc["name"].GetStdString();
+
+    Warning("Map file should have a 'name' field containing the string name for the new rpak, but none was provided. Defaulting to '%s.rpak' and continuing...\n", DEFAULT_RPAK_NAME);
+    return DEFAULT_RPAK_NAME;
+}
+
+// purpose: get the directory that the rpak and its starpaks are written to from a parsed map file
+// returns: output directory, ending with a slash
+std::string RePak::GetOutputDir(rapidjson::Document& doc, const std::filesystem::path& mapPath)
+{
+    if (!g_pBuildContext->outputDir.empty())
+        return g_pBuildContext->outputDir;
 
     std::string sOutputDir = "build/";
 
@@ -164,126 +359,363 @@ int main(int argc, char** argv)
         std::filesystem::path outputDirPath(doc["outputDir"].GetStdString());
 
         if (outputDirPath.is_relative() && mapPath.has_parent_path())
-            sOutputDir = std::filesystem::canonical(mapPath.parent_path() / outputDirPath).u8string();
+            sOutputDir = std::filesystem::weakly_canonical(mapPath.parent_path() / outputDirPath).u8string();
         else
             sOutputDir = outputDirPath.u8string();
 
         // ensure that the path has a slash at the end
         Utils::AppendSlash(sOutputDir);
     }
-    // end json parsing
-
-    Log("building rpak %s.rpak\n\n", sRpakName.c_str());
 
-    std::vector<RPakAssetEntryV8> assetEntries{ };
-
-    // build asset data
-    // loop through all assets defined in the map json
-    for (auto& file : doc["files"].GetArray())
-    {
-        ASSET_HANDLER("txtr", file, assetEntries, Assets::AddTextureAsset);
-        ASSET_HANDLER("uimg", file, assetEntries, Assets::AddUIImageAsset);
-        ASSET_HANDLER("Ptch", file, assetEntries, Assets::AddPatchAsset);
-        ASSET_HANDLER("dtbl", file, assetEntries, Assets::AddDataTableAsset);
-        ASSET_HANDLER("rmdl", file, assetEntries, Assets::AddModelAsset);
-        ASSET_HANDLER("matl", file, assetEntries, Assets::AddMaterialAsset);
-    }
+    return sOutputDir;
+}
 
-    std::filesystem::create_directories(sOutputDir); // create directory if it does not exist yet.
+// purpose: get the size of a null terminated string table
+// returns: size of the table in bytes
+static size_t GetStringTableSize(const std::vector<std::string>& strings)
+{
+    size_t length = 0;
+    for (auto& it : strings)
+        length += it.length() + 1;
+    return length;
+}
 
-    BinaryIO out{ };
+// purpose: get the size of the header and tables of the rpak for the current build state
+// returns: offset of the page data in the rpak
+uint64_t RePak::GetRPakTablesSize(const std::vector<RPakAssetEntryV8>& assetEntries)
+{
+    RPakBuildContext_t* ctx = g_pBuildContext;
 
-    out.open(sOutputDir + sRpakName + ".rpak", BinaryIOMode::Write);
+    uint64_t tablesSize = sizeof(RPakFileHeaderV8) + GetStringTableSize(ctx->starpakPaths) + GetStringTableSize(ctx->optStarpakPaths);
+    tablesSize += ctx->segments.size() * sizeof(RPakVirtualSegment);
+    tablesSize += ctx->pages.size() * sizeof(RPakPageInfo);
+    tablesSize += ctx->descriptors.size() * sizeof(RPakDescriptor);
+    tablesSize += assetEntries.size() * sizeof(RPakAssetEntryV8);
+    tablesSize += ctx->guidDescriptors.size() * sizeof(RPakGuidDescriptor);
+    tablesSize += ctx->fileRelations.size() * sizeof(RPakRelationBlock);
 
-    // write a placeholder header so we can come back and complete it
-    // when we have all the info
-    RPakFileHeaderV8 rpakHeader{ };
-    out.write(rpakHeader);
+    return tablesSize;
+}
 
-    size_t StarpakRefLength = Utils::WriteStringVector(out, Assets::g_vsStarpakPaths);
-    size_t OptStarpakRefLength = Utils::WriteStringVector(out, Assets::g_vsOptStarpakPaths);
+// purpose: write the header and tables of the rpak for the current build state
+// the counts and sizes in the header are filled in here, everything else is written as passed in.
+// the page data has to be written straight after this, in page order
+void RePak::WriteRPakTables(BufferedWriter& out, RPakFileHeaderV8& rpakHeader, std::vector<RPakAssetEntryV8>& assetEntries, uint64_t pageDataSize)
+{
+    RPakBuildContext_t* ctx = g_pBuildContext;
 
-    // write the non-paged data to the file first
-    WRITE_VECTOR(out, g_vvSegments);
-    WRITE_VECTOR(out, g_vPages);
-    WRITE_VECTOR(out, g_vDescriptors);
-    WRITE_VECTOR(out, assetEntries);
-    WRITE_VECTOR(out, g_vGuidDescriptors);
-    WRITE_VECTOR(out, g_vFileRelations);
-    WriteRPakRawDataBlock(out, g_vRawDataBlocks);
+    size_t StarpakRefLength = GetStringTableSize(ctx->starpakPaths);
+    size_t OptStarpakRefLength = GetStringTableSize(ctx->optStarpakPaths);
 
-    // get current time as FILETIME
-    FILETIME ft = Utils::GetFileTimeBySystem();
+    uint64_t fileSize = RePak::GetRPakTablesSize(assetEntries) + pageDataSize;
 
     // set up the file header
-    rpakHeader.CreatedTime = static_cast<__int64>(ft.dwHighDateTime) << 32 | ft.dwLowDateTime; // write the current time into the file as FILETIME
-    rpakHeader.CompressedSize = out.tell();
-    rpakHeader.DecompressedSize = out.tell();
-    rpakHeader.VirtualSegmentCount = g_vvSegments.size();
-    rpakHeader.PageCount = g_vPages.size();
-    rpakHeader.DescriptorCount = g_vDescriptors.size();
-    rpakHeader.GuidDescriptorCount = g_vGuidDescriptors.size();
-    rpakHeader.RelationsCount = g_vFileRelations.size();
+    rpakHeader.CompressedSize = fileSize;
+    rpakHeader.DecompressedSize = fileSize;
+    rpakHeader.VirtualSegmentCount = ctx->segments.size();
+    rpakHeader.PageCount = ctx->pages.size();
+    rpakHeader.DescriptorCount = ctx->descriptors.size();
+    rpakHeader.GuidDescriptorCount = ctx->guidDescriptors.size();
+    rpakHeader.RelationsCount = ctx->fileRelations.size();
     rpakHeader.AssetEntryCount = assetEntries.size();
     rpakHeader.StarpakReferenceSize = StarpakRefLength;
     rpakHeader.StarpakOptReferenceSize = OptStarpakRefLength;
 
-    out.seek(0); // Go back to the beginning to finally write the rpakHeader now.
+    out.write(rpakHeader);
 
-    out.write(rpakHeader); // Re-write rpak header.
-    
-    out.close();
+    out.writeStrings(ctx->starpakPaths);
+    out.writeStrings(ctx->optStarpakPaths);
+
+    // write the non-paged data to the file first
+    out.writeVector(ctx->segments);
+    out.writeVector(ctx->pages);
+    out.writeVector(ctx->descriptors);
+    out.writeVector(assetEntries);
+    out.writeVector(ctx->guidDescriptors);
+    out.writeVector(ctx->fileRelations);
+}
+
+// purpose: write the rpak for the current build state
+// the header is worked out before anything is written, so the rpak is written front to back without seeking
+// and can go to any stream
+void RePak::WriteRPak(std::ostream& out, RPakFileHeaderV8& rpakHeader, std::vector<RPakAssetEntryV8>& assetEntries)
+{
+    uint64_t pageDataSize = 0;
+
+    for (auto& it : g_pBuildContext->rawDataBlocks)
+        pageDataSize += it.dataSize;
+
+    BufferedWriter writer(out);
+    RePak::WriteRPakTables(writer, rpakHeader, assetEntries, pageDataSize);
+
+    std::vector<BufferedWriteBlock_t> pages{};
+
+    for (auto& it : g_pBuildContext->rawDataBlocks)
+        pages.push_back({ it.dataPtr, it.dataSize });
+
+    writer.writeBlocks(pages.data(), pages.size());
+    writer.flush();
+}
+
+// purpose: replace the contents of a file, only writing from the first byte that differs from its old contents
+// the first headerSize bytes are always written, since the rpak header changes on every build
+// returns: number of bytes written, or -1 if the file couldn't be written
+size_t RePak::PatchFile(const std::string& path, const std::string& newData, const void* oldData, size_t oldSize, size_t headerSize)
+{
+    const uint8_t* pOldData = static_cast<const uint8_t*>(oldData);
+
+    size_t nFirstChanged = 0;
 
-    // free the memory
-    for (auto& it : g_vRawDataBlocks)
+    if (oldSize > headerSize && newData.size() > headerSize && FILE_EXISTS(path))
     {
-        delete it.dataPtr;
+        size_t nCompareSize = min(newData.size(), oldSize);
+
+        nFirstChanged = headerSize;
+        while (nFirstChanged < nCompareSize && (uint8_t)newData[nFirstChanged] == pOldData[nFirstChanged])
+            nFirstChanged++;
     }
 
-    // write starpak data
-    if (Assets::g_vsStarpakPaths.size() == 1)
+    if (nFirstChanged == 0)
     {
-        std::string sFullPath = Assets::g_vsStarpakPaths[0];
-        std::filesystem::path path(sFullPath);
+        std::ofstream out(path, std::ios::binary);
+
+        if (!out.is_open())
+            return -1;
 
-        std::string filename = path.filename().u8string();
+        out.write(newData.data(), newData.size());
+        return newData.size();
+    }
 
-        BinaryIO srpkOut;
+    std::fstream out(path, std::ios::binary | std::ios::in | std::ios::out);
 
-        srpkOut.open(sOutputDir + filename, BinaryIOMode::Write);
+    if (!out.is_open())
+        return -1;
 
-        int magic = 'kPRS';
-        int version = 1;
-        uint64_t entryCount = Assets::g_vSRPkDataEntries.size();
+    out.write(newData.data(), headerSize);
+    out.seekp(nFirstChanged);
+    out.write(newData.data() + nFirstChanged, newData.size() - nFirstChanged);
+    out.close();
 
-        srpkOut.write(magic);
-        srpkOut.write(version);
+    if (newData.size() < oldSize)
+        std::filesystem::resize_file(path, newData.size());
 
-        // data blocks in starpaks are all aligned to 4096 bytes, including the header which gets filled with 0xCB after the magic
-        // and version
-        char* why = new char[4088];
-        memset(why, 0xCB, 4088);
+    return headerSize + newData.size() - nFirstChanged;
+}
 
-        srpkOut.getWriter()->write(why, 4088);
+// purpose: build every asset in a resolved asset graph in dependency order
+// assets are loaded from the build cache when one is given and they haven't changed since they were stored.
+// if pMarks is given, it receives the build state before each asset in build order, followed by the state after the last one
+// returns: false if a handler failed to add its asset
+bool RePak::BuildAssets(AssetGraph& assetGraph, const std::vector<const AssetTypeHandler_t*>& usedAssetTypes, std::vector<RPakAssetEntryV8>& assetEntries,
+    BuildCache* buildCache, bool bExplainCache, std::vector<BuildStateMark_t>* pMarks)
+{
+    bool bSuccess = true;
+
+    for (auto& it : usedAssetTypes)
+    {
+        if (it->BeginBatch)
+            it->BeginBatch(&assetEntries);
+    }
 
-        for (auto& it : Assets::g_vSRPkDataEntries)
+    for (uint32_t nodeIdx : assetGraph.GetBuildOrder())
+    {
+        AssetGraphNode_t& node = assetGraph.GetNode(nodeIdx);
+        rapidjson::Value& file = *node.mapEntry;
+
+        const char* assetPath = file["path"].GetString();
+
+        if (pMarks)
+            pMarks->push_back(RePak::MarkBuildState(assetEntries));
+
+        BuildCacheKey_t cacheKey{ };
+
+        if (buildCache)
+        {
+            AssetRecord_t record{ };
+            cacheKey = buildCache->MakeKey(node.handler, assetPath, file);
+
+            if (buildCache->Load(cacheKey, assetPath, record))
+            {
+                node.assetIdx = RePak::SpliceAssetRecord(record, assetEntries);
+                continue;
+            }
+        }
+
+        BuildStateMark_t mark = RePak::MarkBuildState(assetEntries);
+
+        if (!node.handler->AddAsset(&assetEntries, assetPath, file))
         {
-            srpkOut.getWriter()->write((const char*)it.dataPtr, it.dataSize);
+            bSuccess = false;
+            break;
         }
 
-        // starpaks have a table of sorts at the end of the file, containing the offsets and data sizes for every data block
-        // as far as i'm aware, this isn't even used by the game, so i'm not entirely sure why it exists?
-        for (auto& it : Assets::g_vSRPkDataEntries)
+        // handlers may skip the asset without adding anything
+        if (assetEntries.size() == mark.assetCount)
+            continue;
+
+        node.assetIdx = mark.assetCount;
+
+        if (buildCache)
         {
-            SRPkFileEntry fe{};
-            fe.offset = it.offset;
-            fe.size = it.dataSize;
+            AssetRecord_t record{ };
 
-            srpkOut.write(fe);
+            if (RePak::CaptureAssetRecord(mark, assetEntries, record))
+                buildCache->Store(cacheKey, record);
+            else if (bExplainCache)
+                Log("asset '%s' can't be cached\n", assetPath);
         }
+    }
+
+    if (pMarks)
+        pMarks->push_back(RePak::MarkBuildState(assetEntries));
 
-        srpkOut.write(entryCount);
-        srpkOut.close();
+    for (auto& it : usedAssetTypes)
+    {
+        if (it->EndBatch)
+            it->EndBatch(&assetEntries);
     }
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+
+    return bSuccess;
+}
+
+// purpose: write the rpak and starpak of a finished map build to the output directory
+// returns: true on success
+bool RePak::WriteMapOutput(const std::string& sOutputDir, const std::string& sRpakName, std::vector<RPakAssetEntryV8>& assetEntries, MapBuildResult_t& result)
+{
+    std::filesystem::create_directories(sOutputDir); // create directory if it does not exist yet.
+
+    RPakFileHeaderV8 rpakHeader{ };
+    rpakHeader.CreatedTime = RePak::GetCreatedTime();
+
+    if (!RePak::WriteRPakFile(sOutputDir + sRpakName + ".rpak", rpakHeader, assetEntries))
+        return false;
+
+    result.rpakName = sRpakName;
+    result.assetCount = assetEntries.size();
+    result.rpakSize = rpakHeader.DecompressedSize;
+
+    // write starpak data
+    if (g_pBuildContext->starpakPaths.size() == 1)
+    {
+        std::filesystem::path path(g_pBuildContext->starpakPaths[0]);
+
+        if (!RePak::WriteStarpakFile(sOutputDir + path.filename().u8string()))
+            return false;
+
+        if (!g_pBuildContext->starpakEntries.empty())
+            result.starpakSize = g_pBuildContext->starpakEntries.back().offset + g_pBuildContext->starpakEntries.back().dataSize;
+    }
+
+    return true;
+}
+
+// purpose: build the rpak described by a map file into the calling thread's build context
+// returns: true on success
+bool RePak::BuildMapFile(const char* mapFile, bool bExplainCache, MapBuildResult_t& result)
+{
+    std::filesystem::path mapPath(mapFile);
+
+    // begin json parsing
+    std::vector<char> mapBuf{ };
+    Document doc{ };
+
+    if (!RePak::LoadMapFile(mapPath, mapBuf, doc))
+        return false;
+
+    std::string sRpakName = RePak::GetRPakName(doc);
+
+    RePak::SetAssetsDir(doc, mapPath);
+    RePak::SetLayoutOptions(doc);
+    RePak::SetReproducibleOptions(doc);
+    RePak::SetOutputOptions(doc);
+
+    std::string sOutputDir = RePak::GetOutputDir(doc, mapPath);
+
+    // assets are only cached between builds when the map file asks for it
+    // builds that share their caches with other builds in the process use a shared instance, which is trimmed once every build is done
+    SharedBuildState_t* pShared = g_pBuildContext->pShared;
+
+    std::unique_ptr<BuildCache> ownedBuildCache{ };
+    BuildCache* buildCache = nullptr;
+
+    if (doc.HasMember("buildCache") && !g_pBuildContext->bNoBuildCache)
+    {
+        std::filesystem::path cacheDirPath(doc["buildCache"].GetStdString());
+
+        if (cacheDirPath.is_relative() && mapPath.has_parent_path())
+            cacheDirPath = mapPath.parent_path() / cacheDirPath;
+
+        // size limit for the cache in megabytes
+        uint64_t nCacheSizeLimit = 4096;
+
+        if (doc.HasMember("buildCacheSize") && doc["buildCacheSize"].IsUint64())
+            nCacheSizeLimit = doc["buildCacheSize"].GetUint64();
+
+        if (pShared)
+        {
+            buildCache = pShared->GetBuildCache(cacheDirPath.u8string(), nCacheSizeLimit * 1024 * 1024, bExplainCache);
+        }
+        else
+        {
+            ownedBuildCache = std::make_unique<BuildCache>(cacheDirPath.u8string(), nCacheSizeLimit * 1024 * 1024, bExplainCache);
+            buildCache = ownedBuildCache.get();
+        }
+    }
+    // end json parsing
+
+    Log("building rpak %s.rpak\n\n", sRpakName.c_str());
+
+    std::vector<RPakAssetEntryV8> assetEntries{ };
+
+    // build asset data
+    // add all assets defined in the map json to the asset graph first, so that they can be built in dependency order
+    // and so each asset type's batch hooks can be run around the whole group of entries for that type
+    AssetGraph assetGraph{ };
+    std::vector<const AssetTypeHandler_t*> usedAssetTypes{ };
+
+    assetGraph.AddMapFileEntries(doc["files"], usedAssetTypes);
+
+    if (!assetGraph.Resolve())
+    {
+        Error("failed to resolve asset dependencies. Exiting...\n");
+        return false;
+    }
+
+    if (!RePak::SetLoadOrder(doc, mapPath, assetGraph))
+        return false;
+
+    std::vector<BuildStateMark_t> marks{ };
+    bool bBuilt = RePak::BuildAssets(assetGraph, usedAssetTypes, assetEntries, buildCache, bExplainCache, &marks);
+
+    if (ownedBuildCache)
+    {
+        buildCache->Trim();
+        buildCache->PrintStats();
+    }
+
+    if (!bBuilt)
+        return false;
+
+    return RePak::WriteBuiltMap(doc, mapPath, assetGraph, marks, assetEntries, sOutputDir, sRpakName, result);
+}
+
+// purpose: write the built assets of a map in the way that the map asks for
+// marks must hold the build state before every asset in build order and after the last one (see RePak::BuildAssets)
+// returns: true on success
+bool RePak::WriteBuiltMap(rapidjson::Document& doc, const std::filesystem::path& mapPath, AssetGraph& assetGraph, const std::vector<BuildStateMark_t>& marks,
+    std::vector<RPakAssetEntryV8>& assetEntries, const std::string& sOutputDir, const std::string& sRpakName, MapBuildResult_t& result)
+{
+    // maps with a release manifest are written as a patch of their previous release
+    if (doc.HasMember("patchManifest") && doc["patchManifest"].IsString())
+    {
+        std::filesystem::path manifestPath(doc["patchManifest"].GetStdString());
+
+        if (manifestPath.is_relative() && mapPath.has_parent_path())
+            manifestPath = mapPath.parent_path() / manifestPath;
+
+        return RePak::WritePatchMapOutput(assetGraph, marks, assetEntries, RePak::GetPakBudget(doc), manifestPath.u8string(), sOutputDir, sRpakName, result);
+    }
+
+    // maps that don't fit within the engine limits or the map's size limits are split into several rpaks
+    return RePak::WriteBudgetedMapOutput(assetGraph, marks, assetEntries, RePak::GetPakBudget(doc), sOutputDir, sRpakName, result);
+}
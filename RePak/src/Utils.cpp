@@ -1,19 +1,6 @@
 #include "pch.h"
 #include "Utils.h"
 
-// purpose: gets size of the specified file
-// returns: file size
-uintmax_t Utils::GetFileSize(std::string filename)
-{
-	try {
-		return std::filesystem::file_size(filename);
-	}
-	catch (std::filesystem::filesystem_error& e) {
-		std::cout << e.what() << '\n';
-		exit(0);
-	}
-}
-
 // purpose: pad buffer to the specified alignment
 // returns: new buffer size
 size_t Utils::PadBuffer(char** buf, size_t size, size_t alignment)
@@ -30,19 +17,6 @@ size_t Utils::PadBuffer(char** buf, size_t size, size_t alignment)
 	return newSize;
 }
 
-// purpose: write vector of strings to the specified BinaryIO instance
-// returns: length of data written
-size_t Utils::WriteStringVector(BinaryIO& out, std::vector<std::string>& dataVector)
-{
-	size_t length = 0;
-	for (auto it = dataVector.begin(); it != dataVector.end(); ++it)
-	{
-		length += (*it).length() + 1;
-		out.writeString(*it);
-	}
-	return length;
-}
-
 // purpose: get current system time as FILETIME
 FILETIME Utils::GetFileTimeBySystem()
 {
@@ -51,14 +25,73 @@ FILETIME Utils::GetFileTimeBySystem()
 	return ft;
 }
 
+// purpose: hash a block of memory
+// this is fnv-1a over 8 byte words rather than single bytes, so large files can be hashed quickly
+// returns: 64 bit hash of the data
+uint64_t Utils::HashData(const void* data, size_t size, uint64_t seed)
+{
+	const uint64_t prime = 0x100000001b3;
+	const uint8_t* pData = static_cast<const uint8_t*>(data);
+
+	uint64_t hash = seed;
+	size_t i = 0;
+
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+	{
+		uint64_t word;
+		memcpy(&word, pData + i, sizeof(word));
+
+		hash = (hash ^ word) * prime;
+		hash ^= hash >> 32;
+	}
+
+	for (; i < size; ++i)
+		hash = (hash ^ pData[i]) * prime;
+
+	return hash ^ size;
+}
+
+// purpose: hash the contents of a file
+// returns: 64 bit hash of the file, or the unchanged seed if the file couldn't be opened
+uint64_t Utils::HashFile(const std::string& filePath, uint64_t seed)
+{
+	std::ifstream file(filePath, std::ios::binary);
+
+	if (!file.is_open())
+		return seed;
+
+	const size_t chunkSize = 1024 * 1024;
+	std::vector<char> buf(chunkSize);
+
+	uint64_t hash = seed;
+	while (file)
+	{
+		file.read(buf.data(), chunkSize);
+		size_t bytesRead = file.gcount();
+
+		if (bytesRead == 0)
+			break;
+
+		hash = HashData(buf.data(), bytesRead, hash);
+	}
+
+	return hash;
+}
+
 // purpose: add backslash to the end of the string if not already present
 void Utils::AppendSlash(std::string& in)
 {
 	char lchar = in[in.size() - 1];
 	if (lchar != '\\' && lchar != '/')
-		in.append("\\");
+		in.append(PATH_SEPARATOR);
 }
 
+// purpose: normalise a path so that differently written paths to the same file compare equal
+// returns: absolute path with forward slashes and no '.' or '..' parts
+std::string Utils::NormalisePath(const std::filesystem::path& path)
+{
+	return std::filesystem::absolute(path).lexically_normal().generic_u8string();
+}
 
 void Warning(const char* fmt, ...)
 {
@@ -77,6 +110,23 @@ void Error(const char* fmt, ...)
 	va_list args;
 	va_start(args, fmt);
 
+	// builds keep their last error, so that callers of the library can be told why a build failed (see PakBuilder::GetError)
+	if (g_pBuildContext)
+	{
+		va_list errorArgs;
+		va_copy(errorArgs, args);
+
+		char error[1024];
+		vsnprintf(error, sizeof(error), fmt, errorArgs);
+
+		va_end(errorArgs);
+
+		g_pBuildContext->sLastError = error;
+
+		while (!g_pBuildContext->sLastError.empty() && g_pBuildContext->sLastError.back() == '\n')
+			g_pBuildContext->sLastError.pop_back();
+	}
+
 	std::string msg = "ERROR: " + std::string(fmt);
 
 	vprintf(msg.c_str(), args);
@@ -92,7 +142,7 @@ void Log(const char* fmt, ...)
 	va_end(args);
 }
 
-void Debug(const char* fmt, ...)
+void Debug([[maybe_unused]] const char* fmt, ...)
 {
 #ifdef _DEBUG
 	va_list args;
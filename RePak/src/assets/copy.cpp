@@ -0,0 +1,260 @@
+#include "pch.h"
+#include "Assets.h"
+#include "BuildCache.h"
+#include "RPakFile.h"
+
+// an rpak that assets are copied out of
+// each rpak is only read once per batch, however many assets are copied from it
+struct CopySourcePak_t
+{
+    RPakFile_t pak;
+    std::string path;
+
+    // data block table of each of the rpak's mandatory starpaks, read when first needed
+    std::vector<std::vector<SRPkFileEntry>> starpakEntries;
+};
+
+static thread_local std::unordered_map<std::string, std::unique_ptr<CopySourcePak_t>> s_CopySourcePaks;
+
+static std::string GetCopySourcePath(rapidjson::Value& mapEntry)
+{
+    if (!mapEntry.HasMember("rpak") || !mapEntry["rpak"].IsString())
+        return "";
+
+    return g_pBuildContext->assetsDir + mapEntry["rpak"].GetStdString();
+}
+
+// purpose: get the rpak that a copy entry takes its asset from
+// returns: pointer to the loaded rpak, or nullptr if it couldn't be read
+static CopySourcePak_t* GetCopySourcePak(const std::string& path)
+{
+    auto it = s_CopySourcePaks.find(path);
+
+    if (it != s_CopySourcePaks.end())
+        return it->second.get();
+
+    std::unique_ptr<CopySourcePak_t> source = std::make_unique<CopySourcePak_t>();
+
+    // failed reads are remembered as well, so the error is only printed once
+    if (RePak::ReadRPakFile(path, source->pak))
+    {
+        source->path = path;
+        source->starpakEntries.resize(source->pak.starpakPaths.size());
+    }
+
+    CopySourcePak_t* pSource = source->path.empty() ? nullptr : source.get();
+    s_CopySourcePaks.emplace(path, std::move(source));
+
+    return pSource;
+}
+
+// purpose: read a data block out of one of a source rpak's mandatory starpaks
+// starpak offsets keep the index of the starpak in their low bits, since the data blocks are always 4096 byte aligned
+// returns: true on success
+static bool ReadCopySourceStarpakBlock(CopySourcePak_t& source, uint64_t starpakOffset, std::vector<uint8_t>& data)
+{
+    const size_t starpakIdx = starpakOffset & 0xFFF;
+    const uint64_t offset = starpakOffset & ~0xFFFull;
+
+    if (starpakIdx >= source.pak.starpakPaths.size())
+        return false;
+
+    const std::string starpakPath = (std::filesystem::path(source.path).parent_path() / std::filesystem::path(source.pak.starpakPaths[starpakIdx]).filename()).u8string();
+    std::vector<SRPkFileEntry>& entries = source.starpakEntries[starpakIdx];
+
+    BinaryReader in;
+
+    if (!in.open(starpakPath))
+        return false;
+
+    try
+    {
+        if (entries.empty())
+        {
+            uint64_t dataEnd = RePak::GetStarpakDataEnd(starpakPath);
+
+            if (dataEnd == (uint64_t)-1)
+                return false;
+
+            in.seek(dataEnd);
+            in.readVector(entries, (in.size() - dataEnd - sizeof(uint64_t)) / sizeof(SRPkFileEntry));
+        }
+
+        for (auto& it : entries)
+        {
+            if (it.offset != offset)
+                continue;
+
+            in.seek(it.offset);
+            in.readVector(data, it.size);
+
+            return true;
+        }
+    }
+    catch (const char*)
+    {
+        return false;
+    }
+
+    return false;
+}
+
+bool Assets::AddCopiedAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry)
+{
+    Debug("Copying asset '%s'\n", assetPath);
+
+    std::string sourcePath = GetCopySourcePath(mapEntry);
+
+    if (sourcePath.empty())
+    {
+        Warning("copied asset '%s' doesn't have an 'rpak' field. skipping asset...\n", assetPath);
+        return true;
+    }
+
+    CopySourcePak_t* source = GetCopySourcePak(sourcePath);
+
+    if (!source)
+    {
+        Warning("failed to read rpak '%s' for copied asset '%s'. skipping asset...\n", sourcePath.c_str(), assetPath);
+        return true;
+    }
+
+    uint64_t guid = Assets::GetCopiedAssetGuid(assetPath, mapEntry);
+    uint32_t assetIdx = 0;
+
+    if (!RePak::GetAssetByGuid(&source->pak.assets, guid, &assetIdx))
+    {
+        Warning("asset '%s' (%" PRIx64 ") is not in rpak '%s'. skipping asset...\n", assetPath, guid, sourcePath.c_str());
+        return true;
+    }
+
+    const RPakAssetEntryV8& sourceAsset = source->pak.assets[assetIdx];
+
+    if (sourceAsset.OptionalStarpakOffset != (uint64_t)-1)
+    {
+        Warning("asset '%s' has optional starpak data, which can't be copied. skipping asset...\n", assetPath);
+        return true;
+    }
+
+    // the asset's pages and descriptors are taken as they are, only their page indices change
+    AssetRecord_t record{};
+
+    if (!RePak::ExtractAssetRecord(source->pak, assetIdx, record))
+    {
+        Warning("asset '%s' shares pages with other assets in rpak '%s' and can't be copied. skipping asset...\n", assetPath, sourcePath.c_str());
+        return true;
+    }
+
+    if (sourceAsset.StarpakOffset != (uint64_t)-1)
+    {
+        record.starpakBlocks.emplace_back();
+
+        if (!ReadCopySourceStarpakBlock(*source, sourceAsset.StarpakOffset, record.starpakBlocks.back()))
+        {
+            Warning("failed to read starpak data for copied asset '%s'. skipping asset...\n", assetPath);
+            return true;
+        }
+
+        // static name for now
+        record.starpakPaths.push_back("paks/Win64/repak.starpak");
+        record.asset.StarpakOffset = 0;
+    }
+
+    RePak::SpliceAssetRecord(record, *assetEntries);
+
+    return true;
+}
+
+uint64_t Assets::GetCopiedAssetGuid(const char* assetPath, rapidjson::Value& mapEntry)
+{
+    // the guid can be given directly for assets whose name isn't known
+    if (mapEntry.HasMember("guid"))
+    {
+        if (mapEntry["guid"].IsUint64())
+            return mapEntry["guid"].GetUint64();
+
+        if (mapEntry["guid"].IsString())
+            return strtoull(mapEntry["guid"].GetString(), nullptr, 0);
+    }
+
+    return RTech::StringToGuid(assetPath);
+}
+
+void Assets::GetCopiedAssetDependencies(const char* assetPath, rapidjson::Value& mapEntry, std::vector<uint64_t>& dependencies)
+{
+    CopySourcePak_t* source = GetCopySourcePak(GetCopySourcePath(mapEntry));
+    uint32_t assetIdx = 0;
+
+    if (!source || !RePak::GetAssetByGuid(&source->pak.assets, Assets::GetCopiedAssetGuid(assetPath, mapEntry), &assetIdx))
+        return;
+
+    const RPakFile_t& pak = source->pak;
+    const RPakAssetEntryV8& asset = pak.assets[assetIdx];
+
+    for (auto& it : pak.guidDescriptors)
+    {
+        if (it.PageIdx < asset.SubHeaderDataBlockIndex || it.PageIdx >= asset.PageEnd || it.PageIdx >= pak.pages.size())
+            continue;
+
+        if (it.PageOffset + sizeof(uint64_t) > pak.pages[it.PageIdx].DataSize)
+            continue;
+
+        uint64_t guid = 0;
+        memcpy(&guid, pak.fileData.data() + pak.pageOffsets[it.PageIdx] + it.PageOffset, sizeof(guid));
+
+        if (guid != 0)
+            dependencies.push_back(guid);
+    }
+}
+
+// purpose: get the files that a copied asset is read from
+// this is the source rpak, along with its starpaks since the asset's streamed data can come from them
+// the build cache doesn't use this since it has to read the whole rpak, see GetCopiedAssetSourceHash
+void Assets::GetCopiedAssetSourceFiles(const char*, rapidjson::Value& mapEntry, std::vector<std::string>& sourceFiles)
+{
+    std::string sourcePath = GetCopySourcePath(mapEntry);
+
+    if (sourcePath.empty())
+        return;
+
+    sourceFiles.push_back(sourcePath);
+
+    CopySourcePak_t* source = GetCopySourcePak(sourcePath);
+
+    if (!source)
+        return;
+
+    for (auto& it : source->pak.starpakPaths)
+        sourceFiles.push_back((std::filesystem::path(sourcePath).parent_path() / std::filesystem::path(it).filename()).u8string());
+}
+
+// purpose: hash the state of the source of a copied asset for the build cache, without reading the source rpak
+// this is the rpak's header, size and write time along with the asset's guid. the rpak's starpaks aren't looked at,
+// since they are written along with the rpak, which changes its write time
+// returns: hash of the asset's source
+uint64_t Assets::GetCopiedAssetSourceHash(const char* assetPath, rapidjson::Value& mapEntry)
+{
+    std::string sourcePath = GetCopySourcePath(mapEntry);
+    uint64_t hash = Utils::HashData(sourcePath.c_str(), sourcePath.length());
+
+    RPakFileHeaderV8 header{};
+    uint64_t fileSize = 0;
+
+    if (!sourcePath.empty() && RePak::ReadInputFileHeader(sourcePath, &header, sizeof(header), &fileSize))
+    {
+        uint64_t fileHash = RePak::GetSourceFileHash(sourcePath);
+
+        hash = Utils::HashData(&header, sizeof(header), hash);
+        hash = Utils::HashData(&fileSize, sizeof(fileSize), hash);
+        hash = Utils::HashData(&fileHash, sizeof(fileHash), hash);
+    }
+
+    uint64_t guid = Assets::GetCopiedAssetGuid(assetPath, mapEntry);
+    return Utils::HashData(&guid, sizeof(guid), hash);
+}
+
+// purpose: release the rpaks that were read for copied assets once every copy entry has been added
+void Assets::EndCopiedAssetBatch(std::vector<RPakAssetEntryV8>*)
+{
+    s_CopySourcePaks.clear();
+}
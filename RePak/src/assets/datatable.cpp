@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "Assets.h"
 #include <regex>
+#include <sstream>
 
 std::unordered_map<std::string, DataTableColumnDataType> DataTableColumnMap =
 {
@@ -48,11 +49,62 @@ uint32_t DataTable_GetEntrySize(DataTableColumnDataType type)
     return 0; // should be unreachable
 }
 
-void Assets::AddDataTableAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry)
+// sizes of the pages that a dtbl adds after its header page
+struct DataTablePageSizes_t
+{
+    uint32_t columnPageSize;
+    uint32_t columnNamesPageSize;
+    uint32_t rowDataPageSize;
+    uint32_t stringEntriesPageSize;
+    size_t stringCellCount; // every string cell gets its own descriptor
+};
+
+// purpose: get the sizes of the pages that a dtbl adds from its csv
+// the last row of the csv holds the column types and isn't part of the table, so there must be at least 2 rows
+// returns: page sizes
+static DataTablePageSizes_t GetDataTablePageSizes(rapidcsv::Document& doc)
+{
+    const size_t columnCount = doc.GetColumnCount();
+    const size_t rowCount = doc.GetRowCount();
+
+    std::vector<std::string> typeRow = doc.GetRow<std::string>(rowCount - 1);
+
+    DataTablePageSizes_t sizes{};
+    sizes.columnPageSize = sizeof(DataTableColumn) * columnCount;
+
+    for (size_t colIdx = 0; colIdx < columnCount; ++colIdx)
+    {
+        DataTableColumnDataType type = GetDataTableTypeFromString(typeRow[colIdx]);
+
+        sizes.columnNamesPageSize += doc.GetColumnName(colIdx).length() + 1;
+        sizes.rowDataPageSize += DataTable_GetEntrySize(type) * (rowCount - 1); // size of type * row count (excluding the type row)
+
+        if (type == DataTableColumnDataType::StringT || type == DataTableColumnDataType::Asset || type == DataTableColumnDataType::AssetNoPrecache)
+        {
+            for (size_t rowIdx = 0; rowIdx < rowCount - 1; ++rowIdx)
+                sizes.stringEntriesPageSize += doc.GetCell<std::string>(colIdx, rowIdx).length() + 1;
+
+            sizes.stringCellCount += rowCount - 1;
+        }
+    }
+
+    return sizes;
+}
+
+bool Assets::AddDataTableAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value&)
 {
     Debug("Adding dtbl asset '%s'\n", assetPath);
 
-    rapidcsv::Document doc(g_sAssetsDir + assetPath + ".csv");
+    std::shared_ptr<const std::vector<uint8_t>> csvData = RePak::ReadInputFile(g_pBuildContext->assetsDir + assetPath + ".csv");
+
+    if (!csvData)
+    {
+        Warning("failed to read csv file for dtbl asset '%s'. skipping asset...\n", assetPath);
+        return true;
+    }
+
+    std::istringstream csvStream(std::string(csvData->begin(), csvData->end()));
+    rapidcsv::Document doc(csvStream);
 
     std::string sAssetName = assetPath;
 
@@ -61,26 +113,21 @@ void Assets::AddDataTableAsset(std::vector<RPakAssetEntryV8>* assetEntries, cons
     const size_t columnCount = doc.GetColumnCount();
     const size_t rowCount = doc.GetRowCount();
 
-    if (columnCount < 0)
+    if (columnCount == 0)
     {
         Warning("Attempted to add dtbl asset with no columns. Skipping asset...\n");
-        return;
+        return true;
     }
 
     if (rowCount < 2)
     {
         Warning("Attempted to add dtbl asset with invalid row count. Skipping asset...\nDTBL    - CSV must have a row of column types at the end of the table\n");
-        return;
+        return true;
     }
 
-    size_t ColumnNameBufSize = 0;
+    DataTablePageSizes_t pageSizes = GetDataTablePageSizes(doc);
 
-    ///-------------------------------------
-    // figure out the required name buf size
-    for (auto& it : doc.GetColumnNames())
-    {
-        ColumnNameBufSize += it.length() + 1;
-    }
+    size_t ColumnNameBufSize = pageSizes.columnNamesPageSize;
 
     ///-----------------------------------------
     // make a page for the sub header
@@ -90,7 +137,7 @@ void Assets::AddDataTableAsset(std::vector<RPakAssetEntryV8>* assetEntries, cons
 
     // DataTableColumn entries
     RPakVirtualSegment ColumnHeaderSegment{};
-    _vseginfo_t colhdrinfo = RePak::CreateNewSegment(sizeof(DataTableColumn) * columnCount, 1, 8, ColumnHeaderSegment, 64);
+    _vseginfo_t colhdrinfo = RePak::CreateNewSegment(pageSizes.columnPageSize, 1, 8, ColumnHeaderSegment, 64);
 
     // column names
     RPakVirtualSegment ColumnNamesSegment{};
@@ -101,11 +148,9 @@ void Assets::AddDataTableAsset(std::vector<RPakAssetEntryV8>* assetEntries, cons
     pHdr->RowCount = rowCount - 1;
     pHdr->ColumnHeaderPtr = { colhdrinfo.index, 0 };
 
-    RePak::RegisterDescriptor(subhdrinfo.index, offsetof(DataTableHeader, ColumnHeaderPtr));
-
     // allocate buffers for the loop
-    char* namebuf = new char[ColumnNameBufSize];
-    char* columnHeaderBuf = new char[sizeof(DataTableColumn) * columnCount];
+    char* namebuf = new char[ColumnNameBufSize]{};
+    char* columnHeaderBuf = new char[pageSizes.columnPageSize]{};
 
     // vectors
     std::vector<std::string> typeRow = doc.GetRow<std::string>(rowCount - 1);
@@ -115,8 +160,8 @@ void Assets::AddDataTableAsset(std::vector<RPakAssetEntryV8>* assetEntries, cons
     uint32_t colIdx = 0;
     // temp var used for storing the row offset for the next column in the loop below
     uint32_t tempColumnRowOffset = 0;
-    uint32_t stringEntriesSize = 0;
-    size_t rowDataPageSize = 0;
+    uint32_t stringEntriesSize = pageSizes.stringEntriesPageSize;
+    size_t rowDataPageSize = pageSizes.rowDataPageSize;
 
     for (auto& it : doc.GetColumnNames())
     {
@@ -134,24 +179,9 @@ void Assets::AddDataTableAsset(std::vector<RPakAssetEntryV8>* assetEntries, cons
 
         columns.emplace_back(col);
 
-        // register name pointer
-        RePak::RegisterDescriptor(colhdrinfo.index, (sizeof(DataTableColumn) * colIdx) + offsetof(DataTableColumn, NamePtr));
-
-        if (type == DataTableColumnDataType::StringT || type == DataTableColumnDataType::Asset || type == DataTableColumnDataType::AssetNoPrecache)
-        {
-            for (size_t i = 0; i < rowCount - 1; ++i)
-            {
-                // this can be std::string since we only really need to deal with the string types here
-                std::vector<std::string> row = doc.GetRow<std::string>(i);
-
-                stringEntriesSize += row[colIdx].length() + 1;
-            }
-        }
-
         *(DataTableColumn*)(columnHeaderBuf + (sizeof(DataTableColumn) * colIdx)) = col;
 
         tempColumnRowOffset += DataTable_GetEntrySize(type);
-        rowDataPageSize += DataTable_GetEntrySize(type) * (rowCount - 1); // size of type * row count (excluding the type row)
         nextNameOffset += it.length() + 1;
         colIdx++;
 
@@ -161,6 +191,9 @@ void Assets::AddDataTableAsset(std::vector<RPakAssetEntryV8>* assetEntries, cons
             pHdr->RowStride = tempColumnRowOffset;
     }
 
+    // register all column name pointers
+    RePak::RegisterHeaderDescriptors(colhdrinfo.index, 0, (DataTableColumn*)columnHeaderBuf, columnCount);
+
     // page for Row Data
     RPakVirtualSegment RowDataSegment{};
     _vseginfo_t rawdatainfo = RePak::CreateNewSegment(rowDataPageSize, 1, 8, RowDataSegment, 64);
@@ -169,9 +202,13 @@ void Assets::AddDataTableAsset(std::vector<RPakAssetEntryV8>* assetEntries, cons
     RPakVirtualSegment StringEntrySegment{};
     _vseginfo_t stringsinfo = RePak::CreateNewSegment(stringEntriesSize, 1, 8, StringEntrySegment, 64);
 
-    char* rowDataBuf = new char[rowDataPageSize];
+    char* rowDataBuf = new char[rowDataPageSize]{};
+
+    char* stringEntryBuf = new char[stringEntriesSize]{};
+
+    rmem valbuf(rowDataBuf, rowDataPageSize, rawdatainfo.index);
 
-    char* stringEntryBuf = new char[stringEntriesSize];
+    uint32_t nextStringEntryOffset = 0;
 
     for (size_t rowIdx = 0; rowIdx < rowCount - 1; ++rowIdx)
     {
@@ -179,9 +216,7 @@ void Assets::AddDataTableAsset(std::vector<RPakAssetEntryV8>* assetEntries, cons
         {
             DataTableColumn col = columns[colIdx];
 
-            char* EntryPtr = (rowDataBuf + (pHdr->RowStride * rowIdx) + col.RowOffset);
-
-            rmem valbuf(EntryPtr);
+            valbuf.seek((pHdr->RowStride * rowIdx) + col.RowOffset, rseekdir::beg);
 
             switch (col.Type)
             {
@@ -233,15 +268,12 @@ void Assets::AddDataTableAsset(std::vector<RPakAssetEntryV8>* assetEntries, cons
             case DataTableColumnDataType::Asset:
             case DataTableColumnDataType::AssetNoPrecache:
             {
-                static uint32_t nextStringEntryOffset = 0;
-
                 RPakPtr stringPtr{ stringsinfo.index, nextStringEntryOffset };
 
                 std::string val = doc.GetCell<std::string>(colIdx, rowIdx);
                 snprintf(stringEntryBuf + nextStringEntryOffset, val.length() + 1, "%s", val.c_str());
 
-                valbuf.write(stringPtr);
-                RePak::RegisterDescriptor(rawdatainfo.index, (pHdr->RowStride * rowIdx) + col.RowOffset);
+                valbuf.writePtr(stringPtr);
 
                 nextStringEntryOffset += val.length() + 1;
                 break;
@@ -252,7 +284,7 @@ void Assets::AddDataTableAsset(std::vector<RPakAssetEntryV8>* assetEntries, cons
 
     pHdr->RowHeaderPtr = { rawdatainfo.index, 0 };
 
-    RePak::RegisterDescriptor(subhdrinfo.index, offsetof(DataTableHeader, RowHeaderPtr));
+    RePak::RegisterHeaderDescriptors(subhdrinfo.index, 0, pHdr);
 
     // add raw data blocks
     RPakRawDataBlock shDataBlock{ subhdrinfo.index, subhdrinfo.size, (uint8_t*)pHdr };
@@ -279,4 +311,55 @@ void Assets::AddDataTableAsset(std::vector<RPakAssetEntryV8>* assetEntries, cons
     asset.Un2 = 1;
 
     assetEntries->push_back(asset);
-}
\ No newline at end of file
+
+    return true;
+}
+
+// purpose: get the guid of the dtbl described by a map file entry
+// returns: dtbl guid
+uint64_t Assets::GetDataTableGuid(const char* assetPath, rapidjson::Value&)
+{
+    return RTech::StringToGuid((std::string(assetPath) + ".rpak").c_str());
+}
+
+// purpose: get the files that the dtbl described by a map file entry is built from
+void Assets::GetDataTableSourceFiles(const char* assetPath, rapidjson::Value&, std::vector<std::string>& sourceFiles)
+{
+    sourceFiles.push_back(g_pBuildContext->assetsDir + assetPath + ".csv");
+}
+
+// purpose: get the pages of the dtbl described by a map file entry from the shape of its csv file
+// the csv is small next to the rest of a map, so it is parsed in full for the size of its string cells
+// returns: false if the csv is missing or has no type row
+bool Assets::PlanDataTableAsset(const char* assetPath, rapidjson::Value&, AssetPlan_t& plan)
+{
+    std::shared_ptr<const std::vector<uint8_t>> csvData = RePak::ReadInputFile(g_pBuildContext->assetsDir + assetPath + ".csv");
+
+    if (!csvData)
+    {
+        Warning("failed to read csv file for dtbl asset '%s'\n", assetPath);
+        return false;
+    }
+
+    std::istringstream csvStream(std::string(csvData->begin(), csvData->end()));
+    rapidcsv::Document doc(csvStream);
+
+    if (doc.GetRowCount() < 2)
+    {
+        Warning("dtbl asset '%s' has an invalid row count\n", assetPath);
+        return false;
+    }
+
+    DataTablePageSizes_t pageSizes = GetDataTablePageSizes(doc);
+
+    plan.pages.push_back({ sizeof(DataTableHeader), 0, 8 });
+    plan.pages.push_back({ pageSizes.columnPageSize, 1, 8, 64 });
+    plan.pages.push_back({ pageSizes.columnNamesPageSize, 1, 8, 64 });
+    plan.pages.push_back({ pageSizes.rowDataPageSize, 1, 8, 64 });
+    plan.pages.push_back({ pageSizes.stringEntriesPageSize, 1, 8, 64 });
+
+    // column and row pointers, the name of every column and every string cell
+    plan.descriptorCount = 2 + doc.GetColumnCount() + pageSizes.stringCellCount;
+
+    return true;
+}
@@ -1,11 +1,32 @@
 #include "pch.h"
 #include "Assets.h"
 
-void Assets::AddMaterialAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry)
+// sizes of the pages that a material adds after its header page
+struct MaterialPageSizes_t
+{
+    uint32_t dataPageSize; // name, both texture guid arrays and the surface name
+    uint32_t cpuPageSize;
+};
+
+// purpose: get the sizes of the pages that a material adds
+// used by both AddMaterialAsset and PlanMaterialAsset so that the plan matches the build
+// returns: page sizes
+static MaterialPageSizes_t GetMaterialPageSizes(const char* assetPath, size_t textureCount, const std::string& surface)
+{
+    uint32_t assetPathSize = strlen(assetPath) + 1;
+    size_t textureRefSize = textureCount * sizeof(uint64_t);
+
+    MaterialPageSizes_t sizes{};
+    sizes.dataPageSize = (assetPathSize + (assetPathSize % 4)) + (textureRefSize * 2) + (surface.length() + 1);
+    sizes.cpuPageSize = sizeof(MaterialCPUHeader) + MATL_CPU_DATA_SIZE;
+
+    return sizes;
+}
+
+bool Assets::AddMaterialAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry)
 {
     Debug("Adding matl asset '%s'\n", assetPath);
 
-    uint32_t assetUsesCount = 0; // Track how often the asset is used.
     MaterialHeader* mtlHdr = new MaterialHeader();
     std::string sAssetPath = std::string(assetPath);
 
@@ -53,11 +74,13 @@ void Assets::AddMaterialAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
     else
     {
         Warning("Trying to add material with no textures. Skipping asset...\n");
-        return;
+        return true;
     }
 
+    MaterialPageSizes_t pageSizes = GetMaterialPageSizes(assetPath, mapEntry["textures"].GetArray().Size(), surface);
+
     uint32_t assetPathSize = (sAssetPath.length() + 1);
-    uint32_t dataBufSize = (assetPathSize + (assetPathSize % 4)) + (textureRefSize * 2) + (surface.length() + 1);
+    uint32_t dataBufSize = pageSizes.dataPageSize;
 
     RPakVirtualSegment SubHeaderSegment;
     _vseginfo_t subhdrinfo = RePak::CreateNewSegment(sizeof(MaterialHeader), 0, 8, SubHeaderSegment);
@@ -79,7 +102,6 @@ void Assets::AddMaterialAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
     size_t guidPageOffset = sAssetPath.length() + 1 + assetPathAlignment;
 
     int textureIdx = 0;
-    int fileRelationIdx = -1;
     for (auto& it : mapEntry["textures"].GetArray()) // Now we setup the first TextureGUID Map.
     {
         if (it.GetStdString() != "")
@@ -87,18 +109,6 @@ void Assets::AddMaterialAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
             uint64_t textureGUID = RTech::StringToGuid((it.GetStdString() + ".rpak").c_str()); // Convert texture path to guid.
             *(uint64_t*)dataBuf = textureGUID;
             RePak::RegisterGuidDescriptor(dataseginfo.index, guidPageOffset + (textureIdx * sizeof(uint64_t))); // Register GUID descriptor for current texture index.
-
-            if (fileRelationIdx == -1)
-                fileRelationIdx = RePak::AddFileRelation(assetEntries->size());
-            else
-                RePak::AddFileRelation(assetEntries->size());
-
-            RPakAssetEntryV8* txtrAsset = RePak::GetAssetByGuid(assetEntries, textureGUID, nullptr);
-
-            txtrAsset->RelationsStartIndex = fileRelationIdx;
-            txtrAsset->RelationsCount++;
-
-            assetUsesCount++;
         }
         dataBuf += sizeof(uint64_t);
         textureIdx++; // Next texture index coming up.
@@ -112,15 +122,6 @@ void Assets::AddMaterialAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
             uint64_t guid = RTech::StringToGuid((it.GetStdString() + ".rpak").c_str());
             *(uint64_t*)dataBuf = guid;
             RePak::RegisterGuidDescriptor(dataseginfo.index, guidPageOffset + textureRefSize + (textureIdx * sizeof(uint64_t)));
-
-            RePak::AddFileRelation(assetEntries->size());
-
-            RPakAssetEntryV8* txtrAsset = RePak::GetAssetByGuid(assetEntries, guid, nullptr);
-
-            txtrAsset->RelationsStartIndex = fileRelationIdx;
-            txtrAsset->RelationsCount++;
-
-            assetUsesCount++; // Next texture index coming up.
         }
         dataBuf += sizeof(uint64_t);
         textureIdx++;
@@ -141,9 +142,6 @@ void Assets::AddMaterialAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
     mtlHdr->SurfaceName.Index = dataseginfo.index;
     mtlHdr->SurfaceName.Offset = (sAssetPath.length() + 1) + assetPathAlignment + (textureRefSize * 2);
 
-    RePak::RegisterDescriptor(subhdrinfo.index, offsetof(MaterialHeader, Name));
-    RePak::RegisterDescriptor(subhdrinfo.index, offsetof(MaterialHeader, SurfaceName));
-
     // Type Handling
     if (type == "sknp")
     {
@@ -155,14 +153,6 @@ void Assets::AddMaterialAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
         mtlHdr->GUIDRefs[2] = 0xF95A7FA9E8DE1A0E;
         mtlHdr->GUIDRefs[3] = 0x227C27B608B3646B;
 
-        RePak::RegisterGuidDescriptor(subhdrinfo.index, offsetof(MaterialHeader, GUIDRefs));
-        RePak::RegisterGuidDescriptor(subhdrinfo.index, offsetof(MaterialHeader, GUIDRefs) + 8);
-        RePak::RegisterGuidDescriptor(subhdrinfo.index, offsetof(MaterialHeader, GUIDRefs) + 16);
-        RePak::RegisterGuidDescriptor(subhdrinfo.index, offsetof(MaterialHeader, GUIDRefs) + 24);
-
-        RePak::AddFileRelation(assetEntries->size(), 4);
-        assetUsesCount += 4;
-
         mtlHdr->ShaderSetGUID = 0x1D9FFF314E152725;
     }
     else if (type == "wldc")
@@ -173,21 +163,9 @@ void Assets::AddMaterialAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
         mtlHdr->GUIDRefs[2] = 0xD306370918620EC0; // DepthVSM
         mtlHdr->GUIDRefs[3] = 0xDAB17AEAD2D3387A; // DepthShadowTight
 
-        RePak::RegisterGuidDescriptor(subhdrinfo.index, offsetof(MaterialHeader, GUIDRefs));
-        RePak::RegisterGuidDescriptor(subhdrinfo.index, offsetof(MaterialHeader, GUIDRefs) + 8);
-        RePak::RegisterGuidDescriptor(subhdrinfo.index, offsetof(MaterialHeader, GUIDRefs) + 16);
-        RePak::RegisterGuidDescriptor(subhdrinfo.index, offsetof(MaterialHeader, GUIDRefs) + 24);
-
-        RePak::AddFileRelation(assetEntries->size(), 4);
-        assetUsesCount += 4;
-
         mtlHdr->ShaderSetGUID = 0x4B0F3B4CBD009096;
     }
 
-    RePak::RegisterGuidDescriptor(subhdrinfo.index, offsetof(MaterialHeader, ShaderSetGUID));
-    RePak::AddFileRelation(assetEntries->size());
-    assetUsesCount++;
-
     // Is this a colpass asset?
     bool bColpass = false;
     if (mapEntry.HasMember("colpass"))
@@ -195,10 +173,6 @@ void Assets::AddMaterialAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
         std::string colpassPath = "material/" + mapEntry["colpass"].GetStdString() + ".rpak";
         mtlHdr->GUIDRefs[4] = RTech::StringToGuid(colpassPath.c_str());
 
-        RePak::RegisterGuidDescriptor(subhdrinfo.index, offsetof(MaterialHeader, GUIDRefs) + 32);
-        RePak::AddFileRelation(assetEntries->size());
-        assetUsesCount++;
-
         bColpass = false;
     }
     mtlHdr->TextureGUIDs.Index = dataseginfo.index;
@@ -207,8 +181,8 @@ void Assets::AddMaterialAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
     mtlHdr->TextureGUIDs2.Index = dataseginfo.index;
     mtlHdr->TextureGUIDs2.Offset = guidPageOffset + textureRefSize;
 
-    RePak::RegisterDescriptor(subhdrinfo.index, offsetof(MaterialHeader, TextureGUIDs));
-    RePak::RegisterDescriptor(subhdrinfo.index, offsetof(MaterialHeader, TextureGUIDs2));
+    // register the pointers and guid refs for every field that has been set in the header
+    RePak::RegisterHeaderDescriptors(subhdrinfo.index, 0, mtlHdr);
 
     mtlHdr->something = 0x72000000;
     mtlHdr->something2 = 0x100000;
@@ -229,7 +203,7 @@ void Assets::AddMaterialAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
     /// cpu
 
     // required for accurate colour
-    unsigned char testData[544] = {
+    unsigned char testData[MATL_CPU_DATA_SIZE] = {
         0x00, 0x00, 0x80, 0x3F, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00, 0x80, 0x3F,
         0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0x3F, 0x00, 0x00, 0x00, 0x00,
         0x00, 0x00, 0x00, 0x80, 0x00, 0x00, 0x80, 0x3F, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -269,16 +243,16 @@ void Assets::AddMaterialAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
     std::uint64_t cpuDataSize = sizeof(testData) / sizeof(unsigned char);
 
     RPakVirtualSegment CPUSegment;
-    _vseginfo_t cpuseginfo = RePak::CreateNewSegment(sizeof(MaterialCPUHeader) + cpuDataSize, 3, 16, CPUSegment);
+    _vseginfo_t cpuseginfo = RePak::CreateNewSegment(pageSizes.cpuPageSize, 3, 16, CPUSegment);
 
     MaterialCPUHeader cpuhdr{};
     cpuhdr.Unknown.Index = cpuseginfo.index;
     cpuhdr.Unknown.Offset = sizeof(MaterialCPUHeader);
     cpuhdr.DataSize = cpuDataSize;
 
-    RePak::RegisterDescriptor(cpuseginfo.index, 0);
+    RePak::RegisterHeaderDescriptors(cpuseginfo.index, 0, &cpuhdr);
 
-    char* cpuData = new char[sizeof(MaterialCPUHeader) + cpuDataSize];
+    char* cpuData = new char[pageSizes.cpuPageSize]{};
 
     memcpy_s(cpuData, 16, &cpuhdr, 16);
 
@@ -304,8 +278,72 @@ void Assets::AddMaterialAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
     asset.PageEnd = cpuseginfo.index + 1;
     asset.Un2 = bColpass ? 7 : 8; // what
 
-    asset.UsesStartIndex = fileRelationIdx;
-    asset.UsesCount = assetUsesCount;
-
     assetEntries->push_back(asset);
-}
\ No newline at end of file
+
+    return true;
+}
+
+// purpose: get the guid of the material described by a map file entry
+// returns: material guid
+uint64_t Assets::GetMaterialGuid(const char* assetPath, rapidjson::Value& mapEntry)
+{
+    std::string type = mapEntry.HasMember("type") ? mapEntry["type"].GetStdString() : "sknp";
+
+    return RTech::StringToGuid(("material/" + std::string(assetPath) + "_" + type + ".rpak").c_str());
+}
+
+// purpose: get the guids of all assets that a material map file entry references
+void Assets::GetMaterialDependencies(const char*, rapidjson::Value& mapEntry, std::vector<uint64_t>& dependencies)
+{
+    if (mapEntry.HasMember("textures"))
+    {
+        for (auto& it : mapEntry["textures"].GetArray())
+        {
+            if (it.GetStringLength() != 0)
+                dependencies.push_back(RTech::StringToGuid((it.GetStdString() + ".rpak").c_str()));
+        }
+    }
+
+    if (mapEntry.HasMember("colpass"))
+        dependencies.push_back(RTech::StringToGuid(("material/" + mapEntry["colpass"].GetStdString() + ".rpak").c_str()));
+}
+
+// purpose: get the pages of the material described by a map file entry
+// their sizes only depend on the map file entry, so no files are read
+// returns: false if the entry has no textures
+bool Assets::PlanMaterialAsset(const char* assetPath, rapidjson::Value& mapEntry, AssetPlan_t& plan)
+{
+    if (!mapEntry.HasMember("textures"))
+    {
+        Warning("material asset '%s' doesn't have a 'textures' field\n", assetPath);
+        return false;
+    }
+
+    std::string type = mapEntry.HasMember("type") ? mapEntry["type"].GetStdString() : "sknp";
+    std::string surface = mapEntry.HasMember("surface") ? mapEntry["surface"].GetStdString() : "default";
+
+    MaterialPageSizes_t pageSizes = GetMaterialPageSizes(assetPath, mapEntry["textures"].GetArray().Size(), surface);
+
+    plan.pages.push_back({ sizeof(MaterialHeader), 0, 8 });
+    plan.pages.push_back({ pageSizes.dataPageSize, 1, 64 });
+    plan.pages.push_back({ pageSizes.cpuPageSize, 3, 16 });
+
+    // name, surface name and both texture guid pointers, and the cpu data pointer
+    plan.descriptorCount = 5;
+
+    // every texture is referenced twice
+    for (auto& it : mapEntry["textures"].GetArray())
+    {
+        if (it.GetStringLength() != 0)
+            plan.guidDescriptorCount += 2;
+    }
+
+    // the shader guids that are set for the type
+    if (type == "sknp" || type == "wldc")
+        plan.guidDescriptorCount += 5;
+
+    if (mapEntry.HasMember("colpass"))
+        plan.guidDescriptorCount++;
+
+    return true;
+}
@@ -1,7 +1,14 @@
 #include "pch.h"
 #include "Assets.h"
 
-void Assets::AddModelAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry)
+// purpose: get the size of the data page of a model, which holds its name followed by its skeleton
+// returns: data page size
+static uint32_t GetModelDataPageSize(const std::string& sAssetName, const studiohdr_t& mdlhdr)
+{
+    return (sAssetName.length() + 1) + mdlhdr.dataLength;
+}
+
+bool Assets::AddModelAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value&)
 {
     Debug("Adding mdl_ asset '%s'\n", assetPath);
 
@@ -9,73 +16,93 @@ void Assets::AddModelAsset(std::vector<RPakAssetEntryV8>* assetEntries, const ch
 
     ModelHeader* pHdr = new ModelHeader();
 
-    std::string rmdlFilePath = g_sAssetsDir + sAssetName;
-    std::string vgFilePath = g_sAssetsDir + std::string(assetPath) + ".vg";
+    std::string rmdlFilePath = g_pBuildContext->assetsDir + sAssetName;
+    std::string vgFilePath = g_pBuildContext->assetsDir + std::string(assetPath) + ".vg";
 
     ///-------------------
     // Begin skeleton(.rmdl) input
-    BinaryIO skelInput;
-    skelInput.open(rmdlFilePath, BinaryIOMode::Read);
+    std::shared_ptr<const std::vector<uint8_t>> skelData = RePak::ReadInputFile(rmdlFilePath);
 
-    studiohdr_t mdlhdr = skelInput.read<studiohdr_t>();
+    if (!skelData || skelData->size() < sizeof(studiohdr_t))
+    {
+        Warning("failed to read skeleton file for model asset '%s'. skipping asset...\n", sAssetName.c_str());
+        return true;
+    }
+
+    studiohdr_t mdlhdr{};
+    memcpy(&mdlhdr, skelData->data(), sizeof(studiohdr_t));
 
     if (mdlhdr.id != 0x54534449)
     {
         Warning("invalid file magic for model asset '%s'. expected %x, found %x. skipping asset...\n", sAssetName.c_str(), 0x54534449, mdlhdr.id);
-        return;
+        return true;
     }
 
     if (mdlhdr.version != 54)
     {
         Warning("invalid version for model asset '%s'. expected %i, found %i. skipping asset...\n", sAssetName.c_str(), 0x36, mdlhdr.version);
-        return;
+        return true;
     }
 
-    // go back to the beginning of the file to read all the data
-    skelInput.seek(0);
+    if ((size_t)mdlhdr.dataLength > skelData->size())
+    {
+        Warning("skeleton file for model asset '%s' is truncated. expected %i bytes, found %zu. skipping asset...\n", sAssetName.c_str(), mdlhdr.dataLength, skelData->size());
+        return true;
+    }
+
+    if ((uint64_t)mdlhdr.texture_offset + (uint64_t)mdlhdr.texture_count * sizeof(materialref_t) > (uint64_t)mdlhdr.dataLength)
+    {
+        Warning("skeleton file for model asset '%s' has material refs past the end of its data. skipping asset...\n", sAssetName.c_str());
+        return true;
+    }
 
     uint32_t fileNameDataSize = sAssetName.length() + 1;
+    uint32_t dataPageSize = GetModelDataPageSize(sAssetName, mdlhdr);
 
-    char* pDataBuf = new char[fileNameDataSize + mdlhdr.dataLength];
+    char* pDataBuf = new char[dataPageSize];
 
     // write the model file path into the data buffer
     snprintf(pDataBuf, fileNameDataSize, "%s", sAssetName.c_str());
     // write the skeleton data into the data buffer
-    skelInput.getReader()->read(pDataBuf + fileNameDataSize, mdlhdr.dataLength);
-    skelInput.close();
+    memcpy(pDataBuf + fileNameDataSize, skelData->data(), mdlhdr.dataLength);
 
     ///--------------------
     // Add VG data
-    BinaryIO vgInput;
-    vgInput.open(vgFilePath, BinaryIOMode::Read);
+    std::shared_ptr<const std::vector<uint8_t>> vgData = RePak::ReadInputFile(vgFilePath);
+
+    if (!vgData || vgData->size() < sizeof(BasicRMDLVGHeader))
+    {
+        Warning("failed to read vg file for model asset '%s'. skipping asset...\n", sAssetName.c_str());
+        delete[] pDataBuf;
+        return true;
+    }
 
-    BasicRMDLVGHeader bvgh = vgInput.read<BasicRMDLVGHeader>();
+    BasicRMDLVGHeader bvgh{};
+    memcpy(&bvgh, vgData->data(), sizeof(BasicRMDLVGHeader));
 
     if (bvgh.magic != 0x47567430)
     {
         Warning("invalid vg file magic for model asset '%s'. expected %x, found %x. skipping asset...\n", sAssetName.c_str(), 0x47567430, bvgh.magic);
-        return;
+        delete[] pDataBuf;
+        return true;
     }
 
     if (bvgh.version != 1)
     {
         Warning("invalid vg version for model asset '%s'. expected %i, found %i. skipping asset...\n", sAssetName.c_str(), 1, bvgh.version);
-        return;
+        delete[] pDataBuf;
+        return true;
     }
 
-    vgInput.seek(0, std::ios::end);
-
-    uint32_t vgFileSize = vgInput.tell();
+    uint32_t vgFileSize = vgData->size();
     char* pVGBuf = new char[vgFileSize];
 
-    vgInput.seek(0);
-    vgInput.getReader()->read(pVGBuf, vgFileSize);
-    vgInput.close();
+    memcpy(pVGBuf, vgData->data(), vgFileSize);
 
     // static name for now
     RePak::AddStarpakReference("paks/Win64/repak.starpak");
 
-    SRPkDataEntry de{ -1, vgFileSize, (uint8_t*)pVGBuf };
+    SRPkDataEntry de{ (uint64_t)-1, vgFileSize, (uint8_t*)pVGBuf };
     uint64_t starpakOffset = RePak::AddStarpakDataEntry(de);
 
     pHdr->DataCacheSize = vgFileSize;
@@ -84,7 +111,7 @@ void Assets::AddModelAsset(std::vector<RPakAssetEntryV8>* assetEntries, const ch
     _vseginfo_t subhdrinfo = RePak::CreateNewSegment(sizeof(ModelHeader), 0, 8, SubHeaderSegment);
 
     RPakVirtualSegment DataSegment{};
-    _vseginfo_t dataseginfo = RePak::CreateNewSegment(mdlhdr.dataLength + fileNameDataSize, 1, 64, DataSegment);
+    _vseginfo_t dataseginfo = RePak::CreateNewSegment(dataPageSize, 1, 64, DataSegment);
 
     //RPakVirtualSegment VGSegment{};
     //uint32_t vgIdx = RePak::CreateNewSegment(vgFileSize, 67, 1, DataSegment);
@@ -96,11 +123,9 @@ void Assets::AddModelAsset(std::vector<RPakAssetEntryV8>* assetEntries, const ch
     //pHdr->VGPtr = { vgIdx, 0 };
     //pHdr->DataCacheSize = vgFileSize;
 
-    RePak::RegisterDescriptor(subhdrinfo.index, offsetof(ModelHeader, SkeletonPtr));
-    RePak::RegisterDescriptor(subhdrinfo.index, offsetof(ModelHeader, NamePtr));
-    //RePak::RegisterDescriptor(shsIdx, offsetof(ModelHeader, VGPtr));
+    RePak::RegisterHeaderDescriptors(subhdrinfo.index, 0, pHdr);
 
-    rmem dataBuf(pDataBuf);
+    rmem dataBuf(pDataBuf, dataPageSize);
     dataBuf.seek(fileNameDataSize + mdlhdr.texture_offset, rseekdir::beg);
 
     // this shouldn't be needed - the game doesn't register these
@@ -134,11 +159,97 @@ void Assets::AddModelAsset(std::vector<RPakAssetEntryV8>* assetEntries, const ch
     // during (what i assume is) regular reference conversion
     // a potential solution to the material guid conversion issue could be just registering the guids?
     // 
-    size_t fileRelationIdx = RePak::AddFileRelation(assetEntries->size());
-    asset.UsesStartIndex = fileRelationIdx;
-    asset.UsesCount = 1;
+    // uses and relations are filled in from the asset graph once all assets have been added
 
     assetEntries->push_back(asset);
 
-    Log("%i\n", g_vsStarpakPaths.size());
-}
\ No newline at end of file
+    return true;
+}
+
+// purpose: get the guid of the model described by a map file entry
+// returns: model guid
+uint64_t Assets::GetModelGuid(const char* assetPath, rapidjson::Value&)
+{
+    return RTech::StringToGuid((std::string(assetPath) + ".rmdl").c_str());
+}
+
+// purpose: get the guids of all materials that a model references
+// only the studiohdr and material refs are read from the skeleton file
+void Assets::GetModelDependencies(const char* assetPath, rapidjson::Value&, std::vector<uint64_t>& dependencies)
+{
+    std::string rmdlFilePath = g_pBuildContext->assetsDir + assetPath + ".rmdl";
+
+    std::shared_ptr<const std::vector<uint8_t>> skelData = RePak::ReadInputFile(rmdlFilePath);
+
+    if (!skelData || skelData->size() < sizeof(studiohdr_t))
+        return;
+
+    studiohdr_t mdlhdr{};
+    memcpy(&mdlhdr, skelData->data(), sizeof(studiohdr_t));
+
+    if (mdlhdr.id != 0x54534449)
+        return;
+
+    // don't read past the end of truncated files
+    if ((uint64_t)mdlhdr.texture_offset + (uint64_t)mdlhdr.texture_count * sizeof(materialref_t) > skelData->size())
+        return;
+
+    BinaryReader skelBuf(skelData->data(), skelData->size());
+    skelBuf.seek(mdlhdr.texture_offset);
+
+    for (int i = 0; i < mdlhdr.texture_count; ++i)
+    {
+        materialref_t ref = skelBuf.read<materialref_t>();
+
+        if (ref.guid != 0)
+            dependencies.push_back(ref.guid);
+    }
+}
+
+// purpose: get the files that the model described by a map file entry is built from
+void Assets::GetModelSourceFiles(const char* assetPath, rapidjson::Value&, std::vector<std::string>& sourceFiles)
+{
+    sourceFiles.push_back(g_pBuildContext->assetsDir + assetPath + ".rmdl");
+    sourceFiles.push_back(g_pBuildContext->assetsDir + assetPath + ".vg");
+}
+
+// purpose: get the pages and starpak data of the model described by a map file entry
+// only the studiohdr of the skeleton file and the header of the vg file are read
+// returns: false if either file is missing or invalid
+bool Assets::PlanModelAsset(const char* assetPath, rapidjson::Value&, AssetPlan_t& plan)
+{
+    std::string sAssetName = std::string(assetPath) + ".rmdl";
+
+    studiohdr_t mdlhdr{};
+
+    if (!RePak::ReadInputFileHeader(g_pBuildContext->assetsDir + sAssetName, &mdlhdr, sizeof(mdlhdr)))
+    {
+        Warning("failed to read skeleton file for model asset '%s'\n", sAssetName.c_str());
+        return false;
+    }
+
+    if (mdlhdr.id != 0x54534449 || mdlhdr.version != 54)
+    {
+        Warning("skeleton file for model asset '%s' is not a valid v54 rmdl\n", sAssetName.c_str());
+        return false;
+    }
+
+    BasicRMDLVGHeader bvgh{};
+    uint64_t vgFileSize = 0;
+
+    if (!RePak::ReadInputFileHeader(g_pBuildContext->assetsDir + assetPath + ".vg", &bvgh, sizeof(bvgh), &vgFileSize) || bvgh.magic != 0x47567430 || bvgh.version != 1)
+    {
+        Warning("failed to read vg file for model asset '%s'\n", sAssetName.c_str());
+        return false;
+    }
+
+    plan.pages.push_back({ sizeof(ModelHeader), 0, 8 });
+    plan.pages.push_back({ GetModelDataPageSize(sAssetName, mdlhdr), 1, 64 });
+    plan.starpakBlockSizes.push_back(vgFileSize);
+
+    // name and skeleton pointers, and a guid for every material ref
+    plan.descriptorCount = 2;
+    plan.guidDescriptorCount = mdlhdr.texture_count;
+
+    return true;
+}
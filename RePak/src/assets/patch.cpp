@@ -1,28 +1,58 @@
 #include "pch.h"
 #include "Assets.h"
+#include "PatchBuild.h"
 
-void Assets::AddPatchAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry)
+// purpose: get the rpaks that the Ptch described by a map file entry gives patch numbers to
+// "entries" lists rpak names with their patch numbers, and "manifests" lists release manifests of rpaks that are built as patches
+// (see RePak::WritePatchMapOutput), which give the rpak's name and the number of its last patch
+// returns: size of the data page, which holds a name pointer and a patch number for every entry followed by their names
+static uint32_t GetPatchEntries(rapidjson::Value& mapEntry, std::vector<PtchEntry>& patchEntries)
 {
-    Debug("Adding Ptch asset '%s'\n", assetPath);
+    uint32_t entryNamesSectionSize = 0;
 
-    PtchHeader* pHdr = new PtchHeader();
+    if (mapEntry.HasMember("entries"))
+    {
+        for (auto& it : mapEntry["entries"].GetArray())
+        {
+            std::string name = it["name"].GetStdString();
+            uint8_t patchNum = it["patchnum"].GetInt();
 
-    pHdr->patchedPakCount = mapEntry["entries"].GetArray().Size();
+            patchEntries.push_back({ name, patchNum, entryNamesSectionSize });
 
-    std::vector<PtchEntry> patchEntries{};
-    uint32_t entryNamesSectionSize = 0;
+            entryNamesSectionSize += name.length() + 1;
+        }
+    }
 
-    for (auto& it : mapEntry["entries"].GetArray())
+    if (mapEntry.HasMember("manifests"))
     {
-        std::string name = it["name"].GetStdString();
-        uint8_t patchNum = it["patchnum"].GetInt();
+        for (auto& it : mapEntry["manifests"].GetArray())
+        {
+            ReleaseManifest_t manifest{};
+
+            if (!RePak::ReadReleaseManifest(g_pBuildContext->assetsDir + it.GetStdString(), manifest))
+                continue;
 
-        patchEntries.push_back({ name, patchNum, entryNamesSectionSize });
+            std::string name = manifest.rpakName + ".rpak";
 
-        entryNamesSectionSize += name.length() + 1;
+            patchEntries.push_back({ name, (uint8_t)manifest.patchNum, entryNamesSectionSize });
+
+            entryNamesSectionSize += name.length() + 1;
+        }
     }
 
-    size_t dataPageSize = (sizeof(RPakPtr) * pHdr->patchedPakCount) + (sizeof(uint8_t) * pHdr->patchedPakCount) + entryNamesSectionSize;
+    return (sizeof(RPakPtr) + sizeof(uint8_t)) * patchEntries.size() + entryNamesSectionSize;
+}
+
+bool Assets::AddPatchAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry)
+{
+    Debug("Adding Ptch asset '%s'\n", assetPath);
+
+    PtchHeader* pHdr = new PtchHeader();
+
+    std::vector<PtchEntry> patchEntries{};
+    uint32_t dataPageSize = GetPatchEntries(mapEntry, patchEntries);
+
+    pHdr->patchedPakCount = patchEntries.size();
 
     RPakVirtualSegment SubHeaderPage;
     _vseginfo_t subhdrinfo = RePak::CreateNewSegment(sizeof(PtchHeader), 0, 8, SubHeaderPage);
@@ -33,11 +63,10 @@ void Assets::AddPatchAsset(std::vector<RPakAssetEntryV8>* assetEntries, const ch
     pHdr->pPakNames = { dataseginfo.index, 0 };
     pHdr->pPakPatchNums = { dataseginfo.index, (int)sizeof(RPakPtr) * pHdr->patchedPakCount };
 
-    RePak::RegisterDescriptor(subhdrinfo.index, offsetof(PtchHeader, pPakNames));
-    RePak::RegisterDescriptor(subhdrinfo.index, offsetof(PtchHeader, pPakPatchNums));
+    RePak::RegisterHeaderDescriptors(subhdrinfo.index, 0, pHdr);
 
-    char* pDataBuf = new char[dataPageSize];
-    rmem dataBuf(pDataBuf);
+    char* pDataBuf = new char[dataPageSize]{};
+    rmem dataBuf(pDataBuf, dataPageSize, dataseginfo.index);
 
     uint32_t i = 0;
     for (auto& it : patchEntries)
@@ -45,13 +74,12 @@ void Assets::AddPatchAsset(std::vector<RPakAssetEntryV8>* assetEntries, const ch
         uint32_t fileNameOffset = (sizeof(RPakPtr) * pHdr->patchedPakCount) + (sizeof(uint8_t) * pHdr->patchedPakCount) + it.FileNamePageOffset;
 
         // write the ptr to the file name into the buffer
-        dataBuf.write<RPakPtr>({ dataseginfo.index, fileNameOffset }, sizeof(RPakPtr) * i);
+        dataBuf.writePtr({ dataseginfo.index, fileNameOffset }, sizeof(RPakPtr) * i);
         // write the patch number for this entry into the buffer
         dataBuf.write<uint8_t>(it.PatchNum, pHdr->pPakPatchNums.Offset + i);
 
         snprintf(pDataBuf + fileNameOffset, it.FileName.length() + 1, "%s", it.FileName.c_str());
 
-        RePak::RegisterDescriptor(dataseginfo.index, sizeof(RPakPtr) * i);
         i++;
     }
 
@@ -71,4 +99,41 @@ void Assets::AddPatchAsset(std::vector<RPakAssetEntryV8>* assetEntries, const ch
     asset.Un2 = 1;
 
     assetEntries->push_back(asset);
-}
\ No newline at end of file
+
+    return true;
+}
+
+// purpose: get the guid of the Ptch described by a map file entry
+// returns: Ptch guid
+uint64_t Assets::GetPatchGuid(const char*, rapidjson::Value&)
+{
+    // there is only ever one Ptch asset, and it always uses the same guid
+    return 0x6fc6fa5ad8f8bc9c;
+}
+
+// purpose: get the release manifests that the Ptch described by a map file entry reads its patch numbers from
+void Assets::GetPatchSourceFiles(const char*, rapidjson::Value& mapEntry, std::vector<std::string>& sourceFiles)
+{
+    if (!mapEntry.HasMember("manifests"))
+        return;
+
+    for (auto& it : mapEntry["manifests"].GetArray())
+        sourceFiles.push_back(g_pBuildContext->assetsDir + it.GetStdString());
+}
+
+// purpose: get the pages of the Ptch described by a map file entry
+// returns: true
+bool Assets::PlanPatchAsset(const char*, rapidjson::Value& mapEntry, AssetPlan_t& plan)
+{
+    std::vector<PtchEntry> patchEntries{};
+    uint32_t dataPageSize = GetPatchEntries(mapEntry, patchEntries);
+    uint32_t patchedPakCount = patchEntries.size();
+
+    plan.pages.push_back({ sizeof(PtchHeader), 0, 8 });
+    plan.pages.push_back({ dataPageSize, 1, 8 });
+
+    // the two header pointers, and the name pointer of every entry
+    plan.descriptorCount = 2 + patchedPakCount;
+
+    return true;
+}
@@ -1,14 +1,51 @@
 #include "pch.h"
 #include "Assets.h"
 
-void Assets::AddUIImageAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry)
+// atlas headers are cached for the whole uimg batch, since most uimg assets in a pak share the same few atlases
+static thread_local std::unordered_map<std::string, DDS_HEADER> s_AtlasHeaderCache;
+
+// sizes of the pages that a uimg adds after its header page
+struct UIImagePageSizes_t
+{
+    uint32_t textureOffsetsSize;
+    uint32_t textureDimensionsSize;
+    uint32_t textureHashesSize;
+    uint32_t textureInfoPageSize; // offsets, dimensions and hashes
+    uint32_t uvPageSize;
+};
+
+// purpose: get the sizes of the pages that a uimg with the given number of textures adds
+// returns: page sizes
+static UIImagePageSizes_t GetUIImagePageSizes(uint32_t nTexturesCount)
+{
+    UIImagePageSizes_t sizes{};
+    sizes.textureOffsetsSize = sizeof(UIImageOffset) * nTexturesCount;
+    sizes.textureDimensionsSize = sizeof(uint16_t) * 2 * nTexturesCount;
+    sizes.textureHashesSize = (sizeof(uint32_t) + sizeof(uint32_t)) * nTexturesCount;
+    sizes.textureInfoPageSize = sizes.textureOffsetsSize + sizes.textureDimensionsSize + sizes.textureHashesSize /*+ (4 * nTexturesCount)*/;
+    sizes.uvPageSize = sizeof(UIImageUV) * nTexturesCount;
+
+    return sizes;
+}
+
+void Assets::BeginUIImageBatch(std::vector<RPakAssetEntryV8>*)
+{
+    s_AtlasHeaderCache.clear();
+}
+
+void Assets::EndUIImageBatch(std::vector<RPakAssetEntryV8>*)
+{
+    s_AtlasHeaderCache.clear();
+}
+
+bool Assets::AddUIImageAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry)
 {
     Debug("Adding uimg asset '%s'\n", assetPath);
 
     std::string sAssetName = assetPath;
 
     // get the info for the ui atlas image
-    std::string sAtlasFilePath = g_sAssetsDir + mapEntry["atlas"].GetStdString() + ".dds";
+    std::string sAtlasFilePath = g_pBuildContext->assetsDir + mapEntry["atlas"].GetStdString() + ".dds";
     std::string sAtlasAssetName = mapEntry["atlas"].GetStdString() + ".rpak";
     uint64_t atlasGuid = RTech::StringToGuid(sAtlasAssetName.c_str());
 
@@ -16,19 +53,33 @@ void Assets::AddUIImageAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
 
     if (atlasAsset == nullptr)
     {
-        Error("Atlas asset was not found when trying to add uimg asset '%s'. Make sure that the txtr is above the uimg in your map file. Exiting...\n", assetPath);
-        exit(EXIT_FAILURE);
+        Error("Atlas asset was not found when trying to add uimg asset '%s'. Make sure that the atlas txtr is included in your map file\n", assetPath);
+        return false;
     }
 
     uint32_t nTexturesCount = mapEntry["textures"].GetArray().Size();
 
     // grab the dimensions of the atlas
-    BinaryIO atlas;
-    atlas.open(sAtlasFilePath, BinaryIOMode::Read);
-    atlas.seek(4, std::ios::beg);
-    DDS_HEADER ddsh = atlas.read<DDS_HEADER>();
+    auto cachedAtlas = s_AtlasHeaderCache.find(sAtlasFilePath);
 
-    atlas.close();
+    if (cachedAtlas == s_AtlasHeaderCache.end())
+    {
+        // the atlas is also read by its own txtr asset, so this usually comes straight from the input file cache
+        std::shared_ptr<const std::vector<uint8_t>> atlas = RePak::ReadInputFile(sAtlasFilePath);
+
+        if (!atlas || atlas->size() < 4 + sizeof(DDS_HEADER))
+        {
+            Error("Failed to read atlas '%s' for uimg asset '%s'\n", sAtlasFilePath.c_str(), assetPath);
+            return false;
+        }
+
+        DDS_HEADER ddsh{};
+        memcpy(&ddsh, atlas->data() + 4, sizeof(DDS_HEADER));
+
+        cachedAtlas = s_AtlasHeaderCache.emplace(sAtlasFilePath, ddsh).first;
+    }
+
+    DDS_HEADER& ddsh = cachedAtlas->second;
 
     UIImageHeader* pHdr = new UIImageHeader();
     pHdr->width = ddsh.width;
@@ -40,12 +91,11 @@ void Assets::AddUIImageAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
     pHdr->atlasGuid = atlasGuid;
 
     // calculate data sizes so we can allocate a page and segment
-    uint32_t textureOffsetsDataSize = sizeof(UIImageOffset) * nTexturesCount;
-    uint32_t textureDimensionsDataSize = sizeof(uint16_t) * 2 * nTexturesCount;
-    uint32_t textureHashesDataSize = (sizeof(uint32_t) + sizeof(uint32_t)) * nTexturesCount;
+    UIImagePageSizes_t pageSizes = GetUIImagePageSizes(nTexturesCount);
 
-    // get total size
-    uint32_t textureInfoPageSize = textureOffsetsDataSize + textureDimensionsDataSize + textureHashesDataSize /*+ (4 * nTexturesCount)*/;
+    uint32_t textureOffsetsDataSize = pageSizes.textureOffsetsSize;
+    uint32_t textureDimensionsDataSize = pageSizes.textureDimensionsSize;
+    uint32_t textureInfoPageSize = pageSizes.textureInfoPageSize;
 
     // allocate the page and segment
     RPakVirtualSegment SubHeaderSegment;
@@ -55,26 +105,18 @@ void Assets::AddUIImageAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
     _vseginfo_t tiseginfo = RePak::CreateNewSegment(textureInfoPageSize, 0x41, 32, TextureInfoSegment);
 
     RPakVirtualSegment RawDataSegment;
-    _vseginfo_t dataseginfo = RePak::CreateNewSegment(nTexturesCount * 0x10, 0x43, 4, RawDataSegment);
-
-    // register our descriptors so they get converted properly
-    RePak::RegisterDescriptor(subhdrinfo.index, offsetof(UIImageHeader, pTextureOffsets));
-    RePak::RegisterDescriptor(subhdrinfo.index, offsetof(UIImageHeader, pTextureDims));
-    RePak::RegisterDescriptor(subhdrinfo.index, offsetof(UIImageHeader, pTextureHashes));
-
-    // textureGUID descriptors
-    RePak::RegisterGuidDescriptor(subhdrinfo.index, offsetof(UIImageHeader, atlasGuid));
+    _vseginfo_t dataseginfo = RePak::CreateNewSegment(pageSizes.uvPageSize, 0x43, 4, RawDataSegment);
 
     // buffer for texture info data
     char* pTextureInfoBuf = new char[textureInfoPageSize]{};
-    rmem tiBuf(pTextureInfoBuf);
+    rmem tiBuf(pTextureInfoBuf, textureInfoPageSize);
 
     // set texture offset page index and offset
     pHdr->pTextureOffsets = { tiseginfo.index, 0 };
 
     ////////////////////
     // IMAGE OFFSETS
-    for (auto& it : mapEntry["textures"].GetArray())
+    for (uint32_t i = 0; i < nTexturesCount; ++i)
     {
         UIImageOffset uiio{};
         tiBuf.write(uiio);
@@ -109,14 +151,8 @@ void Assets::AddUIImageAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
         nextStringTableOffset += it["path"].GetStringLength() + 1;
     }
 
-    // add the file relation from this uimg asset to the atlas txtr
-    size_t fileRelationIdx = RePak::AddFileRelation(assetEntries->size());
-
-    atlasAsset->RelationsStartIndex = fileRelationIdx;
-    atlasAsset->RelationsCount++;
-
-    char* pUVBuf = new char[nTexturesCount * sizeof(UIImageUV)];
-    rmem uvBuf(pUVBuf);
+    char* pUVBuf = new char[pageSizes.uvPageSize]{};
+    rmem uvBuf(pUVBuf, pageSizes.uvPageSize);
 
     //////////////
     // IMAGE UVS
@@ -126,6 +162,9 @@ void Assets::AddUIImageAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
         uvBuf.write(uiiu);
     }
 
+    // register our descriptors so they get converted properly
+    RePak::RegisterHeaderDescriptors(subhdrinfo.index, 0, pHdr);
+
     RPakRawDataBlock shdb{ subhdrinfo.index, subhdrinfo.size, (uint8_t*)pHdr };
     RePak::AddRawDataBlock(shdb);
 
@@ -143,9 +182,53 @@ void Assets::AddUIImageAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
     asset.PageEnd = dataseginfo.index + 1; // number of the highest page that the asset references pageidx + 1
     asset.Un2 = 2;
 
-    asset.UsesStartIndex = fileRelationIdx;
-    asset.UsesCount = 1; // the asset should only use 1 other asset for the atlas
-
     // add the asset entry
     assetEntries->push_back(asset);
+
+    return true;
+}
+
+// purpose: get the guid of the uimg described by a map file entry
+// returns: uimg guid
+uint64_t Assets::GetUIImageGuid(const char* assetPath, rapidjson::Value&)
+{
+    return RTech::StringToGuid((std::string(assetPath) + ".rpak").c_str());
+}
+
+// purpose: get the guids of all assets that a uimg map file entry references
+void Assets::GetUIImageDependencies(const char*, rapidjson::Value& mapEntry, std::vector<uint64_t>& dependencies)
+{
+    if (mapEntry.HasMember("atlas"))
+        dependencies.push_back(RTech::StringToGuid((mapEntry["atlas"].GetStdString() + ".rpak").c_str()));
+}
+
+// purpose: get the files that the uimg described by a map file entry is built from
+void Assets::GetUIImageSourceFiles(const char*, rapidjson::Value& mapEntry, std::vector<std::string>& sourceFiles)
+{
+    if (mapEntry.HasMember("atlas"))
+        sourceFiles.push_back(g_pBuildContext->assetsDir + mapEntry["atlas"].GetStdString() + ".dds");
+}
+
+// purpose: get the pages of the uimg described by a map file entry
+// their sizes only depend on the number of textures, so no files are read
+// returns: false if the entry has no textures
+bool Assets::PlanUIImageAsset(const char* assetPath, rapidjson::Value& mapEntry, AssetPlan_t& plan)
+{
+    if (!mapEntry.HasMember("textures") || !mapEntry["textures"].IsArray())
+    {
+        Warning("uimg asset '%s' doesn't have a 'textures' field\n", assetPath);
+        return false;
+    }
+
+    UIImagePageSizes_t pageSizes = GetUIImagePageSizes(mapEntry["textures"].GetArray().Size());
+
+    plan.pages.push_back({ sizeof(UIImageHeader), 0x40, 8 });
+    plan.pages.push_back({ pageSizes.textureInfoPageSize, 0x41, 32 });
+    plan.pages.push_back({ pageSizes.uvPageSize, 0x43, 4 });
+
+    // texture offsets, dimensions and hashes, and the atlas
+    plan.descriptorCount = 3;
+    plan.guidDescriptorCount = 1;
+
+    return true;
 }
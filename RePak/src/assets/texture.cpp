@@ -1,45 +1,74 @@
 #include "pch.h"
-#include "rmem.h"
 #include "Assets.h"
 
-void Assets::AddTextureAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry)
+// sizes of the pages that a txtr adds after its header page
+struct TexturePageSizes_t
+{
+    uint32_t debugNamePageSize; // 0 if the name isn't saved
+    uint32_t dataPageSize;
+};
+
+// purpose: get the sizes of the pages that a txtr adds from its map file entry and dds header
+// returns: page sizes
+static TexturePageSizes_t GetTexturePageSizes(const char* assetPath, rapidjson::Value& mapEntry, const DDS_HEADER& ddsh)
+{
+    TexturePageSizes_t sizes{};
+
+    if (mapEntry.HasMember("saveDebugName") && mapEntry["saveDebugName"].GetBool())
+        sizes.debugNamePageSize = strlen(assetPath) + 1;
+
+    sizes.dataPageSize = ddsh.pitchOrLinearSize;
+
+    return sizes;
+}
+
+bool Assets::AddTextureAsset(std::vector<RPakAssetEntryV8>* assetEntries, const char* assetPath, rapidjson::Value& mapEntry)
 {
     Debug("Adding txtr asset '%s'\n", assetPath);
 
 
-    std::string filePath = g_sAssetsDir + assetPath + ".dds";
+    std::string filePath = g_pBuildContext->assetsDir + assetPath + ".dds";
+
+    // read through the input file cache, since atlas textures are also read by the uimg assets that use them
+    std::shared_ptr<const std::vector<uint8_t>> inputData = RePak::ReadInputFile(filePath);
 
-    if (!FILE_EXISTS(filePath))
+    if (!inputData)
     {
         // this is a fatal error because if this asset is a dependency for another asset and we just ignore it
         // we will crash later when trying to reference it
-        Error("Failed to find texture source file %s. Exiting...\n", filePath.c_str());
-        exit(EXIT_FAILURE);
+        Error("Failed to find texture source file %s\n", filePath.c_str());
+        return false;
     }
 
-    TextureHeader* hdr = new TextureHeader();
+    if (inputData->size() < sizeof(int) + sizeof(DDS_HEADER))
+    {
+        Warning("Attempted to add txtr asset '%s' that was not a valid DDS file (file too small). Skipping asset...\n", assetPath);
+        return true;
+    }
 
-    BinaryIO input;
-    input.open(filePath, BinaryIOMode::Read);
+    TextureHeader* hdr = new TextureHeader();
 
-    uint64_t nInputFileSize = Utils::GetFileSize(filePath);
+    BinaryReader input(inputData->data(), inputData->size());
+    size_t nPixelDataOffset = 0;
+    TexturePageSizes_t pageSizes{};
 
     std::string sAssetName = assetPath; // todo: this needs to be changed to the actual name
 
     // parse input image file
     {
-        int magic;
-        input.read(magic);
+        int magic = input.read<int>();
 
         if (magic != 0x20534444) // b'DDS '
         {
             Warning("Attempted to add txtr asset '%s' that was not a valid DDS file (invalid magic). Skipping asset...\n", assetPath);
-            return;
+            return true;
         }
 
         DDS_HEADER ddsh = input.read<DDS_HEADER>();
 
-        hdr->dataLength = ddsh.pitchOrLinearSize;
+        pageSizes = GetTexturePageSizes(assetPath, mapEntry, ddsh);
+
+        hdr->dataLength = pageSizes.dataPageSize;
         hdr->width = ddsh.width;
         hdr->height = ddsh.height;
 
@@ -64,25 +93,33 @@ void Assets::AddTextureAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
             dxgiFormat = DXGI_FORMAT_BC7_UNORM;
             break;
         default:
-            Error("Attempted to add txtr asset '%s' that was not using a supported DDS type. Exiting...\n", assetPath);
-            exit(EXIT_FAILURE);
-            return;
+            Error("Attempted to add txtr asset '%s' that was not using a supported DDS type\n", assetPath);
+            delete hdr;
+            return false;
         }
 
         hdr->format = (uint16_t)TxtrFormatMap[dxgiFormat];
 
-        // go to the end of the main header
-        input.seek(ddsh.size + 4);
+        // pixel data starts after the main header
+        nPixelDataOffset = ddsh.size + 4;
 
+        // skip the dx10 header
         if (dxgiFormat == DXGI_FORMAT_BC7_UNORM || dxgiFormat == DXGI_FORMAT_BC7_UNORM_SRGB)
-            input.seek(20, std::ios::cur);
+            nPixelDataOffset += 20;
+
+        if (nPixelDataOffset + hdr->dataLength > inputData->size())
+        {
+            Error("Texture source file %s is smaller than its header says\n", filePath.c_str());
+            delete hdr;
+            return false;
+        }
     }
 
     hdr->assetGuid = RTech::StringToGuid((sAssetName + ".rpak").c_str());
 
     hdr->permanentMipLevels = 1;
 
-    bool bSaveDebugName = mapEntry.HasMember("saveDebugName") && mapEntry["saveDebugName"].GetBool();
+    bool bSaveDebugName = pageSizes.debugNamePageSize != 0;
 
     // give us a segment to use for the subheader
     RPakVirtualSegment SubHeaderSegment;
@@ -95,7 +132,7 @@ void Assets::AddTextureAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
     if (bSaveDebugName)
     {
         sprintf_s(namebuf, sAssetName.length() + 1, "%s", sAssetName.c_str());
-        nameseginfo = RePak::CreateNewSegment(sAssetName.size() + 1, 129, 1, DebugNameSegment);
+        nameseginfo = RePak::CreateNewSegment(pageSizes.debugNamePageSize, 129, 1, DebugNameSegment);
     }
     else
     {
@@ -108,7 +145,7 @@ void Assets::AddTextureAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
 
     char* databuf = new char[hdr->dataLength];
 
-    input.getReader()->read(databuf, hdr->dataLength);
+    memcpy(databuf, inputData->data() + nPixelDataOffset, hdr->dataLength);
 
     RPakRawDataBlock shdb{ subhdrinfo.index, subhdrinfo.size, (uint8_t*)hdr };
     RePak::AddRawDataBlock(shdb);
@@ -118,10 +155,11 @@ void Assets::AddTextureAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
         RPakRawDataBlock ndb{ nameseginfo.index, nameseginfo.size, (uint8_t*)namebuf };
         RePak::AddRawDataBlock(ndb);
         hdr->pDebugName = { nameseginfo.index, 0 };
-
-        RePak::RegisterDescriptor(nameseginfo.index, offsetof(TextureHeader, pDebugName));
+        RePak::RegisterDescriptor(subhdrinfo.index, offsetof(TextureHeader, pDebugName));
     }
 
+    RePak::RegisterHeaderDescriptors(subhdrinfo.index, 0, hdr);
+
     RPakRawDataBlock rdb{ dataseginfo.index, dataseginfo.size, (uint8_t*)databuf };
     RePak::AddRawDataBlock(rdb);
 
@@ -138,5 +176,56 @@ void Assets::AddTextureAsset(std::vector<RPakAssetEntryV8>* assetEntries, const
 
     assetEntries->push_back(asset);
 
-    input.close();
-}
\ No newline at end of file
+    return true;
+}
+
+// purpose: get the guid of the txtr described by a map file entry
+// returns: txtr guid
+uint64_t Assets::GetTextureGuid(const char* assetPath, rapidjson::Value&)
+{
+    return RTech::StringToGuid((std::string(assetPath) + ".rpak").c_str());
+}
+
+// purpose: get the files that the txtr described by a map file entry is built from
+void Assets::GetTextureSourceFiles(const char* assetPath, rapidjson::Value&, std::vector<std::string>& sourceFiles)
+{
+    sourceFiles.push_back(g_pBuildContext->assetsDir + assetPath + ".dds");
+}
+
+// purpose: get the pages of the txtr described by a map file entry from the header of its dds file
+// returns: false if the dds file is missing or invalid
+bool Assets::PlanTextureAsset(const char* assetPath, rapidjson::Value& mapEntry, AssetPlan_t& plan)
+{
+    std::string filePath = g_pBuildContext->assetsDir + assetPath + ".dds";
+
+    char header[sizeof(int) + sizeof(DDS_HEADER)];
+
+    if (!RePak::ReadInputFileHeader(filePath, header, sizeof(header)))
+    {
+        Warning("failed to read the header of texture source file %s\n", filePath.c_str());
+        return false;
+    }
+
+    DDS_HEADER ddsh{};
+    memcpy(&ddsh, header + sizeof(int), sizeof(DDS_HEADER));
+
+    if (*(int*)header != 0x20534444) // b'DDS '
+    {
+        Warning("txtr asset '%s' is not a valid DDS file (invalid magic)\n", assetPath);
+        return false;
+    }
+
+    TexturePageSizes_t pageSizes = GetTexturePageSizes(assetPath, mapEntry, ddsh);
+
+    plan.pages.push_back({ sizeof(TextureHeader), 0, 8 });
+
+    if (pageSizes.debugNamePageSize != 0)
+    {
+        plan.pages.push_back({ pageSizes.debugNamePageSize, 129, 1 });
+        plan.descriptorCount++;
+    }
+
+    plan.pages.push_back({ pageSizes.dataPageSize, 3, 16 });
+
+    return true;
+}
@@ -0,0 +1,289 @@
+#include "pch.h"
+#include "Assets.h"
+#include "AssetGraph.h"
+#include "BuildCache.h"
+#include "SharedBuildState.h"
+#include <queue>
+
+// purpose: add a map file entry to the graph
+// returns: node index, or -1 if an asset with the same guid has already been added
+uint32_t AssetGraph::AddNode(const AssetTypeHandler_t* handler, rapidjson::Value* mapEntry)
+{
+    const char* assetPath = (*mapEntry)["path"].GetString();
+
+    AssetGraphNode_t node{};
+    node.handler = handler;
+    node.mapEntry = mapEntry;
+    node.guid = RePak::GetAssetGuid(handler, assetPath, *mapEntry);
+
+    if (guidToNode.find(node.guid) != guidToNode.end())
+    {
+        Warning("Asset '%s' has the same guid as an asset that was already defined in the map file. Skipping asset...\n", assetPath);
+        return -1;
+    }
+
+    if (handler->GetDependencies)
+        handler->GetDependencies(assetPath, *mapEntry, node.dependencies);
+
+    uint32_t nodeIdx = nodes.size();
+
+    guidToNode.emplace(node.guid, nodeIdx);
+    nodes.push_back(std::move(node));
+
+    return nodeIdx;
+}
+
+// purpose: add every entry of a map file's 'files' array to the graph
+// entries with a missing or unknown type are skipped with a warning
+// the handler of every asset type that was added is appended to usedAssetTypes once
+void AssetGraph::AddMapFileEntries(rapidjson::Value& files, std::vector<const AssetTypeHandler_t*>& usedAssetTypes)
+{
+    for (auto& file : files.GetArray())
+    {
+        rapidjson::Value::MemberIterator typeIt = file.FindMember("$type");
+        rapidjson::Value::MemberIterator pathIt = file.FindMember("path");
+
+        if (typeIt == file.MemberEnd() || pathIt == file.MemberEnd() || !pathIt->value.IsString())
+        {
+            Warning("Map file entry is missing a '$type' or 'path' field. Skipping asset...\n");
+            continue;
+        }
+
+        const AssetTypeHandler_t* handler = Assets::GetAssetTypeHandler(RePak::GetAssetTypeFourCC(typeIt->value));
+
+        if (!handler)
+        {
+            Warning("Unknown asset type for map file entry '%s'. Skipping asset...\n", pathIt->value.GetString());
+            continue;
+        }
+
+        if (AddNode(handler, &file) == (uint32_t)-1)
+            continue;
+
+        if (std::find(usedAssetTypes.begin(), usedAssetTypes.end(), handler) == usedAssetTypes.end())
+            usedAssetTypes.push_back(handler);
+    }
+}
+
+AssetGraphNode_t* AssetGraph::GetNodeByGuid(uint64_t guid)
+{
+    auto it = guidToNode.find(guid);
+
+    if (it == guidToNode.end())
+        return nullptr;
+
+    return &nodes[it->second];
+}
+
+// purpose: link all nodes to the nodes they reference and sort them so that every node comes after its dependencies
+// nodes without any ordering constraint between them keep the order they were added in
+// returns: false if there is a dependency cycle
+bool AssetGraph::Resolve()
+{
+    for (uint32_t i = 0; i < nodes.size(); ++i)
+    {
+        AssetGraphNode_t& node = nodes[i];
+
+        for (uint64_t guid : node.dependencies)
+        {
+            auto it = guidToNode.find(guid);
+
+            // references to assets in other paks don't affect the build order
+            if (it == guidToNode.end() || it->second == i)
+                continue;
+
+            if (std::find(node.usedNodes.begin(), node.usedNodes.end(), it->second) != node.usedNodes.end())
+                continue;
+
+            node.usedNodes.push_back(it->second);
+            nodes[it->second].userNodes.push_back(i);
+        }
+    }
+
+    std::vector<uint32_t> pendingDeps(nodes.size());
+    std::priority_queue<uint32_t, std::vector<uint32_t>, std::greater<uint32_t>> readyNodes;
+
+    for (uint32_t i = 0; i < nodes.size(); ++i)
+    {
+        pendingDeps[i] = nodes[i].usedNodes.size();
+
+        if (pendingDeps[i] == 0)
+            readyNodes.push(i);
+    }
+
+    buildOrder.clear();
+    buildOrder.reserve(nodes.size());
+
+    while (!readyNodes.empty())
+    {
+        uint32_t nodeIdx = readyNodes.top();
+        readyNodes.pop();
+
+        AssetGraphNode_t& node = nodes[nodeIdx];
+
+        for (uint32_t usedIdx : node.usedNodes)
+            node.level = max(node.level, nodes[usedIdx].level + 1);
+
+        buildOrder.push_back(nodeIdx);
+
+        for (uint32_t userIdx : node.userNodes)
+        {
+            if (--pendingDeps[userIdx] == 0)
+                readyNodes.push(userIdx);
+        }
+    }
+
+    if (buildOrder.size() != nodes.size())
+    {
+        for (uint32_t i = 0; i < nodes.size(); ++i)
+        {
+            if (pendingDeps[i] != 0)
+                Error("Asset '%s' is part of a dependency cycle\n", (*nodes[i].mapEntry)["path"].GetString());
+        }
+        return false;
+    }
+
+    return true;
+}
+
+// purpose: group nodes by their level in the graph
+// returns: node indices for each level, starting with the nodes that don't reference anything in the pak
+std::vector<std::vector<uint32_t>> AssetGraph::GetLevels()
+{
+    std::vector<std::vector<uint32_t>> levels{};
+
+    for (uint32_t nodeIdx : buildOrder)
+    {
+        uint32_t level = nodes[nodeIdx].level;
+
+        if (level >= levels.size())
+            levels.resize(level + 1);
+
+        levels[level].push_back(nodeIdx);
+    }
+
+    return levels;
+}
+
+// purpose: find the groups of nodes that are connected through references, in either direction
+// assets in one group have to be built into the same pak, since handlers look up the assets they reference
+// returns: index of the lowest node in each node's group
+std::vector<uint32_t> AssetGraph::GetGroups()
+{
+    std::vector<uint32_t> groups(nodes.size());
+
+    for (uint32_t i = 0; i < nodes.size(); ++i)
+        groups[i] = i;
+
+    auto findRoot = [&groups](uint32_t idx)
+    {
+        while (groups[idx] != idx)
+        {
+            groups[idx] = groups[groups[idx]];
+            idx = groups[idx];
+        }
+
+        return idx;
+    };
+
+    for (uint32_t i = 0; i < nodes.size(); ++i)
+    {
+        for (uint32_t usedIdx : nodes[i].usedNodes)
+        {
+            uint32_t a = findRoot(i);
+            uint32_t b = findRoot(usedIdx);
+
+            // always keep the lowest index as the root so that the grouping doesn't depend on the order of references
+            if (a != b)
+                groups[max(a, b)] = min(a, b);
+        }
+    }
+
+    for (uint32_t i = 0; i < nodes.size(); ++i)
+        groups[i] = findRoot(i);
+
+    return groups;
+}
+
+// purpose: get the order that the engine is expected to use the assets in
+// every asset comes straight after the assets it references that haven't been placed yet, so the assets that one asset needs
+// are kept together in front of it. assets that nothing references are taken in map file order
+// returns: node indices in load order
+std::vector<uint32_t> AssetGraph::GetLoadOrder()
+{
+    std::vector<uint32_t> loadOrder{};
+    std::vector<bool> placed(nodes.size(), false);
+
+    // node index and the index of the next used node to visit
+    std::vector<std::pair<uint32_t, size_t>> stack{};
+
+    for (uint32_t i = 0; i < nodes.size(); ++i)
+    {
+        if (placed[i] || !nodes[i].userNodes.empty())
+            continue;
+
+        stack.push_back({ i, 0 });
+
+        while (!stack.empty())
+        {
+            auto& top = stack.back();
+            const AssetGraphNode_t& node = nodes[top.first];
+
+            if (top.second < node.usedNodes.size())
+            {
+                uint32_t usedIdx = node.usedNodes[top.second++];
+
+                if (!placed[usedIdx])
+                    stack.push_back({ usedIdx, 0 });
+
+                continue;
+            }
+
+            if (!placed[top.first])
+            {
+                placed[top.first] = true;
+                loadOrder.push_back(top.first);
+            }
+
+            stack.pop_back();
+        }
+    }
+
+    return loadOrder;
+}
+
+// purpose: add the file relations for every built asset
+// an asset's relations list the indices of all assets in the pak that reference it
+void AssetGraph::GenerateFileRelations(std::vector<RPakAssetEntryV8>& assetEntries)
+{
+    for (auto& asset : assetEntries)
+    {
+        asset.RelationsStartIndex = 0;
+        asset.RelationsCount = 0;
+
+        AssetGraphNode_t* node = GetNodeByGuid(asset.GUID);
+
+        if (!node)
+            continue;
+
+        std::vector<uint32_t> users{};
+
+        for (uint32_t userIdx : node->userNodes)
+        {
+            if (nodes[userIdx].assetIdx != (uint32_t)-1)
+                users.push_back(nodes[userIdx].assetIdx);
+        }
+
+        std::sort(users.begin(), users.end());
+
+        for (uint32_t i = 0; i < users.size(); ++i)
+        {
+            size_t relationIdx = RePak::AddFileRelation(users[i]);
+
+            if (i == 0)
+                asset.RelationsStartIndex = relationIdx;
+        }
+
+        asset.RelationsCount = users.size();
+    }
+}
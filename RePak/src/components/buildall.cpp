@@ -0,0 +1,277 @@
+#include "pch.h"
+#include "Assets.h"
+#include "BuildCache.h"
+#include "SharedBuildState.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// purpose: read a whole file into memory
+// returns: file contents, or nullptr if the file couldn't be opened
+static std::shared_ptr<const std::vector<uint8_t>> ReadWholeFile(const std::string& path)
+{
+    std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+
+    if (!ifs.is_open())
+        return nullptr;
+
+    auto data = std::make_shared<std::vector<uint8_t>>(static_cast<size_t>(ifs.tellg()));
+
+    ifs.seekg(0);
+    ifs.read(reinterpret_cast<char*>(data->data()), data->size());
+
+    return data;
+}
+
+// purpose: get the contents of a file, reading it only if it isn't already cached
+// returns: file contents, or nullptr if the file couldn't be opened
+std::shared_ptr<const std::vector<uint8_t>> InputFileCache::Get(const std::string& path)
+{
+    // the same file can be reached through differently written paths from different map files
+    std::string key = Utils::NormalisePath(path);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto it = files.find(key);
+
+        if (it != files.end())
+            return it->second;
+    }
+
+    // read outside of the lock so that other builds aren't held up by this one's disk reads
+    std::shared_ptr<const std::vector<uint8_t>> data = ReadWholeFile(path);
+
+    if (!data)
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto inserted = files.emplace(key, data);
+
+    // another build read the same file in the meantime
+    if (!inserted.second)
+        return inserted.first->second;
+
+    insertOrder.push_back(key);
+    totalSize += data->size();
+
+    // builds that still hold a dropped file keep it alive through their own reference
+    while (totalSize > maxSize && nextEvictIdx < insertOrder.size() - 1)
+    {
+        auto it = files.find(insertOrder[nextEvictIdx++]);
+
+        totalSize -= it->second->size();
+        files.erase(it);
+    }
+
+    return data;
+}
+
+// purpose: get the build cache for a directory, creating it on first use
+// returns: build cache shared by every build using the same directory
+BuildCache* SharedBuildState_t::GetBuildCache(const std::string& dir, uint64_t maxSizeBytes, bool bExplain)
+{
+    std::string key = Utils::NormalisePath(dir);
+
+    std::lock_guard<std::mutex> lock(buildCacheMutex);
+
+    std::unique_ptr<BuildCache>& cache = buildCaches[key];
+
+    if (!cache)
+        cache = std::make_unique<BuildCache>(dir, maxSizeBytes, bExplain);
+
+    return cache.get();
+}
+
+// purpose: read a source file for an asset
+// files given to the build in memory are used before anything on disk,
+// builds that share their caches with other builds read the file through the shared input file cache
+// returns: file contents, or nullptr if the file couldn't be opened
+std::shared_ptr<const std::vector<uint8_t>> RePak::ReadInputFile(const std::string& path)
+{
+    if (g_pBuildContext && !g_pBuildContext->memoryFiles.empty())
+    {
+        auto it = g_pBuildContext->memoryFiles.find(Utils::NormalisePath(path));
+
+        if (it != g_pBuildContext->memoryFiles.end())
+            return it->second;
+    }
+
+    if (g_pBuildContext && g_pBuildContext->pShared)
+        return g_pBuildContext->pShared->inputFiles.Get(path);
+
+    return ReadWholeFile(path);
+}
+
+// purpose: read the start of a source file for an asset, without reading the rest of it or adding it to the input file cache
+// returns: false if the file couldn't be opened or is smaller than the header
+bool RePak::ReadInputFileHeader(const std::string& path, void* header, size_t headerSize, uint64_t* pFileSize)
+{
+    if (g_pBuildContext && !g_pBuildContext->memoryFiles.empty())
+    {
+        auto it = g_pBuildContext->memoryFiles.find(Utils::NormalisePath(path));
+
+        if (it != g_pBuildContext->memoryFiles.end())
+        {
+            if (it->second->size() < headerSize)
+                return false;
+
+            memcpy(header, it->second->data(), headerSize);
+
+            if (pFileSize)
+                *pFileSize = it->second->size();
+
+            return true;
+        }
+    }
+
+    std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+
+    if (!ifs.is_open())
+        return false;
+
+    uint64_t fileSize = ifs.tellg();
+
+    if (fileSize < headerSize)
+        return false;
+
+    ifs.seekg(0);
+
+    if (!ifs.read(reinterpret_cast<char*>(header), headerSize))
+        return false;
+
+    if (pFileSize)
+        *pFileSize = fileSize;
+
+    return true;
+}
+
+// purpose: get the guid of the asset described by a map file entry
+// handlers can work the guid out from any field of the entry, not just its path, so guids aren't shared between builds
+// returns: asset guid
+uint64_t RePak::GetAssetGuid(const AssetTypeHandler_t* handler, const char* assetPath, rapidjson::Value& mapEntry)
+{
+    return handler->GetGuid ? handler->GetGuid(assetPath, mapEntry) : RTech::StringToGuid(assetPath);
+}
+
+struct MapBuildStatus_t
+{
+    MapBuildResult_t result;
+    bool bSuccess = false;
+    long long nBuildTimeMs = 0;
+};
+
+// purpose: group map files by the directory that they are written to
+// every asset with starpak data goes into repak.starpak in the output directory (with a suffix for split rpaks and patches),
+// so maps that share an output directory would write the same starpak at the same time
+// returns: groups of map file indices, the maps of a group have to be built one after another.
+// maps that can't be loaded aren't in any group
+static std::vector<std::vector<size_t>> GroupMapsByOutputDir(const std::vector<const char*>& mapFiles)
+{
+    std::vector<std::vector<size_t>> groups{};
+    std::unordered_map<std::string, size_t> groupIdxByDir{};
+
+    for (size_t i = 0; i < mapFiles.size(); ++i)
+    {
+        RPakBuildContext_t ctx{ };
+        BuildContextScope ctxScope(ctx);
+
+        std::filesystem::path mapPath(mapFiles[i]);
+        std::vector<char> mapBuf{ };
+        rapidjson::Document doc{ };
+
+        if (!RePak::LoadMapFile(mapPath, mapBuf, doc))
+            continue;
+
+        std::string sOutputDir = RePak::GetOutputDir(doc, mapPath);
+        auto inserted = groupIdxByDir.emplace(Utils::NormalisePath(sOutputDir), groups.size());
+
+        if (inserted.second)
+        {
+            groups.push_back({ i });
+            continue;
+        }
+
+        std::vector<size_t>& group = groups[inserted.first->second];
+
+        Log("%s writes to the same output directory as %s (%s), building them one after another\n", mapFiles[i], mapFiles[group[0]], sOutputDir.c_str());
+        group.push_back(i);
+    }
+
+    return groups;
+}
+
+// purpose: build several map files at once on a pool of worker threads
+// every build has its own build context, but they all share one input file cache and set of build caches.
+// maps that share an output directory are built on the same thread in the order they are given (see GroupMapsByOutputDir)
+// returns: exit code
+int RePak::BuildAll(const std::vector<const char*>& mapFiles, uint32_t nThreads, uint64_t maxInputCacheSize, bool bExplainCache)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    SharedBuildState_t shared(maxInputCacheSize);
+
+    std::vector<MapBuildStatus_t> statuses(mapFiles.size());
+    std::vector<std::vector<size_t>> groups = GroupMapsByOutputDir(mapFiles);
+    std::atomic<size_t> nextGroupIdx = 0;
+
+    auto worker = [&]()
+    {
+        for (size_t groupIdx = nextGroupIdx++; groupIdx < groups.size(); groupIdx = nextGroupIdx++)
+        {
+            for (size_t i : groups[groupIdx])
+            {
+                auto mapStart = std::chrono::steady_clock::now();
+
+                RPakBuildContext_t ctx{ };
+                ctx.pShared = &shared;
+
+                BuildContextScope ctxScope(ctx);
+
+                statuses[i].bSuccess = RePak::BuildMapFile(mapFiles[i], bExplainCache, statuses[i].result);
+                statuses[i].nBuildTimeMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - mapStart).count();
+            }
+        }
+    };
+
+    nThreads = min(nThreads, (uint32_t)groups.size());
+
+    std::vector<std::thread> threads{};
+
+    for (uint32_t i = 0; i < nThreads; ++i)
+        threads.emplace_back(worker);
+
+    for (auto& it : threads)
+        it.join();
+
+    for (auto& it : shared.buildCaches)
+    {
+        it.second->Trim();
+        it.second->PrintStats();
+    }
+
+    size_t nFailedCount = 0;
+
+    Log("\n");
+
+    for (size_t i = 0; i < mapFiles.size(); ++i)
+    {
+        const MapBuildStatus_t& status = statuses[i];
+
+        if (!status.bSuccess)
+        {
+            Log("FAILED %s (%lld ms)\n", mapFiles[i], status.nBuildTimeMs);
+            nFailedCount++;
+            continue;
+        }
+
+        Log("ok     %s.rpak: %zu assets, %" PRIu64 " bytes rpak, %" PRIu64 " bytes starpak (%lld ms)\n", status.result.rpakName.c_str(), status.result.assetCount,
+            status.result.rpakSize, status.result.starpakSize, status.nBuildTimeMs);
+    }
+
+    long long nTotalTimeMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    Log("\nbuilt %zu of %zu rpaks in %lld ms on %u threads\n", mapFiles.size() - nFailedCount, mapFiles.size(), nTotalTimeMs, nThreads);
+
+    return nFailedCount == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,577 @@
+#include "pch.h"
+#include "Assets.h"
+#include "BuildCache.h"
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
+
+#define BUILD_CACHE_MAGIC 'CKPR'
+#define BUILD_CACHE_VERSION 1
+
+// version of the data that the asset handlers produce, which is separate from the version of the cache file format.
+// bump it whenever a change to a handler, or to anything a handler calls, changes the records it produces
+#define BUILD_CACHE_OUTPUT_VERSION 2
+
+// purpose: hash what decides whether a cached record can be used by this RePak
+// the executable is hashed along with the output version, so records from other builds of RePak are never used
+// even if the output version wasn't bumped
+// returns: version hash, which is only worked out once per process
+static uint64_t GetOutputVersionHash()
+{
+    static const uint64_t versionHash = []()
+    {
+        const uint32_t outputVersion = BUILD_CACHE_OUTPUT_VERSION;
+        return Utils::HashFile(Platform::GetExecutablePath(), Utils::HashData(&outputVersion, sizeof(outputVersion)));
+    }();
+
+    return versionHash;
+}
+
+// purpose: get the current size of the global build state
+// returns: mark to pass to CaptureAssetRecord once the asset has been added
+BuildStateMark_t RePak::MarkBuildState(std::vector<RPakAssetEntryV8>& assetEntries)
+{
+    return { assetEntries.size(), g_pBuildContext->pages.size(), g_pBuildContext->descriptors.size(), g_pBuildContext->guidDescriptors.size(), g_pBuildContext->rawDataBlocks.size(), g_pBuildContext->starpakEntries.size() };
+}
+
+// purpose: copy everything added to the build state since the mark into a relocatable asset record
+// returns: false if the handler didn't add exactly one asset, or if the asset can't be relocated
+//          because it points into pages that it doesn't own
+bool RePak::CaptureAssetRecord(const BuildStateMark_t& mark, std::vector<RPakAssetEntryV8>& assetEntries, AssetRecord_t& record)
+{
+    return RePak::CaptureAssetRecord(mark, RePak::MarkBuildState(assetEntries), assetEntries, record);
+}
+
+// purpose: copy everything added to the build state between two marks into a relocatable asset record
+// lets an asset be captured after other assets have been added behind it
+// returns: false if exactly one asset wasn't added between the marks, or if the asset can't be relocated
+bool RePak::CaptureAssetRecord(const BuildStateMark_t& mark, const BuildStateMark_t& endMark, std::vector<RPakAssetEntryV8>& assetEntries, AssetRecord_t& record)
+{
+    if (endMark.assetCount != mark.assetCount + 1)
+        return false;
+
+    const uint32_t firstPage = mark.pageCount;
+    const uint32_t pageCount = endMark.pageCount - firstPage;
+
+    record = {};
+    record.pages.resize(pageCount);
+
+    for (uint32_t i = 0; i < pageCount; ++i)
+    {
+        const RPakPageInfo& page = g_pBuildContext->pages[firstPage + i];
+        const RPakVirtualSegment& seg = g_pBuildContext->segments[page.VSegIdx];
+
+        AssetRecordPage_t& recPage = record.pages[i];
+        recPage.segFlags = seg.DataFlag;
+        recPage.segAlignment = seg.SomeType;
+        recPage.alignment = page.SomeType;
+        recPage.data.resize(page.DataSize);
+    }
+
+    for (size_t i = mark.rawDataBlockCount; i < endMark.rawDataBlockCount; ++i)
+    {
+        const RPakRawDataBlock& block = g_pBuildContext->rawDataBlocks[i];
+
+        if (block.pageIdx < firstPage || block.pageIdx >= firstPage + pageCount)
+            return false;
+
+        std::vector<uint8_t>& data = record.pages[block.pageIdx - firstPage].data;
+        memcpy(data.data(), block.dataPtr, min(block.dataSize, data.size()));
+    }
+
+    for (size_t i = mark.descriptorCount; i < endMark.descriptorCount; ++i)
+    {
+        RPakDescriptor desc = g_pBuildContext->descriptors[i];
+
+        if (desc.PageIdx < firstPage || desc.PageIdx >= firstPage + pageCount)
+            return false;
+
+        desc.PageIdx -= firstPage;
+
+        std::vector<uint8_t>& data = record.pages[desc.PageIdx].data;
+
+        if (desc.PageOffset + sizeof(RPakPtr) > data.size())
+            return false;
+
+        // make the pointer relative to the asset's first page
+        RPakPtr* ptr = reinterpret_cast<RPakPtr*>(data.data() + desc.PageOffset);
+
+        if (ptr->Index < firstPage || ptr->Index >= firstPage + pageCount)
+            return false;
+
+        ptr->Index -= firstPage;
+
+        record.descriptors.push_back(desc);
+    }
+
+    for (size_t i = mark.guidDescriptorCount; i < endMark.guidDescriptorCount; ++i)
+    {
+        RPakGuidDescriptor desc = g_pBuildContext->guidDescriptors[i];
+
+        if (desc.PageIdx < firstPage || desc.PageIdx >= firstPage + pageCount)
+            return false;
+
+        desc.PageIdx -= firstPage;
+        record.guidDescriptors.push_back(desc);
+    }
+
+    record.asset = assetEntries[mark.assetCount];
+    record.asset.SubHeaderDataBlockIndex -= firstPage;
+    record.asset.PageEnd -= firstPage;
+
+    if (record.asset.RawDataBlockIndex != (uint32_t)-1)
+        record.asset.RawDataBlockIndex -= firstPage;
+
+    if (mark.starpakEntryCount < endMark.starpakEntryCount)
+    {
+        uint64_t firstStarpakOffset = g_pBuildContext->starpakEntries[mark.starpakEntryCount].offset;
+
+        for (size_t i = mark.starpakEntryCount; i < endMark.starpakEntryCount; ++i)
+        {
+            const SRPkDataEntry& entry = g_pBuildContext->starpakEntries[i];
+            record.starpakBlocks.emplace_back(entry.dataPtr, entry.dataPtr + entry.dataSize);
+        }
+
+        // the low bits of the offset are the index of the asset's starpak, which is stored as a path instead
+        // since the starpak can have another index in the pak that the record is spliced into
+        if (record.asset.StarpakOffset != (uint64_t)-1)
+        {
+            const size_t starpakIdx = record.asset.StarpakOffset & 0xFFF;
+
+            if (starpakIdx >= g_pBuildContext->starpakPaths.size())
+                return false;
+
+            record.starpakPaths.push_back(g_pBuildContext->starpakPaths[starpakIdx]);
+            record.asset.StarpakOffset = (record.asset.StarpakOffset & ~0xFFFull) - firstStarpakOffset;
+        }
+    }
+
+    return true;
+}
+
+// purpose: add a relocatable asset record to the current build state
+// returns: index of the added asset entry
+uint32_t RePak::SpliceAssetRecord(const AssetRecord_t& record, std::vector<RPakAssetEntryV8>& assetEntries)
+{
+    const uint32_t firstPage = g_pBuildContext->pages.size();
+
+    std::vector<uint8_t*> pageBufs{};
+    pageBufs.reserve(record.pages.size());
+
+    for (auto& it : record.pages)
+    {
+        RPakVirtualSegment seg;
+        _vseginfo_t info = RePak::CreateNewSegment(it.data.size(), it.segFlags, it.alignment, seg, it.segAlignment);
+
+        uint8_t* buf = new uint8_t[it.data.size()];
+        memcpy(buf, it.data.data(), it.data.size());
+
+        RePak::AddRawDataBlock({ info.index, it.data.size(), buf });
+        pageBufs.push_back(buf);
+    }
+
+    for (auto& it : record.descriptors)
+    {
+        RPakPtr* ptr = reinterpret_cast<RPakPtr*>(pageBufs[it.PageIdx] + it.PageOffset);
+        ptr->Index += firstPage;
+
+        RePak::RegisterDescriptor(firstPage + it.PageIdx, it.PageOffset);
+    }
+
+    for (auto& it : record.guidDescriptors)
+        RePak::RegisterGuidDescriptor(firstPage + it.PageIdx, it.PageOffset);
+
+    RPakAssetEntryV8 asset = record.asset;
+    asset.SubHeaderDataBlockIndex += firstPage;
+    asset.PageEnd += firstPage;
+
+    if (asset.RawDataBlockIndex != (uint32_t)-1)
+        asset.RawDataBlockIndex += firstPage;
+
+    if (!record.starpakBlocks.empty())
+    {
+        uint64_t starpakIdx = 0;
+
+        for (auto& it : record.starpakPaths)
+            RePak::AddStarpakReference(it);
+
+        if (!record.starpakPaths.empty())
+        {
+            const std::vector<std::string>& paths = g_pBuildContext->starpakPaths;
+            starpakIdx = std::find(paths.begin(), paths.end(), record.starpakPaths[0]) - paths.begin();
+        }
+
+        uint64_t firstStarpakOffset = -1;
+
+        // the blocks were padded when they were first added
+        for (auto& it : record.starpakBlocks)
+        {
+            uint8_t* buf = new uint8_t[it.size()];
+            memcpy(buf, it.data(), it.size());
+
+            uint64_t offset = RePak::AddPaddedStarpakDataEntry({ (uint64_t)-1, it.size(), buf });
+
+            if (firstStarpakOffset == (uint64_t)-1)
+                firstStarpakOffset = offset;
+        }
+
+        if (asset.StarpakOffset != (uint64_t)-1)
+            asset.StarpakOffset += firstStarpakOffset + starpakIdx;
+    }
+
+    assetEntries.push_back(asset);
+    return assetEntries.size() - 1;
+}
+
+// purpose: hash everything an asset record would add to a pak
+// records are relocatable, so the hash of an unchanged asset doesn't depend on where it ends up in the pak
+// returns: content hash of the record
+uint64_t RePak::HashAssetRecord(const AssetRecord_t& record)
+{
+    uint64_t hash = Utils::HashData(&record.asset, sizeof(record.asset));
+
+    for (auto& it : record.pages)
+    {
+        uint32_t layout[3] = { it.segFlags, it.segAlignment, it.alignment };
+
+        hash = Utils::HashData(layout, sizeof(layout), hash);
+        hash = Utils::HashData(it.data.data(), it.data.size(), hash);
+    }
+
+    hash = Utils::HashData(record.descriptors.data(), record.descriptors.size() * sizeof(RPakDescriptor), hash);
+    hash = Utils::HashData(record.guidDescriptors.data(), record.guidDescriptors.size() * sizeof(RPakGuidDescriptor), hash);
+
+    for (auto& it : record.starpakBlocks)
+        hash = Utils::HashData(it.data(), it.size(), hash);
+
+    return hash;
+}
+
+// purpose: write an asset record to a file
+void RePak::WriteAssetRecord(BufferedWriter& out, const AssetRecord_t& record)
+{
+    out.write(record.asset);
+    out.write((uint32_t)record.pages.size());
+
+    for (auto& it : record.pages)
+    {
+        uint32_t layout[4] = { it.segFlags, it.segAlignment, it.alignment, (uint32_t)it.data.size() };
+
+        out.write(layout);
+        out.writeVector(it.data);
+    }
+
+    out.write((uint32_t)record.descriptors.size());
+    out.writeVector(record.descriptors);
+
+    out.write((uint32_t)record.guidDescriptors.size());
+    out.writeVector(record.guidDescriptors);
+
+    out.write((uint32_t)record.starpakBlocks.size());
+
+    for (auto& it : record.starpakBlocks)
+    {
+        out.write((uint64_t)it.size());
+        out.writeVector(it);
+    }
+
+    out.write((uint32_t)record.starpakPaths.size());
+    out.writeStrings(record.starpakPaths);
+}
+
+// purpose: read an asset record from a file
+// returns: false if the record couldn't be read completely
+bool RePak::ReadAssetRecord(BinaryReader& in, AssetRecord_t& record)
+{
+    record = {};
+
+    try
+    {
+        in.read(record.asset);
+        record.pages.resize(in.read<uint32_t>());
+
+        for (auto& it : record.pages)
+        {
+            uint32_t layout[4];
+            in.read(layout);
+
+            it.segFlags = layout[0];
+            it.segAlignment = layout[1];
+            it.alignment = layout[2];
+
+            in.readVector(it.data, layout[3]);
+        }
+
+        in.readVector(record.descriptors, in.read<uint32_t>());
+        in.readVector(record.guidDescriptors, in.read<uint32_t>());
+
+        record.starpakBlocks.resize(in.read<uint32_t>());
+
+        for (auto& it : record.starpakBlocks)
+            in.readVector(it, in.read<uint64_t>());
+
+        record.starpakPaths.resize(in.read<uint32_t>());
+
+        for (auto& it : record.starpakPaths)
+            it = in.readString();
+    }
+    catch (const char*)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+BuildCache::BuildCache(const std::string& dir, uint64_t maxSizeBytes, bool explain)
+{
+    cacheDir = dir;
+    maxSize = maxSizeBytes;
+    bExplain = explain;
+
+    Utils::AppendSlash(cacheDir);
+    std::filesystem::create_directories(cacheDir);
+}
+
+std::string BuildCache::GetEntryPath(uint64_t assetId)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.rpcache", (unsigned long long)assetId);
+
+    return cacheDir + name;
+}
+
+// purpose: hash the state of a source file of an asset
+// files on disk are hashed by their size and last write time, so that a cache hit doesn't have to read its source files.
+// files given in memory are hashed by their contents, since they have neither. each file is only looked at once per build
+// returns: hash of the file, which is the same for every file that doesn't exist
+uint64_t RePak::GetSourceFileHash(const std::string& path)
+{
+    RPakBuildContext_t* ctx = g_pBuildContext;
+    std::string sNormalisedPath = Utils::NormalisePath(path);
+
+    auto it = ctx->sourceFileHashes.find(sNormalisedPath);
+
+    if (it != ctx->sourceFileHashes.end())
+        return it->second;
+
+    uint64_t hash = Utils::HashData(nullptr, 0);
+
+    if (ctx->memoryFiles.count(sNormalisedPath))
+    {
+        std::shared_ptr<const std::vector<uint8_t>> data = RePak::ReadInputFile(path);
+        hash = Utils::HashData(data->data(), data->size(), hash);
+    }
+    else
+    {
+        std::error_code ec;
+        uint64_t fileSize = std::filesystem::file_size(path, ec);
+
+        if (!ec)
+        {
+            int64_t writeTime = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+
+            hash = Utils::HashData(&fileSize, sizeof(fileSize), hash);
+            hash = Utils::HashData(&writeTime, sizeof(writeTime), hash);
+        }
+    }
+
+    ctx->sourceFileHashes.emplace(sNormalisedPath, hash);
+    return hash;
+}
+
+// purpose: hash everything that an asset's build output depends on
+// returns: cache key for the asset
+BuildCacheKey_t BuildCache::MakeKey(const AssetTypeHandler_t* handler, const char* assetPath, rapidjson::Value& mapEntry)
+{
+    BuildCacheKey_t key{};
+
+    key.assetId = Utils::HashData(&handler->mapType, sizeof(handler->mapType));
+    key.assetId = Utils::HashData(assetPath, strlen(assetPath), key.assetId);
+
+    key.versionHash = GetOutputVersionHash();
+
+    rapidjson::StringBuffer entryJson{};
+    rapidjson::Writer<rapidjson::StringBuffer> writer(entryJson);
+    mapEntry.Accept(writer);
+
+    key.entryHash = Utils::HashData(entryJson.GetString(), entryJson.GetSize());
+
+    if (handler->GetSourceHash)
+    {
+        key.sourceHash = handler->GetSourceHash(assetPath, mapEntry);
+        return key;
+    }
+
+    std::vector<std::string> sourceFiles{};
+
+    if (handler->GetSourceFiles)
+        handler->GetSourceFiles(assetPath, mapEntry, sourceFiles);
+
+    key.sourceHash = Utils::HashData(nullptr, 0);
+
+    for (auto& it : sourceFiles)
+    {
+        uint64_t fileHash = RePak::GetSourceFileHash(it);
+
+        key.sourceHash = Utils::HashData(it.c_str(), it.length(), key.sourceHash);
+        key.sourceHash = Utils::HashData(&fileHash, sizeof(fileHash), key.sourceHash);
+    }
+
+    return key;
+}
+
+// purpose: load the cached record for an asset if it is still up to date
+// returns: true on a cache hit
+bool BuildCache::Load(const BuildCacheKey_t& key, const char* assetPath, AssetRecord_t& record)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::string entryPath = GetEntryPath(key.assetId);
+    const char* missReason = nullptr;
+
+    BinaryReader in;
+
+    if (!FILE_EXISTS(entryPath) || !in.open(entryPath))
+    {
+        missReason = "no cache entry";
+    }
+    else if (in.size() < 2 * sizeof(uint32_t) + sizeof(BuildCacheKey_t))
+    {
+        missReason = "cache entry is corrupt";
+        in.close();
+    }
+    else
+    {
+        uint32_t magic = in.read<uint32_t>();
+        uint32_t version = in.read<uint32_t>();
+        BuildCacheKey_t cachedKey = in.read<BuildCacheKey_t>();
+
+        if (magic != BUILD_CACHE_MAGIC || version != BUILD_CACHE_VERSION)
+            missReason = "cache entry uses an old format";
+        else if (cachedKey.versionHash != key.versionHash)
+            missReason = "RePak version changed";
+        else if (cachedKey.entryHash != key.entryHash)
+            missReason = "map file entry changed";
+        else if (cachedKey.sourceHash != key.sourceHash)
+            missReason = "source files changed";
+        else if (!RePak::ReadAssetRecord(in, record))
+            missReason = "cache entry is corrupt";
+
+        in.close();
+    }
+
+    if (missReason)
+    {
+        misses++;
+
+        if (bExplain)
+            Log("cache miss: '%s' (%s)\n", assetPath, missReason);
+
+        return false;
+    }
+
+    hits++;
+
+    if (bExplain)
+        Log("cache hit: '%s'\n", assetPath);
+
+    // mark the entry as recently used so it is the last to be trimmed
+    std::error_code ec;
+    std::filesystem::last_write_time(entryPath, std::filesystem::file_time_type::clock::now(), ec);
+
+    return true;
+}
+
+// purpose: write an asset record to the cache, replacing the asset's previous entry
+void BuildCache::Store(const BuildCacheKey_t& key, const AssetRecord_t& record)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::string entryPath = GetEntryPath(key.assetId);
+    std::string tempPath = entryPath + ".tmp";
+
+    BufferedWriter out{};
+
+    if (!out.open(tempPath))
+    {
+        Warning("failed to write build cache entry '%s'\n", entryPath.c_str());
+        return;
+    }
+
+    uint32_t magic = BUILD_CACHE_MAGIC;
+    uint32_t version = BUILD_CACHE_VERSION;
+    BuildCacheKey_t entryKey = key;
+
+    out.write(magic);
+    out.write(version);
+    out.write(entryKey);
+
+    RePak::WriteAssetRecord(out, record);
+
+    // write to a temporary file first so that an interrupted build can't leave a partial entry behind
+    std::error_code ec;
+
+    if (!out.close())
+    {
+        Warning("failed to write build cache entry '%s'\n", entryPath.c_str());
+        std::filesystem::remove(tempPath, ec);
+        return;
+    }
+
+    std::filesystem::rename(tempPath, entryPath, ec);
+
+    if (ec)
+        Warning("failed to write build cache entry '%s'\n", entryPath.c_str());
+}
+
+// purpose: remove the least recently used cache entries until the cache fits in its size limit
+void BuildCache::Trim()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    struct CacheEntry_t
+    {
+        std::filesystem::path path;
+        std::filesystem::file_time_type lastUsed;
+        uintmax_t size;
+    };
+
+    std::vector<CacheEntry_t> entries{};
+    uintmax_t totalSize = 0;
+
+    std::error_code ec;
+    for (auto& it : std::filesystem::directory_iterator(cacheDir, ec))
+    {
+        if (!it.is_regular_file() || it.path().extension() != ".rpcache")
+            continue;
+
+        entries.push_back({ it.path(), it.last_write_time(), it.file_size() });
+        totalSize += it.file_size();
+    }
+
+    if (totalSize <= maxSize)
+        return;
+
+    std::sort(entries.begin(), entries.end(), [](const CacheEntry_t& a, const CacheEntry_t& b) { return a.lastUsed < b.lastUsed; });
+
+    size_t removed = 0;
+    for (auto& it : entries)
+    {
+        if (totalSize <= maxSize)
+            break;
+
+        if (std::filesystem::remove(it.path, ec))
+        {
+            totalSize -= it.size;
+            removed++;
+        }
+    }
+
+    Debug("removed %zu least recently used build cache entries\n", removed);
+}
+
+void BuildCache::PrintStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Log("build cache: %zu hits, %zu misses\n", hits, misses);
+}
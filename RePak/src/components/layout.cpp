@@ -0,0 +1,289 @@
+#include "pch.h"
+#include "AssetGraph.h"
+#include "BuildCache.h"
+
+// everything that a single asset added to the build state
+struct LayoutUnit_t
+{
+    uint64_t guid; // guid of the unit's first asset, -1 if it has none
+    uint32_t rank; // position in the load order, UINT32_MAX if it isn't in it
+    size_t position; // position in build order
+
+    BuildStateMark_t mark;
+    BuildStateMark_t endMark;
+};
+
+// purpose: read the layout options of the map into the build context
+// "stableLayoutSlotSize" pads every page to a multiple of it, see RePak::ApplyStableLayout for what it can't keep in place
+void RePak::SetLayoutOptions(rapidjson::Document& doc)
+{
+    g_pBuildContext->bStableLayout = doc.HasMember("stableLayout") && doc["stableLayout"].IsBool() && doc["stableLayout"].GetBool();
+    g_pBuildContext->layoutSlotSize = 0;
+
+    if (doc.HasMember("stableLayoutSlotSize") && doc["stableLayoutSlotSize"].IsUint())
+        g_pBuildContext->layoutSlotSize = doc["stableLayoutSlotSize"].GetUint();
+}
+
+// purpose: read the load order of the map into the build context
+// "loadOrder" is either "graph", to place assets right after the assets they reference (see AssetGraph::GetLoadOrder),
+// or the path of a file listing asset guids in the order the engine loads them, one per line, such as one taken from a loader trace.
+// assets that aren't in the file come after the ones that are, in graph order.
+// a load order turns on the stable layout
+// returns: false if the load order file couldn't be read
+bool RePak::SetLoadOrder(rapidjson::Document& doc, const std::filesystem::path& mapPath, AssetGraph& assetGraph)
+{
+    RPakBuildContext_t* ctx = g_pBuildContext;
+    ctx->loadOrder.clear();
+
+    if (!doc.HasMember("loadOrder") || !doc["loadOrder"].IsString())
+        return true;
+
+    std::string loadOrder = doc["loadOrder"].GetStdString();
+
+    if (loadOrder != "graph")
+    {
+        std::filesystem::path hintPath(loadOrder);
+
+        if (hintPath.is_relative() && mapPath.has_parent_path())
+            hintPath = mapPath.parent_path() / hintPath;
+
+        std::ifstream hintFile(hintPath);
+
+        if (!hintFile.is_open())
+        {
+            Error("couldn't open load order file '%s'\n", hintPath.u8string().c_str());
+            return false;
+        }
+
+        std::string line;
+
+        while (std::getline(hintFile, line))
+        {
+            if (line.empty() || line[0] == '#')
+                continue;
+
+            // only the first position of a guid counts
+            ctx->loadOrder.emplace(strtoull(line.c_str(), nullptr, 0), (uint32_t)ctx->loadOrder.size());
+        }
+    }
+
+    for (uint32_t nodeIdx : assetGraph.GetLoadOrder())
+        ctx->loadOrder.emplace(assetGraph.GetNode(nodeIdx).guid, (uint32_t)ctx->loadOrder.size());
+
+    ctx->bStableLayout = true;
+    return true;
+}
+
+// purpose: reorder the build state so that its layout only depends on the assets in it, not on the order they were built in
+// - assets, with their pages and starpak data, are placed in load order if the map has one (see RePak::SetLoadOrder),
+//   and in guid order otherwise
+// - segments are placed in order of their flags and alignment
+// - with a slot size, every page is padded to a multiple of it, so an asset can grow a little without moving the pages after it
+// this way, an asset that hasn't changed keeps the same bytes and mostly the same file offsets from one build to the next.
+// limit: the page data comes after the header tables (starpak paths, segments, pages, descriptors and asset entries), which
+// aren't padded, so adding or removing an asset, page, descriptor or starpak path still moves the page data of every asset.
+// the slot size only keeps offsets stable while the set of assets stays the same
+// marks must hold the build state before every asset in build order and after the last one (see RePak::BuildAssets),
+// anything added after the last mark is kept at the end
+// note: must run before FinalizeDescriptors, since it changes the asset order
+void RePak::ApplyStableLayout(const std::vector<BuildStateMark_t>& marks, std::vector<RPakAssetEntryV8>& assetEntries)
+{
+    RPakBuildContext_t* ctx = g_pBuildContext;
+
+    if (marks.empty())
+        return;
+
+    std::vector<LayoutUnit_t> units{};
+
+    for (size_t i = 0; i + 1 < marks.size(); ++i)
+    {
+        const bool bHasAsset = marks[i].assetCount != marks[i + 1].assetCount;
+        units.push_back({ bHasAsset ? assetEntries[marks[i].assetCount].GUID : (uint64_t)-1, UINT32_MAX, i, marks[i], marks[i + 1] });
+    }
+
+    // everything after the last mark goes at the end
+    BuildStateMark_t endMark = RePak::MarkBuildState(assetEntries);
+    units.push_back({ (uint64_t)-1, UINT32_MAX, marks.size() - 1, marks.back(), endMark });
+
+    for (auto& it : units)
+    {
+        // each asset's pages have to stay together, which is only the case if they were all added for it
+        for (size_t i = it.mark.assetCount; i < it.endMark.assetCount; ++i)
+        {
+            const RPakAssetEntryV8& asset = assetEntries[i];
+
+            if (asset.SubHeaderDataBlockIndex < it.mark.pageCount || asset.PageEnd > it.endMark.pageCount || asset.PageEnd <= asset.SubHeaderDataBlockIndex)
+            {
+                Warning("asset %" PRIx64 " uses pages of other assets, keeping the build order layout\n", asset.GUID);
+                return;
+            }
+        }
+    }
+
+    for (auto& it : units)
+    {
+        auto rankIt = ctx->loadOrder.find(it.guid);
+        it.rank = rankIt != ctx->loadOrder.end() ? rankIt->second : UINT32_MAX;
+    }
+
+    std::stable_sort(units.begin(), units.end() - 1, [](const LayoutUnit_t& a, const LayoutUnit_t& b)
+    {
+        return a.rank < b.rank || (a.rank == b.rank && a.guid < b.guid);
+    });
+
+    // pages
+    std::vector<uint32_t> pageMap(ctx->pages.size());
+    std::vector<uint32_t> pageOrder{};
+
+    for (auto& it : units)
+    {
+        for (size_t i = it.mark.pageCount; i < it.endMark.pageCount; ++i)
+        {
+            pageMap[i] = pageOrder.size();
+            pageOrder.push_back(i);
+        }
+    }
+
+    // segments
+    std::vector<uint32_t> segmentOrder(ctx->segments.size());
+
+    for (uint32_t i = 0; i < segmentOrder.size(); ++i)
+        segmentOrder[i] = i;
+
+    std::sort(segmentOrder.begin(), segmentOrder.end(), [ctx](uint32_t a, uint32_t b)
+    {
+        const RPakVirtualSegment& segA = ctx->segments[a];
+        const RPakVirtualSegment& segB = ctx->segments[b];
+
+        return segA.DataFlag < segB.DataFlag || (segA.DataFlag == segB.DataFlag && segA.SomeType < segB.SomeType);
+    });
+
+    std::vector<uint32_t> segmentMap(ctx->segments.size());
+    std::vector<RPakVirtualSegment> segments{};
+
+    for (uint32_t i = 0; i < segmentOrder.size(); ++i)
+    {
+        segmentMap[segmentOrder[i]] = i;
+        segments.push_back({ ctx->segments[segmentOrder[i]].DataFlag, ctx->segments[segmentOrder[i]].SomeType, 0 });
+    }
+
+    // page data is held by one raw data block per page
+    std::vector<uint8_t*> pageData(ctx->pages.size(), nullptr);
+
+    for (auto& it : ctx->rawDataBlocks)
+        pageData[it.pageIdx] = it.dataPtr;
+
+    // pointers are moved while the data is still held by its old page
+    for (auto& it : ctx->descriptors)
+    {
+        RPakPtr* ptr = reinterpret_cast<RPakPtr*>(pageData[it.PageIdx] + it.PageOffset);
+        ptr->Index = pageMap[ptr->Index];
+
+        it.PageIdx = pageMap[it.PageIdx];
+    }
+
+    for (auto& it : ctx->guidDescriptors)
+        it.PageIdx = pageMap[it.PageIdx];
+
+    std::vector<RPakPageInfo> pages{};
+    std::vector<RPakRawDataBlock> rawDataBlocks{};
+
+    for (uint32_t oldIdx : pageOrder)
+    {
+        RPakPageInfo page = ctx->pages[oldIdx];
+        uint8_t* data = pageData[oldIdx];
+
+        if (ctx->layoutSlotSize && page.DataSize % ctx->layoutSlotSize)
+        {
+            uint32_t paddedSize = page.DataSize + ctx->layoutSlotSize - page.DataSize % ctx->layoutSlotSize;
+            uint8_t* paddedData = new uint8_t[paddedSize]{};
+
+            memcpy(paddedData, data, page.DataSize);
+            delete[] data;
+
+            data = paddedData;
+            page.DataSize = paddedSize;
+        }
+
+        page.VSegIdx = segmentMap[page.VSegIdx];
+        segments[page.VSegIdx].DataSize += page.DataSize;
+
+        rawDataBlocks.push_back({ (uint32_t)pages.size(), page.DataSize, data });
+        pages.push_back(page);
+    }
+
+    ctx->segments = std::move(segments);
+    ctx->pages = std::move(pages);
+    ctx->rawDataBlocks = std::move(rawDataBlocks);
+
+    // starpak data, placed from where the first block was
+    std::unordered_map<uint64_t, uint64_t> starpakOffsetMap{};
+    std::vector<SRPkDataEntry> starpakEntries{};
+    uint64_t starpakOffset = ctx->starpakEntries.empty() ? 0 : ctx->starpakEntries[0].offset;
+
+    for (auto& it : units)
+    {
+        for (size_t i = it.mark.starpakEntryCount; i < it.endMark.starpakEntryCount; ++i)
+        {
+            SRPkDataEntry entry = ctx->starpakEntries[i];
+
+            starpakOffsetMap[entry.offset] = starpakOffset;
+            entry.offset = starpakOffset;
+            starpakOffset += entry.dataSize;
+
+            starpakEntries.push_back(entry);
+        }
+    }
+
+    ctx->starpakEntries = std::move(starpakEntries);
+
+    // assets
+    std::vector<RPakAssetEntryV8> newAssetEntries{};
+
+    for (auto& it : units)
+    {
+        for (size_t i = it.mark.assetCount; i < it.endMark.assetCount; ++i)
+        {
+            RPakAssetEntryV8 asset = assetEntries[i];
+
+            asset.SubHeaderDataBlockIndex = pageMap[asset.SubHeaderDataBlockIndex];
+            asset.PageEnd = pageMap[asset.PageEnd - 1] + 1;
+
+            if (asset.RawDataBlockIndex != (uint32_t)-1)
+                asset.RawDataBlockIndex = pageMap[asset.RawDataBlockIndex];
+
+            auto offsetIt = starpakOffsetMap.find(asset.StarpakOffset);
+
+            if (asset.StarpakOffset != (uint64_t)-1 && offsetIt != starpakOffsetMap.end())
+                asset.StarpakOffset = offsetIt->second;
+
+            newAssetEntries.push_back(asset);
+        }
+    }
+
+    assetEntries = std::move(newAssetEntries);
+}
+
+// purpose: lay out the built assets of a map the way its layout options ask for and finalize the descriptors and file relations
+// marks must hold the build state before every asset in build order and after the last one (see RePak::BuildAssets).
+// pAssetGraph is only used for the relations when its asset indices match the entries, otherwise pass nullptr
+// returns: true on success
+bool RePak::FinalizeLayout(AssetGraph* pAssetGraph, const std::vector<BuildStateMark_t>& marks, std::vector<RPakAssetEntryV8>& assetEntries)
+{
+    // the asset graph's asset indices don't survive the reordering, so relations are generated from the guids instead
+    if (g_pBuildContext->bStableLayout)
+    {
+        RePak::ApplyStableLayout(marks, assetEntries);
+        pAssetGraph = nullptr;
+    }
+
+    if (!RePak::FinalizeDescriptors(assetEntries))
+        return false;
+
+    if (pAssetGraph)
+        pAssetGraph->GenerateFileRelations(assetEntries);
+    else
+        RePak::GenerateFileRelationsFromGuids(assetEntries);
+
+    return true;
+}
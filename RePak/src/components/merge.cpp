@@ -0,0 +1,358 @@
+#include "pch.h"
+#include "Assets.h"
+#include "BuildCache.h"
+#include "RPakFile.h"
+
+// size of the chunks that starpak data is copied in
+#define STARPAK_COPY_CHUNK_SIZE (1024 * 1024)
+
+// purpose: find the file of an rpak's starpak, which is expected to be next to the rpak
+// returns: path of the starpak file, or an empty string if the rpak doesn't use this kind of starpak
+static std::string GetStarpakFilePath(const std::string& rpakPath, const std::vector<std::string>& starpakPaths)
+{
+    if (starpakPaths.empty())
+        return "";
+
+    return (std::filesystem::path(rpakPath).parent_path() / std::filesystem::path(starpakPaths[0]).filename()).u8string();
+}
+
+// purpose: get the temporary file that an output file of the merge is written to
+// outputs are often written over the rpaks and starpaks being merged, so they only replace them once every output has been written
+static std::string GetTempOutputPath(const std::string& outPath)
+{
+    return outPath + ".tmp";
+}
+
+// purpose: replace every output file with its temporary file, or remove the temporary files if the merge failed
+// returns: true if every output file was replaced
+static bool FinishOutputFiles(const std::vector<std::string>& outFiles, bool bSuccess)
+{
+    std::error_code ec;
+
+    for (auto& it : outFiles)
+    {
+        if (!bSuccess)
+        {
+            std::filesystem::remove(GetTempOutputPath(it), ec);
+            continue;
+        }
+
+        std::filesystem::rename(GetTempOutputPath(it), it, ec);
+
+        if (ec)
+        {
+            Error("couldn't replace '%s' with the merged file\n", it.c_str());
+            bSuccess = false;
+        }
+    }
+
+    return bSuccess;
+}
+
+// purpose: write the data of several starpaks one after another into a new starpak
+// the data blocks are copied as they are, bases receives the amount that each input's offsets move by
+// returns: true on success
+static bool MergeStarpaks(const std::vector<std::string>& inputs, const std::string& outPath, std::vector<uint64_t>& bases)
+{
+    BufferedWriter out{};
+
+    if (!out.open(outPath))
+    {
+        Error("couldn't open starpak '%s' for writing\n", outPath.c_str());
+        return false;
+    }
+
+    int magic = 'kPRS';
+    int version = 1;
+
+    out.write(magic);
+    out.write(version);
+    out.writePadding(4088, 0xCB);
+
+    std::vector<char> buf(STARPAK_COPY_CHUNK_SIZE);
+
+    std::vector<SRPkFileEntry> entries{};
+    uint64_t outOffset = 0x1000;
+
+    bases.assign(inputs.size(), 0);
+
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        if (inputs[i].empty())
+            continue;
+
+        uint64_t dataEnd = RePak::GetStarpakDataEnd(inputs[i]);
+
+        if (dataEnd == (uint64_t)-1)
+        {
+            Error("'%s' is not a valid starpak\n", inputs[i].c_str());
+            return false;
+        }
+
+        std::ifstream in(inputs[i], std::ios::binary | std::ios::ate);
+        uint64_t fileSize = in.tellg();
+
+        std::vector<SRPkFileEntry> inEntries((fileSize - dataEnd - sizeof(uint64_t)) / sizeof(SRPkFileEntry));
+        in.seekg(dataEnd);
+        in.read((char*)inEntries.data(), inEntries.size() * sizeof(SRPkFileEntry));
+
+        bases[i] = outOffset - 0x1000;
+
+        for (auto& it : inEntries)
+            entries.push_back({ it.offset + bases[i], it.size });
+
+        in.seekg(0x1000);
+
+        for (uint64_t remaining = dataEnd - 0x1000; remaining > 0;)
+        {
+            size_t chunkSize = (size_t)min(remaining, (uint64_t)buf.size());
+
+            if (!in.read(buf.data(), chunkSize))
+            {
+                Error("failed to read starpak '%s'\n", inputs[i].c_str());
+                return false;
+            }
+
+            out.writeBytes(buf.data(), chunkSize);
+            remaining -= chunkSize;
+        }
+
+        outOffset += dataEnd - 0x1000;
+    }
+
+    uint64_t entryCount = entries.size();
+
+    out.writeVector(entries);
+    out.write(entryCount);
+
+    return out.close();
+}
+
+// purpose: merge the mandatory or optional starpaks of every rpak into one starpak
+// the merged starpak uses the path of the first rpak that has one, and is written to its temporary file (see GetTempOutputPath)
+// returns: true on success
+static bool MergeStarpakKind(const std::vector<RPakFile_t>& paks, const std::vector<std::string>& rpakPaths, bool bOptional, const std::filesystem::path& outDir,
+    std::vector<std::string>& outPaths, std::vector<uint64_t>& bases, std::vector<std::string>& outFiles)
+{
+    std::vector<std::string> inputs{ };
+
+    for (size_t i = 0; i < paks.size(); ++i)
+    {
+        const std::vector<std::string>& pakPaths = bOptional ? paks[i].optStarpakPaths : paks[i].starpakPaths;
+
+        if (!pakPaths.empty() && outPaths.empty())
+            outPaths.push_back(pakPaths[0]);
+        else if (!pakPaths.empty() && pakPaths[0] != outPaths[0])
+            Warning("starpak '%s' of rpak '%s' is merged into '%s'\n", pakPaths[0].c_str(), rpakPaths[i].c_str(), outPaths[0].c_str());
+
+        inputs.push_back(GetStarpakFilePath(rpakPaths[i], pakPaths));
+    }
+
+    if (outPaths.empty())
+        return true;
+
+    outFiles.push_back((outDir / std::filesystem::path(outPaths[0]).filename()).u8string());
+
+    return MergeStarpaks(inputs, GetTempOutputPath(outFiles.back()), bases);
+}
+
+// purpose: merge several existing rpaks and their starpaks into a single rpak
+// the tables of each rpak are appended with their page, asset and starpak indices moved past those of the rpaks before it,
+// and the page data is copied as a single block per rpak after the pointers in it have been moved the same way.
+// no asset handlers are run, so no source files are needed
+// returns: exit code
+int RePak::MergeRPaks(const std::vector<std::string>& rpakPaths, const std::string& outPath)
+{
+    std::vector<RPakFile_t> paks(rpakPaths.size());
+
+    for (size_t i = 0; i < rpakPaths.size(); ++i)
+    {
+        if (!RePak::ReadRPakFile(rpakPaths[i], paks[i]))
+            return EXIT_FAILURE;
+
+        if (paks[i].starpakPaths.size() > 1 || paks[i].optStarpakPaths.size() > 1)
+        {
+            Error("rpak '%s' uses more than one starpak of the same kind, which isn't supported\n", rpakPaths[i].c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    Log("merging %zu rpaks into %s\n\n", paks.size(), outPath.c_str());
+
+    RPakBuildContext_t* ctx = g_pBuildContext;
+
+    std::vector<RPakAssetEntryV8> assetEntries{ };
+    std::unordered_map<uint64_t, size_t> guidToPak{ };
+
+    // pointers to the page data of every merged page, in the order that it is written
+    std::vector<const uint8_t*> pageData{ };
+
+    for (size_t i = 0; i < paks.size(); ++i)
+    {
+        RPakFile_t& pak = paks[i];
+        const uint32_t pageBase = ctx->pages.size();
+
+        // segments with the same flags and alignment are combined, the same way as when building
+        std::vector<uint32_t> segmentMap(pak.segments.size());
+
+        for (uint32_t j = 0; j < pak.segments.size(); ++j)
+        {
+            const RPakVirtualSegment& seg = pak.segments[j];
+            uint32_t outIdx = 0;
+
+            while (outIdx < ctx->segments.size() && (ctx->segments[outIdx].DataFlag != seg.DataFlag || ctx->segments[outIdx].SomeType != seg.SomeType))
+                outIdx++;
+
+            if (outIdx == ctx->segments.size())
+                ctx->segments.push_back({ seg.DataFlag, seg.SomeType, 0 });
+
+            ctx->segments[outIdx].DataSize += seg.DataSize;
+            segmentMap[j] = outIdx;
+        }
+
+        for (uint32_t j = 0; j < pak.pages.size(); ++j)
+        {
+            RPakPageInfo page = pak.pages[j];
+            page.VSegIdx = segmentMap[page.VSegIdx];
+
+            ctx->pages.push_back(page);
+            pageData.push_back(pak.fileData.data() + pak.pageOffsets[j]);
+        }
+
+        // move the pointers in the page data along with the pages they point to
+        for (auto desc : pak.descriptors)
+        {
+            if (desc.PageIdx >= pak.pages.size() || desc.PageOffset + sizeof(RPakPtr) > pak.pages[desc.PageIdx].DataSize)
+            {
+                Error("rpak '%s' has a descriptor outside of its pages\n", rpakPaths[i].c_str());
+                return EXIT_FAILURE;
+            }
+
+            RPakPtr* ptr = reinterpret_cast<RPakPtr*>(pak.fileData.data() + pak.pageOffsets[desc.PageIdx] + desc.PageOffset);
+            ptr->Index += pageBase;
+
+            desc.PageIdx += pageBase;
+            ctx->descriptors.push_back(desc);
+        }
+
+        for (auto desc : pak.guidDescriptors)
+        {
+            desc.PageIdx += pageBase;
+            ctx->guidDescriptors.push_back(desc);
+        }
+
+        for (auto asset : pak.assets)
+        {
+            auto inserted = guidToPak.emplace(asset.GUID, i);
+
+            if (!inserted.second)
+            {
+                Error("asset %" PRIx64 " is in both '%s' and '%s'\n", asset.GUID, rpakPaths[inserted.first->second].c_str(), rpakPaths[i].c_str());
+                return EXIT_FAILURE;
+            }
+
+            asset.SubHeaderDataBlockIndex += pageBase;
+            asset.PageEnd += pageBase;
+
+            if (asset.RawDataBlockIndex != (uint32_t)-1)
+                asset.RawDataBlockIndex += pageBase;
+
+            assetEntries.push_back(asset);
+        }
+    }
+
+    if (ctx->pages.size() > UINT16_MAX)
+    {
+        Error("merged rpak would have %zu pages, but rpaks can only have %u\n", ctx->pages.size(), UINT16_MAX);
+        return EXIT_FAILURE;
+    }
+
+    // the data of every input's starpaks is appended to a single starpak of each kind
+    std::filesystem::path outDir = std::filesystem::path(outPath).parent_path();
+    std::vector<uint64_t> starpakBases{ };
+    std::vector<uint64_t> optStarpakBases{ };
+    std::vector<std::string> outFiles{ };
+
+    if (!outDir.empty())
+        std::filesystem::create_directories(outDir);
+
+    if (!MergeStarpakKind(paks, rpakPaths, false, outDir, ctx->starpakPaths, starpakBases, outFiles)
+        || !MergeStarpakKind(paks, rpakPaths, true, outDir, ctx->optStarpakPaths, optStarpakBases, outFiles))
+    {
+        FinishOutputFiles(outFiles, false);
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0, assetIdx = 0; i < paks.size(); ++i)
+    {
+        for (size_t j = 0; j < paks[i].assets.size(); ++j, ++assetIdx)
+        {
+            RPakAssetEntryV8& asset = assetEntries[assetIdx];
+
+            if (asset.StarpakOffset != (uint64_t)-1 && !starpakBases.empty())
+                asset.StarpakOffset += starpakBases[i];
+
+            if (asset.OptionalStarpakOffset != (uint64_t)-1 && !optStarpakBases.empty())
+                asset.OptionalStarpakOffset += optStarpakBases[i];
+        }
+    }
+
+    // relations are generated again rather than moved, so that assets that use assets from another of the merged rpaks get them as well
+    if (!RePak::FinalizeDescriptors(assetEntries))
+    {
+        FinishOutputFiles(outFiles, false);
+        return EXIT_FAILURE;
+    }
+
+    RePak::GenerateFileRelationsFromGuids(assetEntries, pageData);
+
+    // keep every header field that isn't derived from the tables from the first rpak
+    RPakFileHeaderV8 rpakHeader = paks[0].header;
+    rpakHeader.CreatedTime = RePak::GetCreatedTime();
+
+    uint64_t pageDataSize = 0;
+
+    for (auto& it : ctx->pages)
+        pageDataSize += it.DataSize;
+
+    outFiles.push_back(outPath);
+
+    BufferedWriter out{};
+
+    if (!out.open(GetTempOutputPath(outPath)))
+    {
+        Error("couldn't open rpak '%s' for writing\n", outPath.c_str());
+        FinishOutputFiles(outFiles, false);
+        return EXIT_FAILURE;
+    }
+
+    RePak::WriteRPakTables(out, rpakHeader, assetEntries, pageDataSize);
+
+    // page data is stored in page order, so each rpak's pages can be written in one go
+    for (auto& it : paks)
+    {
+        if (it.pages.empty())
+            continue;
+
+        size_t size = 0;
+
+        for (auto& page : it.pages)
+            size += page.DataSize;
+
+        out.writeBytes(it.fileData.data() + it.pageOffsets[0], size);
+    }
+
+    if (!out.close())
+    {
+        Error("failed to write rpak '%s'\n", outPath.c_str());
+        FinishOutputFiles(outFiles, false);
+        return EXIT_FAILURE;
+    }
+
+    if (!FinishOutputFiles(outFiles, true))
+        return EXIT_FAILURE;
+
+    Log("merged %zu assets into %s\n", assetEntries.size(), outPath.c_str());
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,304 @@
+#include "pch.h"
+#include "RePak.h"
+#include "DirectWriter.h"
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <thread>
+
+// pages are only split between threads once there is enough data to be worth it
+#define PAKWRITER_BYTES_PER_THREAD ((uint64_t)16 * 1024 * 1024)
+
+// rpaks with less page data than this go through the file cache even when direct writes are on,
+// since they don't push anything else out of it and are usually read back straight away
+#define PAKWRITER_DIRECT_MIN_PAGE_DATA ((uint64_t)256 * 1024 * 1024)
+
+// a block of data and the file offset it goes to
+struct PlannedWrite_t
+{
+    uint64_t offset;
+    const void* data;
+    uint64_t size;
+};
+
+// purpose: read the output options of the map into the build context
+void RePak::SetOutputOptions(rapidjson::Document& doc)
+{
+    g_pBuildContext->bDirectIO = doc.HasMember("directIO") && doc["directIO"].IsBool() && doc["directIO"].GetBool();
+}
+
+// purpose: work out the file offset of the tables and every page of the rpak for the current build state
+// the page data follows the tables, one raw data block per page, in page order
+void RePak::PlanRPakFile(const std::vector<RPakAssetEntryV8>& assetEntries, RPakFilePlan_t& plan)
+{
+    plan.tablesSize = RePak::GetRPakTablesSize(assetEntries);
+    plan.fileSize = plan.tablesSize;
+    plan.pageOffsets.clear();
+
+    for (auto& it : g_pBuildContext->rawDataBlocks)
+    {
+        plan.pageOffsets.push_back(plan.fileSize);
+        plan.fileSize += it.dataSize;
+    }
+}
+
+// purpose: write blocks to their offsets in a file that has been created at its final size
+// the blocks are shared out between worker threads, each with its own handle to the file, since the blocks never overlap.
+// writes are positional (see Platform::WriteFileAt), so the threads never have to share a file pointer
+// returns: true on success
+static bool WritePlannedBlocks(const std::string& path, const std::vector<PlannedWrite_t>& writes)
+{
+    uint64_t totalSize = 0;
+
+    for (auto& it : writes)
+        totalSize += it.size;
+
+    uint32_t nThreads = max(std::thread::hardware_concurrency(), 1u);
+    nThreads = static_cast<uint32_t>(min((uint64_t)nThreads, totalSize / PAKWRITER_BYTES_PER_THREAD + 1));
+    nThreads = static_cast<uint32_t>(min((size_t)nThreads, writes.size()));
+
+    std::atomic<size_t> nextWriteIdx = 0;
+    std::atomic<bool> bFailed = false;
+
+    auto worker = [&]()
+    {
+        PlatformFile_t file = Platform::OpenOutputFile(path);
+
+        if (file == PLATFORM_INVALID_FILE)
+        {
+            bFailed = true;
+            return;
+        }
+
+        for (size_t i = nextWriteIdx++; i < writes.size() && !bFailed; i = nextWriteIdx++)
+        {
+            if (!Platform::WriteFileAt(file, writes[i].offset, writes[i].data, writes[i].size))
+                bFailed = true;
+        }
+
+        Platform::CloseFile(file);
+    };
+
+    // small files are written on the calling thread
+    if (nThreads <= 1)
+    {
+        worker();
+        return !bFailed;
+    }
+
+    std::vector<std::thread> threads{};
+
+    for (uint32_t i = 0; i < nThreads; ++i)
+        threads.emplace_back(worker);
+
+    for (auto& it : threads)
+        it.join();
+
+    return !bFailed;
+}
+
+// purpose: write the tables and then every page of an rpak from start to end without going through the file cache
+// returns: true on success
+static bool WriteRPakFileDirect(const std::string& path, const std::string& tablesData, const RPakFilePlan_t& plan)
+{
+    DirectWriter out{};
+
+    if (!out.open(path, plan.fileSize))
+    {
+        Error("failed to create rpak '%s'\n", path.c_str());
+        return false;
+    }
+
+    out.writeBytes(tablesData.data(), tablesData.size());
+
+    for (auto& it : g_pBuildContext->rawDataBlocks)
+        out.writeBytes(it.dataPtr, it.dataSize);
+
+    if (!out.close())
+    {
+        Error("failed to write rpak '%s'\n", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// purpose: write the rpak for the current build state to a file
+// every offset in the file is planned before anything is written (see RePak::PlanRPakFile), so the file is created at its
+// final size and the pages are written straight to their offsets on several threads, instead of one after another through a stream
+// returns: true on success
+bool RePak::WriteRPakFile(const std::string& path, RPakFileHeaderV8& rpakHeader, std::vector<RPakAssetEntryV8>& assetEntries)
+{
+    RPakFilePlan_t plan{};
+    RePak::PlanRPakFile(assetEntries, plan);
+
+    std::ostringstream tables{};
+    BufferedWriter tablesWriter(tables);
+
+    RePak::WriteRPakTables(tablesWriter, rpakHeader, assetEntries, plan.fileSize - plan.tablesSize);
+    tablesWriter.flush();
+
+    std::string tablesData = tables.str();
+
+    if (g_pBuildContext->bDirectIO && plan.fileSize - plan.tablesSize >= PAKWRITER_DIRECT_MIN_PAGE_DATA)
+        return WriteRPakFileDirect(path, tablesData, plan);
+
+    PlatformFile_t file = Platform::CreateOutputFile(path, plan.fileSize);
+
+    if (file == PLATFORM_INVALID_FILE)
+    {
+        Error("failed to create rpak '%s'\n", path.c_str());
+        return false;
+    }
+
+    bool bSuccess = Platform::WriteFileAt(file, 0, tablesData.data(), tablesData.size());
+    Platform::CloseFile(file);
+
+    std::vector<PlannedWrite_t> writes{};
+    const std::vector<RPakRawDataBlock>& rawDataBlocks = g_pBuildContext->rawDataBlocks;
+
+    for (size_t i = 0; i < rawDataBlocks.size(); ++i)
+        writes.push_back({ plan.pageOffsets[i], rawDataBlocks[i].dataPtr, rawDataBlocks[i].dataSize });
+
+    if (!bSuccess || !WritePlannedBlocks(path, writes))
+    {
+        Error("failed to write rpak '%s'\n", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// purpose: write the rpak for the current build state into memory, laid out the same way as RePak::WriteRPakFile
+// the image is allocated at its final size and every page is copied straight into it
+// returns: the rpak image
+std::string RePak::WriteRPakImage(RPakFileHeaderV8& rpakHeader, std::vector<RPakAssetEntryV8>& assetEntries)
+{
+    RPakFilePlan_t plan{};
+    RePak::PlanRPakFile(assetEntries, plan);
+
+    std::ostringstream tables{};
+    BufferedWriter tablesWriter(tables);
+
+    RePak::WriteRPakTables(tablesWriter, rpakHeader, assetEntries, plan.fileSize - plan.tablesSize);
+    tablesWriter.flush();
+
+    std::string image(plan.fileSize, '\0');
+    tables.str().copy(image.data(), plan.tablesSize);
+
+    const std::vector<RPakRawDataBlock>& rawDataBlocks = g_pBuildContext->rawDataBlocks;
+
+    for (size_t i = 0; i < rawDataBlocks.size(); ++i)
+        memcpy(image.data() + plan.pageOffsets[i], rawDataBlocks[i].dataPtr, rawDataBlocks[i].dataSize);
+
+    return image;
+}
+
+// purpose: write a starpak from start to end without going through the file cache
+// the data entries are written in offset order, and anything between them is left as zeros like in a file written by offset
+// returns: true on success
+static bool WriteStarpakFileDirect(const std::string& path, const std::vector<char>& header, const std::vector<SRPkFileEntry>& entryTable, uint64_t fileSize)
+{
+    std::vector<const SRPkDataEntry*> entries{};
+
+    for (auto& it : g_pBuildContext->starpakEntries)
+        entries.push_back(&it);
+
+    std::stable_sort(entries.begin(), entries.end(), [](const SRPkDataEntry* a, const SRPkDataEntry* b) { return a->offset < b->offset; });
+
+    DirectWriter out{};
+
+    if (!out.open(path, fileSize))
+    {
+        Error("failed to create starpak '%s'\n", path.c_str());
+        return false;
+    }
+
+    out.writeVector(header);
+
+    for (auto& it : entries)
+    {
+        if (it->offset < out.tell())
+        {
+            out.close();
+            Error("failed to write starpak '%s': data entry at offset 0x%" PRIx64 " overlaps the one before it\n", path.c_str(), it->offset);
+            return false;
+        }
+
+        out.writePadding(it->offset - out.tell());
+        out.writeBytes(it->dataPtr, it->dataSize);
+    }
+
+    uint64_t entryCount = entryTable.size();
+
+    out.writeVector(entryTable);
+    out.write(entryCount);
+
+    if (!out.close())
+    {
+        Error("failed to write starpak '%s'\n", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// purpose: write every starpak data entry to a new starpak file
+// the offset of each data entry is already its offset in the file, so the entries are written the same way as rpak pages
+// returns: true on success
+bool RePak::WriteStarpakFile(const std::string& path)
+{
+    const std::vector<SRPkDataEntry>& starpakEntries = g_pBuildContext->starpakEntries;
+
+    // data blocks in starpaks are all aligned to 4096 bytes, including the header which gets filled with 0xCB after the magic
+    // and version
+    std::vector<char> header(0x1000, (char)0xCB);
+    int magic = 'kPRS';
+    int version = 1;
+
+    memcpy(header.data(), &magic, sizeof(magic));
+    memcpy(header.data() + sizeof(magic), &version, sizeof(version));
+
+    uint64_t dataEnd = header.size();
+    std::vector<SRPkFileEntry> entryTable{};
+
+    for (auto& it : starpakEntries)
+    {
+        dataEnd = max(dataEnd, it.offset + it.dataSize);
+        entryTable.push_back({ it.offset, it.dataSize });
+    }
+
+    uint64_t entryCount = starpakEntries.size();
+    uint64_t fileSize = dataEnd + entryTable.size() * sizeof(SRPkFileEntry) + sizeof(entryCount);
+
+    // starpak data is only ever read back by the game, so big starpak sets can be kept out of the file cache entirely
+    if (g_pBuildContext->bDirectIO)
+        return WriteStarpakFileDirect(path, header, entryTable, fileSize);
+
+    PlatformFile_t file = Platform::CreateOutputFile(path, fileSize);
+
+    if (file == PLATFORM_INVALID_FILE)
+    {
+        Error("failed to create starpak '%s'\n", path.c_str());
+        return false;
+    }
+
+    bool bSuccess = Platform::WriteFileAt(file, 0, header.data(), header.size())
+        && Platform::WriteFileAt(file, dataEnd, entryTable.data(), entryTable.size() * sizeof(SRPkFileEntry))
+        && Platform::WriteFileAt(file, fileSize - sizeof(entryCount), &entryCount, sizeof(entryCount));
+
+    Platform::CloseFile(file);
+
+    std::vector<PlannedWrite_t> writes{};
+
+    for (auto& it : starpakEntries)
+        writes.push_back({ it.offset, it.dataPtr, it.dataSize });
+
+    if (!bSuccess || !WritePlannedBlocks(path, writes))
+    {
+        Error("failed to write starpak '%s'\n", path.c_str());
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,333 @@
+#include "pch.h"
+#include "Assets.h"
+#include "AssetGraph.h"
+#include "BuildCache.h"
+#include "SharedBuildState.h"
+#include "PakBudget.h"
+#include "PatchBuild.h"
+#include "RPakFile.h"
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+
+// purpose: read the manifest of a released rpak
+// returns: true on success
+bool RePak::ReadReleaseManifest(const std::string& path, ReleaseManifest_t& manifest)
+{
+    std::ifstream ifs(path, std::ios::binary);
+
+    if (!ifs.is_open())
+    {
+        Error("couldn't open release manifest '%s'\n", path.c_str());
+        return false;
+    }
+
+    std::string json((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    rapidjson::Document doc{};
+
+    doc.Parse(json.c_str());
+
+    if (doc.HasParseError() || !doc.IsObject() || !doc.HasMember("assets") || !doc["assets"].IsArray())
+    {
+        Error("'%s' is not a valid release manifest\n", path.c_str());
+        return false;
+    }
+
+    manifest = {};
+
+    if (doc.HasMember("rpak") && doc["rpak"].IsString())
+        manifest.rpakName = doc["rpak"].GetStdString();
+
+    if (doc.HasMember("patch") && doc["patch"].IsUint())
+        manifest.patchNum = doc["patch"].GetUint();
+
+    for (auto& it : doc["assets"].GetArray())
+    {
+        if (!it.HasMember("guid") || !it["guid"].IsString() || !it.HasMember("hash") || !it["hash"].IsString())
+            continue;
+
+        manifest.assetHashes[strtoull(it["guid"].GetString(), nullptr, 0)] = strtoull(it["hash"].GetString(), nullptr, 0);
+    }
+
+    return true;
+}
+
+// purpose: write the manifest of a released rpak
+// assets are written in guid order, so that the manifests of two releases can be compared as text
+// returns: true on success
+bool RePak::WriteReleaseManifest(const std::string& path, const ReleaseManifest_t& manifest)
+{
+    rapidjson::StringBuffer json{};
+    rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(json);
+
+    writer.StartObject();
+    writer.Key("rpak");
+    writer.String(manifest.rpakName.c_str());
+    writer.Key("patch");
+    writer.Uint(manifest.patchNum);
+    writer.Key("assets");
+    writer.StartArray();
+
+    for (auto& it : manifest.assetHashes)
+    {
+        char buf[32];
+
+        writer.StartObject();
+        writer.Key("guid");
+        snprintf(buf, sizeof(buf), "0x%016llX", (unsigned long long)it.first);
+        writer.String(buf);
+        writer.Key("hash");
+        snprintf(buf, sizeof(buf), "0x%016llX", (unsigned long long)it.second);
+        writer.String(buf);
+        writer.EndObject();
+    }
+
+    writer.EndArray();
+    writer.EndObject();
+
+    std::ofstream out(path, std::ios::binary);
+
+    if (!out.is_open())
+    {
+        Error("failed to write release manifest '%s'\n", path.c_str());
+        return false;
+    }
+
+    out.write(json.GetString(), json.GetSize());
+
+    return !out.fail();
+}
+
+// purpose: get the name of a patch of an rpak
+// returns: rpak name with the patch number appended, e.g. "common(01)"
+std::string RePak::GetPatchRPakName(const std::string& sRpakName, uint32_t patchNum)
+{
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "(%02u)", patchNum);
+
+    return sRpakName + suffix;
+}
+
+// purpose: write a patch of an rpak, holding every asset of the map's build
+// a patch is a complete rpak, so that the engine can load it in place of the base rpak once a Ptch asset gives the rpak its patch number,
+// and PatchIndex in its header stays 0 since it doesn't patch the data of an earlier file.
+// assets that haven't changed since the base rpak are copied out of it, and their streamed data is left in the base rpak's starpaks.
+// only the streamed data of new and changed assets goes into the patch's own starpak, which is what keeps a patch small
+// returns: true on success
+static bool WritePatchRPak(AssetGraph& assetGraph, const std::vector<BuildStateMark_t>& marks, std::vector<RPakAssetEntryV8>& assetEntries,
+    std::vector<bool>& changed, const std::string& sBasePath, const std::string& sOutputDir, const std::string& sPatchName, const std::string& suffix,
+    MapBuildResult_t& result)
+{
+    RPakFile_t base{};
+
+    if (!RePak::ReadRPakFile(sBasePath, base))
+    {
+        Error("patches are written on top of the base rpak, which has to be a single rpak in the output directory\n");
+        return false;
+    }
+
+    const std::vector<uint32_t>& buildOrder = assetGraph.GetBuildOrder();
+    const size_t positionCount = marks.size() - 1;
+
+    // take every asset's record while the map's build context is still current
+    std::vector<AssetRecord_t> records(positionCount);
+    std::vector<bool> hasRecord(positionCount, false);
+
+    for (size_t i = 0; i < positionCount; ++i)
+    {
+        // handlers can skip assets
+        if (marks[i].assetCount == marks[i + 1].assetCount)
+            continue;
+
+        uint32_t baseIdx = 0;
+
+        // assets that can't be copied out of the base rpak are written as if they had changed
+        if (!changed[i])
+        {
+            changed[i] = !RePak::GetAssetByGuid(&base.assets, assetEntries[marks[i].assetCount].GUID, &baseIdx)
+                || !RePak::ExtractAssetRecord(base, baseIdx, records[i]);
+        }
+
+        if (changed[i])
+        {
+            if (!RePak::CaptureAssetRecord(marks[i], marks[i + 1], assetEntries, records[i]))
+            {
+                Error("asset '%s' can't be relocated, so it can't be written to a patch\n", (*assetGraph.GetNode(buildOrder[i]).mapEntry)["path"].GetString());
+                return false;
+            }
+
+            RePak::SetStarpakSuffix(records[i].starpakPaths, suffix);
+        }
+
+        hasRecord[i] = true;
+    }
+
+    RPakBuildContext_t pakCtx{};
+    pakCtx.CopyOptions(*g_pBuildContext);
+
+    BuildContextScope ctxScope(pakCtx);
+
+    // the patch's own starpak comes first, so that a stable layout only moves the data that is in it (see RePak::ApplyStableLayout).
+    // the base rpak's assets are moved over to the index that their starpak gets after it
+    for (size_t i = 0; i < positionCount; ++i)
+    {
+        if (changed[i] && !records[i].starpakBlocks.empty())
+            RePak::AddStarpakReference(records[i].starpakPaths[0]);
+    }
+
+    if (pakCtx.starpakPaths.size() > 1)
+    {
+        Error("the new and changed assets of patch %s.rpak use more than one starpak\n", sPatchName.c_str());
+        return false;
+    }
+
+    const size_t nPatchStarpakCount = pakCtx.starpakPaths.size();
+
+    for (auto& it : base.starpakPaths)
+        pakCtx.starpakPaths.push_back(it);
+
+    pakCtx.optStarpakPaths = base.optStarpakPaths;
+
+    std::vector<RPakAssetEntryV8> pakEntries{};
+    std::vector<BuildStateMark_t> pakMarks{};
+
+    for (size_t i = 0; i < positionCount; ++i)
+    {
+        pakMarks.push_back(RePak::MarkBuildState(pakEntries));
+
+        if (!hasRecord[i])
+            continue;
+
+        RePak::SpliceAssetRecord(records[i], pakEntries);
+
+        RPakAssetEntryV8& asset = pakEntries.back();
+
+        if (!changed[i] && asset.StarpakOffset != (uint64_t)-1)
+            asset.StarpakOffset += nPatchStarpakCount;
+
+        records[i] = {};
+    }
+
+    pakMarks.push_back(RePak::MarkBuildState(pakEntries));
+
+    // the asset graph's asset indices are those of the map's build, not this pak's
+    if (!RePak::FinalizeLayout(nullptr, pakMarks, pakEntries))
+        return false;
+
+    RPakFileHeaderV8 rpakHeader{ };
+    rpakHeader.CreatedTime = RePak::GetCreatedTime();
+
+    if (!RePak::WriteRPakFile(sOutputDir + sPatchName + ".rpak", rpakHeader, pakEntries))
+        return false;
+
+    result.rpakName = sPatchName;
+    result.assetCount = pakEntries.size();
+    result.rpakSize = rpakHeader.DecompressedSize;
+
+    if (nPatchStarpakCount)
+    {
+        if (!RePak::WriteStarpakFile(sOutputDir + std::filesystem::path(pakCtx.starpakPaths[0]).filename().u8string()))
+            return false;
+
+        result.starpakSize = pakCtx.starpakEntries.back().offset + pakCtx.starpakEntries.back().dataSize;
+    }
+
+    return true;
+}
+
+// purpose: write a map's build as the next release of an rpak
+// the first build is written as the base rpak. every build after it is compared against the base rpak's manifest,
+// and written as a patch rpak and starpak with the next patch number (see WritePatchRPak).
+// each patch holds every change since the base rpak rather than only the changes since the last patch,
+// and the manifest keeps the base rpak's hashes with the number of the last patch, which a Ptch asset can read from it
+// returns: true on success
+bool RePak::WritePatchMapOutput(AssetGraph& assetGraph, const std::vector<BuildStateMark_t>& marks, std::vector<RPakAssetEntryV8>& assetEntries,
+    const PakBudget_t& budget, const std::string& sManifestPath, const std::string& sOutputDir, const std::string& sRpakName, MapBuildResult_t& result)
+{
+    // assets have to be hashed before the descriptors are finalised, since the records are captured from the build state
+    ReleaseManifest_t release{};
+    release.rpakName = sRpakName;
+
+    std::vector<uint64_t> positionGuids(marks.size() - 1, 0);
+    std::vector<uint64_t> positionHashes(marks.size() - 1, 0);
+
+    for (size_t i = 0; i + 1 < marks.size(); ++i)
+    {
+        if (marks[i].assetCount == marks[i + 1].assetCount)
+            continue;
+
+        AssetRecord_t record{};
+
+        positionGuids[i] = assetEntries[marks[i].assetCount].GUID;
+
+        // assets that can't be captured are treated as changed in every release
+        if (RePak::CaptureAssetRecord(marks[i], marks[i + 1], assetEntries, record))
+            positionHashes[i] = RePak::HashAssetRecord(record);
+
+        release.assetHashes[positionGuids[i]] = positionHashes[i];
+    }
+
+    if (!FILE_EXISTS(sManifestPath))
+    {
+        Log("no release manifest found, writing base rpak\n");
+
+        if (!RePak::WriteBudgetedMapOutput(assetGraph, marks, assetEntries, budget, sOutputDir, sRpakName, result))
+            return false;
+
+        return RePak::WriteReleaseManifest(sManifestPath, release);
+    }
+
+    ReleaseManifest_t base{};
+
+    if (!RePak::ReadReleaseManifest(sManifestPath, base))
+        return false;
+
+    std::vector<bool> changed(positionGuids.size(), false);
+    size_t nChangedCount = 0;
+
+    for (size_t i = 0; i < positionGuids.size(); ++i)
+    {
+        if (!positionGuids[i])
+            continue;
+
+        auto it = base.assetHashes.find(positionGuids[i]);
+
+        changed[i] = it == base.assetHashes.end() || it->second != positionHashes[i] || positionHashes[i] == 0;
+        nChangedCount += changed[i];
+    }
+
+    size_t nRemovedCount = 0;
+
+    for (auto& it : base.assetHashes)
+        nRemovedCount += !release.assetHashes.count(it.first);
+
+    result.rpakName = sRpakName;
+
+    if (nChangedCount == 0 && nRemovedCount == 0)
+    {
+        Log("no assets have changed since the base %s.rpak, not writing a patch\n", sRpakName.c_str());
+        return true;
+    }
+
+    release.patchNum = base.patchNum + 1;
+
+    if (release.patchNum > MAX_PATCH_NUMBER)
+    {
+        Error("%s.rpak already has %u patches, which is the most that a patch rpak name can have\n", sRpakName.c_str(), MAX_PATCH_NUMBER);
+        return false;
+    }
+
+    std::string sPatchName = RePak::GetPatchRPakName(sRpakName, release.patchNum);
+
+    Log("writing patch %s.rpak with %zu new or changed and %zu removed asset(s) of %zu\n", sPatchName.c_str(), nChangedCount, nRemovedCount, release.assetHashes.size());
+
+    std::filesystem::create_directories(sOutputDir);
+
+    if (!WritePatchRPak(assetGraph, marks, assetEntries, changed, sOutputDir + sRpakName + ".rpak", sOutputDir, sPatchName,
+        sPatchName.substr(sRpakName.length()), result))
+        return false;
+
+    // only the patch number moves forward, so the next patch is compared against the base rpak as well
+    release.assetHashes = std::move(base.assetHashes);
+
+    return RePak::WriteReleaseManifest(sManifestPath, release);
+}
@@ -0,0 +1,182 @@
+#include "pch.h"
+#include "Assets.h"
+#include "BuildCache.h"
+#include "SharedBuildState.h"
+#include "PakBudget.h"
+#include <chrono>
+#include <unordered_set>
+
+// totals of every asset of one type in a plan
+struct PlannedAssetType_t
+{
+    size_t assetCount = 0;
+    size_t pageCount = 0;
+    uint64_t pageDataSize = 0;
+    uint64_t starpakSize = 0;
+};
+
+// purpose: get the "$type" string of an asset type
+// returns: type name, e.g. "txtr"
+static std::string GetAssetTypeName(uint32_t mapType)
+{
+    char name[sizeof(mapType) + 1]{};
+    memcpy(name, &mapType, sizeof(mapType));
+
+    return name;
+}
+
+// purpose: estimate the layout of the rpak and starpak that a map file would build, without building it
+// every asset is planned by its handler from the map file entry and the headers of its source files (see AssetTypeHandler_t::PlanAsset),
+// the planned pages go through the same segment allocator as a real build, and starpak data is placed the same way.
+// the report says whether the rpak stays within the engine limits and the map's pak budget, and would otherwise be split
+// returns: exit code
+int RePak::PlanMapFile(const char* mapFile)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::filesystem::path mapPath(mapFile);
+
+    std::vector<char> mapBuf{ };
+    rapidjson::Document doc{ };
+
+    if (!RePak::LoadMapFile(mapPath, mapBuf, doc))
+        return EXIT_FAILURE;
+
+    std::string sRpakName = RePak::GetRPakName(doc);
+    PakBudget_t budget = RePak::GetPakBudget(doc);
+
+    RePak::SetAssetsDir(doc, mapPath);
+
+    if (!doc.HasMember("files") || !doc["files"].IsArray())
+    {
+        Error("map file doesn't have a 'files' array\n");
+        return EXIT_FAILURE;
+    }
+
+    RPakBuildContext_t* ctx = g_pBuildContext;
+
+    std::map<uint32_t, PlannedAssetType_t> types{};
+    std::unordered_set<uint64_t> guids{};
+    std::vector<std::string> unplannedAssets{};
+    PakStats_t stats{};
+    size_t nSkippedCount = 0;
+    size_t nStarpakBlockCount = 0;
+
+    for (auto& file : doc["files"].GetArray())
+    {
+        rapidjson::Value::MemberIterator typeIt = file.FindMember("$type");
+        rapidjson::Value::MemberIterator pathIt = file.FindMember("path");
+
+        if (typeIt == file.MemberEnd() || pathIt == file.MemberEnd() || !pathIt->value.IsString())
+        {
+            Warning("Map file entry is missing a '$type' or 'path' field. Skipping asset...\n");
+            continue;
+        }
+
+        const char* assetPath = pathIt->value.GetString();
+        const AssetTypeHandler_t* handler = Assets::GetAssetTypeHandler(RePak::GetAssetTypeFourCC(typeIt->value));
+
+        if (!handler)
+        {
+            Warning("Unknown asset type for map file entry '%s'. Skipping asset...\n", assetPath);
+            continue;
+        }
+
+        if (!guids.insert(RePak::GetAssetGuid(handler, assetPath, file)).second)
+        {
+            Warning("Asset '%s' has the same guid as an asset that was already defined in the map file. Skipping asset...\n", assetPath);
+            continue;
+        }
+
+        if (!handler->PlanAsset)
+        {
+            unplannedAssets.push_back(assetPath);
+            continue;
+        }
+
+        AssetPlan_t plan{};
+
+        if (!handler->PlanAsset(assetPath, file, plan))
+        {
+            nSkippedCount++;
+            continue;
+        }
+
+        PlannedAssetType_t& type = types[handler->mapType];
+        type.assetCount++;
+        type.pageCount += plan.pages.size();
+
+        for (auto& it : plan.pages)
+        {
+            RPakVirtualSegment seg{};
+            RePak::CreateNewSegment(it.size, it.flags, it.alignment, seg, it.vsegAlignment);
+
+            type.pageDataSize += it.size;
+            stats.pageDataSize += it.size;
+        }
+
+        // starpak data is padded the same way as in RePak::AddStarpakDataEntry, which adds a whole block to data that is already aligned
+        for (uint64_t size : plan.starpakBlockSizes)
+        {
+            uint64_t paddedSize = (size & ~4095ull) + 4096;
+
+            ctx->nextStarpakOffset += paddedSize;
+            type.starpakSize += paddedSize;
+            stats.starpakSize += paddedSize;
+            nStarpakBlockCount++;
+        }
+
+        stats.assetCount++;
+        stats.descriptorCount += plan.descriptorCount;
+        stats.guidDescriptorCount += plan.guidDescriptorCount;
+    }
+
+    stats.pageCount = ctx->pages.size();
+
+    for (auto& it : ctx->segments)
+        stats.segmentKeys.push_back((uint64_t)it.DataFlag << 32 | it.SomeType);
+
+    Log("\nlayout plan for %s.rpak\n\n", sRpakName.c_str());
+
+    Log("%-6s %8s %8s %14s %14s\n", "type", "assets", "pages", "page data", "starpak data");
+
+    for (auto& it : types)
+    {
+        Log("%-6s %8zu %8zu %14" PRIu64 " %14" PRIu64 "\n", GetAssetTypeName(it.first).c_str(), it.second.assetCount, it.second.pageCount,
+            it.second.pageDataSize, it.second.starpakSize);
+    }
+
+    Log("\nsegments:\n");
+
+    for (size_t i = 0; i < ctx->segments.size(); ++i)
+    {
+        const RPakVirtualSegment& seg = ctx->segments[i];
+        Log("  %2zu: flags 0x%02x, alignment %3u, %" PRIu64 " bytes\n", i, seg.DataFlag, seg.SomeType, (uint64_t)seg.DataSize);
+    }
+
+    Log("\n");
+    Log("assets:           %zu\n", stats.assetCount);
+    Log("pages:            %zu (limit %zu)\n", stats.pageCount, budget.maxPageCount);
+    Log("segments:         %zu (limit %zu)\n", ctx->segments.size(), budget.maxSegmentCount);
+    Log("descriptors:      %zu\n", stats.descriptorCount);
+    Log("guid descriptors: at most %zu\n", stats.guidDescriptorCount);
+    Log("rpak size:        about %" PRIu64 " bytes\n", stats.GetPakSize());
+
+    if (stats.starpakSize)
+        Log("starpak size:     %" PRIu64 " bytes\n", ctx->nextStarpakOffset + nStarpakBlockCount * sizeof(SRPkFileEntry) + sizeof(uint64_t));
+
+    if (!unplannedAssets.empty())
+        Warning("%zu asset(s) of types that can't be planned are not included, starting with '%s'\n", unplannedAssets.size(), unplannedAssets[0].c_str());
+
+    if (nSkippedCount)
+        Warning("%zu asset(s) would be skipped by the build\n", nSkippedCount);
+
+    if (const char* limit = RePak::CheckPakBudget(stats, budget))
+        Warning("the rpak exceeds the %s limit and would be split into several rpaks\n", limit);
+    else
+        Log("the rpak stays within its limits\n");
+
+    Log("planned in %lld ms\n", (long long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,153 @@
+#include "pch.h"
+#include "BuildCache.h"
+#include "SharedBuildState.h"
+#include "ShardBuild.h"
+#include <chrono>
+
+// purpose: read the reproducible build option of the map into the build context
+// reproducible builds always use the stable layout, so the tables don't depend on the order of the map file either
+void RePak::SetReproducibleOptions(rapidjson::Document& doc)
+{
+    if (doc.HasMember("reproducible") && doc["reproducible"].IsBool() && doc["reproducible"].GetBool())
+        g_pBuildContext->bReproducible = true;
+
+    if (g_pBuildContext->bReproducible)
+        g_pBuildContext->bStableLayout = true;
+}
+
+// purpose: get the creation time to write into the rpak header
+// reproducible builds take it from SOURCE_DATE_EPOCH (seconds since 1970) when it is set, and from the hash of the map file otherwise
+// returns: creation time as FILETIME
+uint64_t RePak::GetCreatedTime()
+{
+    if (!g_pBuildContext->bReproducible)
+    {
+        FILETIME ft = Utils::GetFileTimeBySystem();
+        return static_cast<uint64_t>(ft.dwHighDateTime) << 32 | ft.dwLowDateTime;
+    }
+
+    char epoch[32];
+    DWORD epochLength = GetEnvironmentVariableA("SOURCE_DATE_EPOCH", epoch, sizeof(epoch));
+
+    if (epochLength > 0 && epochLength < sizeof(epoch))
+        return strtoull(epoch, nullptr, 10) * 10000000 + FILETIME_UNIX_EPOCH;
+
+    // FILETIME is signed
+    return g_pBuildContext->inputHash & INT64_MAX;
+}
+
+// purpose: hash every file in a directory
+// returns: hash of each file, keyed by file name
+static std::map<std::string, uint64_t> HashOutputFiles(const std::string& dir)
+{
+    std::map<std::string, uint64_t> hashes{};
+    std::error_code ec;
+
+    for (auto& it : std::filesystem::directory_iterator(dir, ec))
+    {
+        if (it.is_regular_file())
+            hashes[it.path().filename().u8string()] = Utils::HashFile(it.path().u8string());
+    }
+
+    return hashes;
+}
+
+// purpose: build a map twice as a reproducible build and check that both builds write the same files
+// with a shard count, the second build is a sharded build, so that it is also checked against the single process build.
+// each build is written to its own temporary directory, so files left over from an earlier build can't match by accident,
+// and the build cache isn't used, so that the second build runs every handler again instead of loading what the first one stored
+// returns: exit code
+int RePak::VerifyReproducibleBuild(const char* mapFile, uint32_t shardCount)
+{
+    std::vector<char> mapBuf{ };
+    rapidjson::Document doc{ };
+    std::filesystem::path mapPath(mapFile);
+
+    if (!RePak::LoadMapFile(mapPath, mapBuf, doc))
+        return EXIT_FAILURE;
+
+    if (doc.HasMember("patchManifest"))
+    {
+        Error("patch builds change their release manifest on every build, so they can't be checked for reproducibility\n");
+        return EXIT_FAILURE;
+    }
+
+    // the directories are named after the map and the time, so that checks running at the same time don't share them
+    std::string sMapPath = Utils::NormalisePath(mapPath);
+    uint64_t tempHash = Utils::HashData(sMapPath.data(), sMapPath.size());
+    int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+    tempHash = Utils::HashData(&now, sizeof(now), tempHash);
+
+    std::map<std::string, uint64_t> hashes[2];
+
+    for (int i = 0; i < 2; ++i)
+    {
+        std::error_code ec;
+        std::filesystem::path tempDir = std::filesystem::temp_directory_path(ec) / ("repak_repro_" + std::to_string(tempHash) + "_" + std::to_string(i));
+
+        std::filesystem::remove_all(tempDir, ec);
+
+        RPakBuildContext_t ctx{ };
+        ctx.bReproducible = true;
+        ctx.bNoBuildCache = true;
+        ctx.pShared = g_pBuildContext->pShared;
+        ctx.memoryFiles = g_pBuildContext->memoryFiles;
+        ctx.outputDir = tempDir.u8string();
+
+        // ensure that the path has a slash at the end
+        Utils::AppendSlash(ctx.outputDir);
+
+        BuildContextScope ctxScope(ctx);
+
+        bool bSharded = i == 1 && shardCount > 0;
+        MapBuildResult_t result{ };
+
+        Log("reproducibility check: %s build %i of 2\n\n", bSharded ? "sharded" : "single process", i + 1);
+
+        bool bBuilt = bSharded ? RePak::BuildMapFileSharded(mapFile, shardCount) == EXIT_SUCCESS : RePak::BuildMapFile(mapFile, false, result);
+
+        if (bBuilt)
+            hashes[i] = HashOutputFiles(ctx.outputDir);
+
+        std::filesystem::remove_all(tempDir, ec);
+
+        if (!bBuilt)
+            return EXIT_FAILURE;
+    }
+
+    size_t nDifferentCount = 0;
+
+    for (auto& it : hashes[0])
+    {
+        auto other = hashes[1].find(it.first);
+
+        if (other == hashes[1].end())
+        {
+            Warning("%s was only written by the first build\n", it.first.c_str());
+            nDifferentCount++;
+        }
+        else if (other->second != it.second)
+        {
+            Warning("%s differs between the builds (%" PRIx64 ", %" PRIx64 ")\n", it.first.c_str(), it.second, other->second);
+            nDifferentCount++;
+        }
+    }
+
+    for (auto& it : hashes[1])
+    {
+        if (!hashes[0].count(it.first))
+        {
+            Warning("%s was only written by the second build\n", it.first.c_str());
+            nDifferentCount++;
+        }
+    }
+
+    if (nDifferentCount)
+    {
+        Error("build is not reproducible, %zu file(s) differ\n", nDifferentCount);
+        return EXIT_FAILURE;
+    }
+
+    Log("build is reproducible, %zu file(s) match\n", hashes[0].size());
+    return EXIT_SUCCESS;
+}
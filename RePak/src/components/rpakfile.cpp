@@ -0,0 +1,173 @@
+#include "pch.h"
+#include "Assets.h"
+#include "BuildCache.h"
+#include "RPakFile.h"
+
+// purpose: read an rpak and all of its tables
+// returns: true on success
+bool RePak::ReadRPakFile(const std::string& path, RPakFile_t& pak)
+{
+    std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+
+    if (!ifs.is_open())
+    {
+        Error("couldn't open rpak '%s'\n", path.c_str());
+        return false;
+    }
+
+    size_t fileSize = ifs.tellg();
+    pak = {};
+    pak.fileData.resize(fileSize);
+
+    ifs.seekg(0);
+    ifs.read((char*)pak.fileData.data(), fileSize);
+    ifs.close();
+
+    BinaryReader buf(pak.fileData.data(), fileSize);
+
+    try
+    {
+        pak.header = buf.read<RPakFileHeaderV8>();
+        RPakFileHeaderV8& header = pak.header;
+
+        if (header.Magic != RPakFileHeaderV8{}.Magic || header.Version != 8)
+        {
+            Error("'%s' is not a version 8 rpak\n", path.c_str());
+            return false;
+        }
+
+        if (header.CompressedSize != header.DecompressedSize || header.DecompressedSize != fileSize)
+        {
+            Error("rpak '%s' is compressed or truncated, which isn't supported\n", path.c_str());
+            return false;
+        }
+
+        buf.readStrings(header.StarpakReferenceSize, pak.starpakPaths);
+        buf.readStrings(header.StarpakOptReferenceSize, pak.optStarpakPaths);
+
+        buf.readVector(pak.segments, header.VirtualSegmentCount);
+        buf.readVector(pak.pages, header.PageCount);
+        buf.readVector(pak.descriptors, header.DescriptorCount);
+        buf.readVector(pak.assets, header.AssetEntryCount);
+        buf.readVector(pak.guidDescriptors, header.GuidDescriptorCount);
+        buf.readVector(pak.relations, header.RelationsCount);
+    }
+    catch (const char* err)
+    {
+        Error("failed to read rpak '%s': %s\n", path.c_str(), err);
+        return false;
+    }
+
+    // page data follows the tables in page order
+    size_t pageOffset = buf.tell();
+
+    for (auto& it : pak.pages)
+    {
+        if (it.VSegIdx >= pak.segments.size())
+        {
+            Error("rpak '%s' has a page in segment %u, but only %zu segments\n", path.c_str(), it.VSegIdx, pak.segments.size());
+            return false;
+        }
+
+        pak.pageOffsets.push_back(pageOffset);
+        pageOffset += it.DataSize;
+    }
+
+    if (pageOffset > fileSize)
+    {
+        Error("rpak '%s' page data runs past the end of the file\n", path.c_str());
+        return false;
+    }
+
+    pak.pageOwners.resize(pak.pages.size(), PAGE_OWNER_NONE);
+
+    for (uint32_t i = 0; i < pak.assets.size(); ++i)
+    {
+        const RPakAssetEntryV8& asset = pak.assets[i];
+
+        for (uint32_t j = asset.SubHeaderDataBlockIndex; j < asset.PageEnd && j < pak.pages.size(); ++j)
+            pak.pageOwners[j] = pak.pageOwners[j] == PAGE_OWNER_NONE ? i : PAGE_OWNER_SHARED;
+    }
+
+    return true;
+}
+
+// purpose: copy a single asset out of an rpak into a relocatable asset record
+// the asset has to be the only owner of every page from its subheader page up to PageEnd,
+// and every pointer on those pages has to stay within them, which is always the case for rpaks built by RePak
+// starpak data isn't copied, so the record's starpak offsets still point into the rpak's existing starpaks
+// returns: false if the asset can't be relocated
+bool RePak::ExtractAssetRecord(const RPakFile_t& pak, uint32_t assetIdx, AssetRecord_t& record)
+{
+    const RPakAssetEntryV8& asset = pak.assets[assetIdx];
+
+    const uint32_t firstPage = asset.SubHeaderDataBlockIndex;
+    const uint32_t pageEnd = asset.PageEnd;
+
+    if (firstPage >= pageEnd || pageEnd > pak.pages.size())
+        return false;
+
+    if (asset.RawDataBlockIndex != (uint32_t)-1 && (asset.RawDataBlockIndex < firstPage || asset.RawDataBlockIndex >= pageEnd))
+        return false;
+
+    record = {};
+
+    for (uint32_t i = firstPage; i < pageEnd; ++i)
+    {
+        if (pak.pageOwners[i] != assetIdx)
+            return false;
+
+        const RPakPageInfo& page = pak.pages[i];
+        const RPakVirtualSegment& seg = pak.segments[page.VSegIdx];
+        const uint8_t* data = pak.fileData.data() + pak.pageOffsets[i];
+
+        AssetRecordPage_t recPage{};
+        recPage.segFlags = seg.DataFlag;
+        recPage.segAlignment = seg.SomeType;
+        recPage.alignment = page.SomeType;
+        recPage.data.assign(data, data + page.DataSize);
+
+        record.pages.push_back(std::move(recPage));
+    }
+
+    for (auto desc : pak.descriptors)
+    {
+        if (desc.PageIdx < firstPage || desc.PageIdx >= pageEnd)
+            continue;
+
+        desc.PageIdx -= firstPage;
+
+        std::vector<uint8_t>& data = record.pages[desc.PageIdx].data;
+
+        if (desc.PageOffset + sizeof(RPakPtr) > data.size())
+            return false;
+
+        // make the pointer relative to the asset's first page
+        RPakPtr* ptr = reinterpret_cast<RPakPtr*>(data.data() + desc.PageOffset);
+
+        if (ptr->Index < firstPage || ptr->Index >= pageEnd)
+            return false;
+
+        ptr->Index -= firstPage;
+
+        record.descriptors.push_back(desc);
+    }
+
+    for (auto desc : pak.guidDescriptors)
+    {
+        if (desc.PageIdx < firstPage || desc.PageIdx >= pageEnd)
+            continue;
+
+        desc.PageIdx -= firstPage;
+        record.guidDescriptors.push_back(desc);
+    }
+
+    record.asset = asset;
+    record.asset.SubHeaderDataBlockIndex -= firstPage;
+    record.asset.PageEnd -= firstPage;
+
+    if (record.asset.RawDataBlockIndex != (uint32_t)-1)
+        record.asset.RawDataBlockIndex -= firstPage;
+
+    return true;
+}
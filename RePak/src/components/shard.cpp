@@ -0,0 +1,441 @@
+#include "pch.h"
+#include "Assets.h"
+#include "AssetGraph.h"
+#include "BuildCache.h"
+#include "SharedBuildState.h"
+#include "ShardBuild.h"
+
+//
+// a map file loaded for a sharded build
+// every process of the build loads the map the same way, so they all agree on the build order and on which shard builds which asset
+//
+struct ShardedMap_t
+{
+    std::vector<char> mapBuf;
+    rapidjson::Document doc;
+
+    std::string sRpakName;
+    std::string sOutputDir;
+    uint64_t mapHash = 0;
+
+    AssetGraph assetGraph;
+    std::vector<const AssetTypeHandler_t*> usedAssetTypes;
+
+    // index of the shard that builds each asset graph node
+    std::vector<uint32_t> nodeShards;
+};
+
+// purpose: estimate how much work building an asset is, from the size of its source files
+// returns: asset weight
+static uint64_t GetAssetWeight(AssetGraphNode_t& node)
+{
+    // assets without source files still have some cost
+    uint64_t weight = 1;
+
+    if (!node.handler->GetSourceFiles)
+        return weight;
+
+    std::vector<std::string> sourceFiles{};
+    node.handler->GetSourceFiles((*node.mapEntry)["path"].GetString(), *node.mapEntry, sourceFiles);
+
+    for (auto& it : sourceFiles)
+    {
+        std::error_code ec;
+        uintmax_t size = std::filesystem::file_size(it, ec);
+
+        if (!ec)
+            weight += size;
+    }
+
+    return weight;
+}
+
+// purpose: split the asset graph into shards
+// assets that are connected through references always end up in the same shard, since handlers need the assets they
+// reference to be in the same build. groups of connected assets are handed out heaviest first to the lightest shard
+static void AssignShards(ShardedMap_t& map, uint32_t shardCount)
+{
+    AssetGraph& graph = map.assetGraph;
+    const uint32_t nodeCount = graph.GetNodeCount();
+
+    // assets that are connected through references always have to be built together
+    std::vector<uint32_t> nodeGroups = graph.GetGroups();
+
+    struct AssetGroup_t
+    {
+        uint32_t rootIdx;
+        uint64_t weight;
+    };
+
+    std::vector<AssetGroup_t> groups{};
+    std::unordered_map<uint32_t, size_t> rootToGroup{};
+
+    for (uint32_t i = 0; i < nodeCount; ++i)
+    {
+        uint32_t root = nodeGroups[i];
+        auto it = rootToGroup.find(root);
+
+        if (it == rootToGroup.end())
+        {
+            it = rootToGroup.emplace(root, groups.size()).first;
+            groups.push_back({ root, 0 });
+        }
+
+        groups[it->second].weight += GetAssetWeight(graph.GetNode(i));
+    }
+
+    std::stable_sort(groups.begin(), groups.end(), [](const AssetGroup_t& a, const AssetGroup_t& b) { return a.weight > b.weight; });
+
+    std::vector<uint64_t> shardWeights(shardCount, 0);
+    std::unordered_map<uint32_t, uint32_t> rootToShard{};
+
+    for (auto& it : groups)
+    {
+        uint32_t shardIdx = std::min_element(shardWeights.begin(), shardWeights.end()) - shardWeights.begin();
+
+        shardWeights[shardIdx] += it.weight;
+        rootToShard[it.rootIdx] = shardIdx;
+    }
+
+    map.nodeShards.resize(nodeCount);
+
+    for (uint32_t i = 0; i < nodeCount; ++i)
+        map.nodeShards[i] = rootToShard[nodeGroups[i]];
+}
+
+// purpose: load a map file and work out which shard builds each of its assets
+// returns: true on success
+static bool LoadShardedMap(const char* mapFile, uint32_t shardCount, ShardedMap_t& map)
+{
+    std::filesystem::path mapPath(mapFile);
+
+    if (!RePak::LoadMapFile(mapPath, map.mapBuf, map.doc))
+        return false;
+
+    map.mapHash = Utils::HashFile(mapPath.u8string());
+    map.sRpakName = RePak::GetRPakName(map.doc);
+    map.sOutputDir = RePak::GetOutputDir(map.doc, mapPath);
+
+    RePak::SetAssetsDir(map.doc, mapPath);
+    RePak::SetLayoutOptions(map.doc);
+    RePak::SetReproducibleOptions(map.doc);
+    RePak::SetOutputOptions(map.doc);
+
+    map.assetGraph.AddMapFileEntries(map.doc["files"], map.usedAssetTypes);
+
+    if (!map.assetGraph.Resolve())
+    {
+        Error("failed to resolve asset dependencies. Exiting...\n");
+        return false;
+    }
+
+    if (!RePak::SetLoadOrder(map.doc, mapPath, map.assetGraph))
+        return false;
+
+    AssignShards(map, shardCount);
+    return true;
+}
+
+// purpose: build the assets of one shard of a map file into a shard file
+// assets are built in the same order as in a normal build, and stored as relocatable asset records so that
+// the shards can be linked into the exact rpak that a normal build would produce
+// returns: true on success
+bool RePak::BuildShard(const char* mapFile, uint32_t shardIdx, uint32_t shardCount, const char* shardFile)
+{
+    if (shardIdx >= shardCount)
+    {
+        Error("shard index %u is out of range for %u shards\n", shardIdx, shardCount);
+        return false;
+    }
+
+    ShardedMap_t map{};
+
+    if (!LoadShardedMap(mapFile, shardCount, map))
+        return false;
+
+    BufferedWriter out{};
+
+    if (!out.open(shardFile))
+    {
+        Error("failed to open shard file '%s'\n", shardFile);
+        return false;
+    }
+
+    ShardFileHeader_t hdr{ SHARD_FILE_MAGIC, SHARD_FILE_VERSION, map.mapHash, (uint32_t)map.assetGraph.GetNodeCount(), shardIdx, shardCount };
+    out.write(hdr);
+
+    std::vector<RPakAssetEntryV8> assetEntries{ };
+    size_t nRecordCount = 0;
+    size_t nRebuildCount = 0;
+
+    for (auto& it : map.usedAssetTypes)
+    {
+        if (it->BeginBatch)
+            it->BeginBatch(&assetEntries);
+    }
+
+    for (uint32_t nodeIdx : map.assetGraph.GetBuildOrder())
+    {
+        if (map.nodeShards[nodeIdx] != shardIdx)
+            continue;
+
+        AssetGraphNode_t& node = map.assetGraph.GetNode(nodeIdx);
+        rapidjson::Value& file = *node.mapEntry;
+
+        BuildStateMark_t mark = RePak::MarkBuildState(assetEntries);
+
+        if (!node.handler->AddAsset(&assetEntries, file["path"].GetString(), file))
+            return false;
+
+        ShardAssetState state = ShardAssetState::SKIPPED;
+        AssetRecord_t record{ };
+
+        if (assetEntries.size() != mark.assetCount)
+        {
+            node.assetIdx = mark.assetCount;
+            state = RePak::CaptureAssetRecord(mark, assetEntries, record) ? ShardAssetState::RECORD : ShardAssetState::REBUILD;
+        }
+
+        out.write(nodeIdx);
+        out.write(state);
+
+        if (state == ShardAssetState::RECORD)
+        {
+            RePak::WriteAssetRecord(out, record);
+            nRecordCount++;
+        }
+        else if (state == ShardAssetState::REBUILD)
+        {
+            nRebuildCount++;
+        }
+    }
+
+    for (auto& it : map.usedAssetTypes)
+    {
+        if (it->EndBatch)
+            it->EndBatch(&assetEntries);
+    }
+
+    if (!out.close())
+    {
+        Error("failed to write shard file '%s'\n", shardFile);
+        return false;
+    }
+
+    Log("built shard %u of %u: %zu assets, %zu left to be built during linking\n", shardIdx + 1, shardCount, nRecordCount, nRebuildCount);
+    return true;
+}
+
+//
+// sequential reader for a shard file
+// shards store their assets in build order, so the linker only ever needs the next asset of each shard
+//
+struct ShardReader_t
+{
+    BinaryReader in;
+    std::string path;
+    uint32_t nextNodeIdx = -1;
+
+    // purpose: read the index of the next asset in the shard
+    void Advance()
+    {
+        if (in.remaining() < sizeof(nextNodeIdx))
+            nextNodeIdx = -1;
+        else
+            in.read(nextNodeIdx);
+    }
+};
+
+// purpose: link shard files into the rpak that a normal build of the map file would produce
+// the linker runs the whole build order again, but splices the shards' asset records instead of running asset handlers
+// returns: true on success
+bool RePak::LinkShards(const char* mapFile, const std::vector<std::string>& shardFiles, MapBuildResult_t& result)
+{
+    uint32_t shardCount = shardFiles.size();
+
+    if (shardCount == 0)
+    {
+        Error("no shard files given\n");
+        return false;
+    }
+
+    ShardedMap_t map{};
+
+    if (!LoadShardedMap(mapFile, shardCount, map))
+        return false;
+
+    // shards can be given in any order
+    std::vector<std::unique_ptr<ShardReader_t>> shards(shardCount);
+
+    for (auto& it : shardFiles)
+    {
+        std::unique_ptr<ShardReader_t> reader = std::make_unique<ShardReader_t>();
+        reader->path = it;
+
+        if (!reader->in.open(it))
+        {
+            Error("failed to open shard file '%s'\n", it.c_str());
+            return false;
+        }
+
+        ShardFileHeader_t hdr{};
+
+        if (reader->in.remaining() >= sizeof(hdr))
+            reader->in.read(hdr);
+
+        if (hdr.magic != SHARD_FILE_MAGIC || hdr.version != SHARD_FILE_VERSION)
+        {
+            Error("'%s' is not a shard file or was made by a different version of RePak\n", it.c_str());
+            return false;
+        }
+
+        if (hdr.mapHash != map.mapHash || hdr.nodeCount != map.assetGraph.GetNodeCount() || hdr.shardCount != shardCount)
+        {
+            Error("shard file '%s' was built from a different map file or shard count\n", it.c_str());
+            return false;
+        }
+
+        if (hdr.shardIdx >= shardCount || shards[hdr.shardIdx])
+        {
+            Error("shard file '%s' has a duplicate or invalid shard index %u\n", it.c_str(), hdr.shardIdx);
+            return false;
+        }
+
+        reader->Advance();
+        shards[hdr.shardIdx] = std::move(reader);
+    }
+
+    Log("linking rpak %s.rpak from %u shards\n\n", map.sRpakName.c_str(), shardCount);
+
+    std::vector<RPakAssetEntryV8> assetEntries{ };
+
+    for (auto& it : map.usedAssetTypes)
+    {
+        if (it->BeginBatch)
+            it->BeginBatch(&assetEntries);
+    }
+
+    std::vector<BuildStateMark_t> marks{ };
+
+    for (uint32_t nodeIdx : map.assetGraph.GetBuildOrder())
+    {
+        ShardReader_t& shard = *shards[map.nodeShards[nodeIdx]];
+
+        if (shard.nextNodeIdx != nodeIdx)
+        {
+            Error("shard file '%s' doesn't contain the assets it should (expected asset %u, found %u)\n", shard.path.c_str(), nodeIdx, shard.nextNodeIdx);
+            return false;
+        }
+
+        AssetGraphNode_t& node = map.assetGraph.GetNode(nodeIdx);
+        rapidjson::Value& file = *node.mapEntry;
+
+        if (shard.in.remaining() < sizeof(ShardAssetState))
+        {
+            Error("shard file '%s' is corrupt\n", shard.path.c_str());
+            return false;
+        }
+
+        ShardAssetState state = shard.in.read<ShardAssetState>();
+
+        marks.push_back(RePak::MarkBuildState(assetEntries));
+
+        if (state == ShardAssetState::RECORD)
+        {
+            AssetRecord_t record{ };
+
+            if (!RePak::ReadAssetRecord(shard.in, record))
+            {
+                Error("shard file '%s' is corrupt\n", shard.path.c_str());
+                return false;
+            }
+
+            node.assetIdx = RePak::SpliceAssetRecord(record, assetEntries);
+        }
+        else if (state == ShardAssetState::REBUILD)
+        {
+            size_t assetCount = assetEntries.size();
+
+            if (!node.handler->AddAsset(&assetEntries, file["path"].GetString(), file))
+                return false;
+
+            if (assetEntries.size() != assetCount)
+                node.assetIdx = assetCount;
+        }
+
+        shard.Advance();
+    }
+
+    marks.push_back(RePak::MarkBuildState(assetEntries));
+
+    for (auto& it : map.usedAssetTypes)
+    {
+        if (it->EndBatch)
+            it->EndBatch(&assetEntries);
+    }
+
+    // written the same way as a normal build, so that both give the same rpak
+    return RePak::WriteBuiltMap(map.doc, mapFile, map.assetGraph, marks, assetEntries, map.sOutputDir, map.sRpakName, result);
+}
+
+// purpose: build a map file with one process per shard, then link the shards in this process
+// returns: exit code
+int RePak::BuildMapFileSharded(const char* mapFile, uint32_t shardCount)
+{
+    std::vector<char> mapBuf{ };
+    rapidjson::Document doc{ };
+    std::filesystem::path mapPath(mapFile);
+
+    if (!RePak::LoadMapFile(mapPath, mapBuf, doc))
+        return EXIT_FAILURE;
+
+    std::string sOutputDir = RePak::GetOutputDir(doc, mapPath);
+    std::string sRpakName = RePak::GetRPakName(doc);
+
+    std::filesystem::create_directories(sOutputDir);
+
+    std::string exePath = Platform::GetExecutablePath();
+
+    std::vector<std::string> shardFiles{ };
+    std::vector<PlatformProcess_t> processes{ };
+
+    for (uint32_t i = 0; i < shardCount; ++i)
+    {
+        shardFiles.push_back(sOutputDir + sRpakName + "." + std::to_string(i) + ".rpshard");
+
+        // RePak build-shard <map file> <shard index> <shard count> <shard file>
+        std::vector<std::string> args{ "build-shard", mapPath.u8string(), std::to_string(i), std::to_string(shardCount), shardFiles.back() };
+        PlatformProcess_t process{ };
+
+        if (!Platform::StartProcess(exePath, args, process))
+        {
+            Error("failed to start the process for shard %u\n", i);
+            shardCount = i;
+            break;
+        }
+
+        processes.push_back(process);
+    }
+
+    bool bShardsBuilt = shardCount == processes.size() && shardCount != 0;
+
+    for (size_t i = 0; i < processes.size(); ++i)
+    {
+        if (Platform::WaitForProcess(processes[i]) != EXIT_SUCCESS)
+        {
+            Error("shard %zu failed to build\n", i);
+            bShardsBuilt = false;
+        }
+    }
+
+    MapBuildResult_t result{ };
+    bool bSuccess = bShardsBuilt && RePak::LinkShards(mapFile, shardFiles, result);
+
+    for (auto& it : shardFiles)
+    {
+        std::error_code ec;
+        std::filesystem::remove(it, ec);
+    }
+
+    return bSuccess ? EXIT_SUCCESS : EXIT_FAILURE;
+}
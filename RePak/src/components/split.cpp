@@ -0,0 +1,400 @@
+#include "pch.h"
+#include "Assets.h"
+#include "AssetGraph.h"
+#include "BuildCache.h"
+#include "SharedBuildState.h"
+#include "PakBudget.h"
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+
+void PakStats_t::Add(const PakStats_t& other)
+{
+    assetCount += other.assetCount;
+    pageCount += other.pageCount;
+    descriptorCount += other.descriptorCount;
+    guidDescriptorCount += other.guidDescriptorCount;
+    pageDataSize += other.pageDataSize;
+    starpakSize += other.starpakSize;
+
+    std::vector<uint64_t> keys{};
+    std::set_union(segmentKeys.begin(), segmentKeys.end(), other.segmentKeys.begin(), other.segmentKeys.end(), std::back_inserter(keys));
+    segmentKeys = std::move(keys);
+}
+
+// purpose: estimate the size of an rpak with these contents
+// relations aren't known until the pak is finished, so every guid descriptor is assumed to cause one
+// returns: rpak size in bytes
+uint64_t PakStats_t::GetPakSize() const
+{
+    uint64_t size = sizeof(RPakFileHeaderV8) + MAX_PATH * 2; // header and starpak paths
+    size += segmentKeys.size() * sizeof(RPakVirtualSegment);
+    size += pageCount * sizeof(RPakPageInfo);
+    size += descriptorCount * sizeof(RPakDescriptor);
+    size += assetCount * sizeof(RPakAssetEntryV8);
+    size += guidDescriptorCount * (sizeof(RPakGuidDescriptor) + sizeof(RPakRelationBlock));
+    size += pageDataSize;
+
+    return size;
+}
+
+// purpose: read the pak limits from the map file
+// the engine limits can only be lowered
+// returns: pak budget
+PakBudget_t RePak::GetPakBudget(rapidjson::Document& doc)
+{
+    PakBudget_t budget{};
+
+    if (doc.HasMember("maxPageCount") && doc["maxPageCount"].IsUint64())
+        budget.maxPageCount = min(doc["maxPageCount"].GetUint64(), (uint64_t)RPAK_MAX_PAGE_COUNT);
+
+    if (doc.HasMember("maxSegmentCount") && doc["maxSegmentCount"].IsUint64())
+        budget.maxSegmentCount = min(doc["maxSegmentCount"].GetUint64(), (uint64_t)RPAK_MAX_SEGMENT_COUNT);
+
+    // sizes are given in megabytes
+    if (doc.HasMember("maxPakSize") && doc["maxPakSize"].IsUint64())
+        budget.maxPakSize = doc["maxPakSize"].GetUint64() * 1024 * 1024;
+
+    if (doc.HasMember("maxStarpakSize") && doc["maxStarpakSize"].IsUint64())
+        budget.maxStarpakSize = doc["maxStarpakSize"].GetUint64() * 1024 * 1024;
+
+    return budget;
+}
+
+// purpose: get what everything added to the build state between two marks adds to an rpak
+// returns: stats of the range
+static PakStats_t GetBuildStats(const BuildStateMark_t& mark, const BuildStateMark_t& endMark)
+{
+    RPakBuildContext_t* ctx = g_pBuildContext;
+    PakStats_t stats{};
+
+    stats.assetCount = endMark.assetCount - mark.assetCount;
+    stats.pageCount = endMark.pageCount - mark.pageCount;
+    stats.descriptorCount = endMark.descriptorCount - mark.descriptorCount;
+    stats.guidDescriptorCount = endMark.guidDescriptorCount - mark.guidDescriptorCount;
+
+    for (size_t i = mark.pageCount; i < endMark.pageCount; ++i)
+    {
+        const RPakPageInfo& page = ctx->pages[i];
+        const RPakVirtualSegment& seg = ctx->segments[page.VSegIdx];
+
+        stats.pageDataSize += page.DataSize;
+        stats.segmentKeys.push_back((uint64_t)seg.DataFlag << 32 | seg.SomeType);
+    }
+
+    for (size_t i = mark.starpakEntryCount; i < endMark.starpakEntryCount; ++i)
+        stats.starpakSize += ctx->starpakEntries[i].dataSize;
+
+    std::sort(stats.segmentKeys.begin(), stats.segmentKeys.end());
+    stats.segmentKeys.erase(std::unique(stats.segmentKeys.begin(), stats.segmentKeys.end()), stats.segmentKeys.end());
+
+    return stats;
+}
+
+// purpose: check if an rpak with these contents stays within the budget
+// returns: nullptr if it does, otherwise the limit that is exceeded
+const char* RePak::CheckPakBudget(const PakStats_t& stats, const PakBudget_t& budget)
+{
+    if (stats.pageCount > budget.maxPageCount)
+        return "page count";
+
+    if (stats.segmentKeys.size() > budget.maxSegmentCount)
+        return "segment count";
+
+    if (budget.maxPakSize && stats.GetPakSize() > budget.maxPakSize)
+        return "rpak size";
+
+    if (budget.maxStarpakSize && stats.starpakSize + 0x1000 > budget.maxStarpakSize)
+        return "starpak size";
+
+    return nullptr;
+}
+
+// purpose: check the whole build state against the budget, for writers that can only write it as a single rpak
+// returns: false if the rpak would exceed a limit, in which case it must not be written
+bool RePak::CheckBuildBudget(std::vector<RPakAssetEntryV8>& assetEntries, const PakBudget_t& budget)
+{
+    const char* limit = RePak::CheckPakBudget(GetBuildStats(BuildStateMark_t{}, RePak::MarkBuildState(assetEntries)), budget);
+
+    if (limit)
+    {
+        Error("rpak exceeds the %s limit. only a normal build of a map can split it into several rpaks\n", limit);
+        return false;
+    }
+
+    return true;
+}
+
+// purpose: add a suffix to the file name of every starpak path, so that the starpaks of split rpaks and patches don't overwrite each other
+void RePak::SetStarpakSuffix(std::vector<std::string>& starpakPaths, const std::string& suffix)
+{
+    for (auto& it : starpakPaths)
+    {
+        std::filesystem::path path(it);
+        it = (path.parent_path() / (path.stem().u8string() + suffix + path.extension().u8string())).generic_u8string();
+    }
+}
+
+struct SplitPak_t
+{
+    PakStats_t stats;
+
+    // positions in the build order of the assets in the pak
+    std::vector<size_t> positions;
+};
+
+// purpose: split the built assets of a map into rpaks that each fit in the budget
+// assets that reference each other are kept in the same rpak. groups of them are added to the current rpak in build order,
+// and a new rpak is started whenever the next group doesn't fit
+// returns: false if a single group of assets doesn't fit in the budget
+static bool PlanSplitPaks(AssetGraph& assetGraph, const std::vector<BuildStateMark_t>& marks, const PakBudget_t& budget, std::vector<SplitPak_t>& paks)
+{
+    const std::vector<uint32_t>& buildOrder = assetGraph.GetBuildOrder();
+    std::vector<uint32_t> nodeGroups = assetGraph.GetGroups();
+
+    std::vector<SplitPak_t> groups{};
+    std::unordered_map<uint32_t, size_t> rootToGroup{};
+
+    for (size_t i = 0; i < buildOrder.size(); ++i)
+    {
+        auto it = rootToGroup.find(nodeGroups[buildOrder[i]]);
+
+        if (it == rootToGroup.end())
+        {
+            it = rootToGroup.emplace(nodeGroups[buildOrder[i]], groups.size()).first;
+            groups.emplace_back();
+        }
+
+        SplitPak_t& group = groups[it->second];
+        group.stats.Add(GetBuildStats(marks[i], marks[i + 1]));
+        group.positions.push_back(i);
+    }
+
+    for (auto& group : groups)
+    {
+        if (const char* limit = RePak::CheckPakBudget(group.stats, budget))
+        {
+            Error("asset '%s' and the assets connected to it exceed the %s limit on their own\n",
+                (*assetGraph.GetNode(buildOrder[group.positions[0]]).mapEntry)["path"].GetString(), limit);
+            return false;
+        }
+
+        if (!paks.empty())
+        {
+            PakStats_t combined = paks.back().stats;
+            combined.Add(group.stats);
+
+            if (!RePak::CheckPakBudget(combined, budget))
+            {
+                paks.back().stats = std::move(combined);
+                paks.back().positions.insert(paks.back().positions.end(), group.positions.begin(), group.positions.end());
+                continue;
+            }
+        }
+
+        paks.push_back(std::move(group));
+    }
+
+    // keep the build order within each pak
+    for (auto& it : paks)
+        std::sort(it.positions.begin(), it.positions.end());
+
+    return true;
+}
+
+// purpose: write some of the built assets of a map as their own rpak
+// the rpak is built in a new build context from asset records of the map's build. assets that can't be relocated are built again
+// returns: true on success
+bool RePak::WritePartialMapOutput(AssetGraph& assetGraph, const std::vector<BuildStateMark_t>& marks, std::vector<RPakAssetEntryV8>& assetEntries,
+    const std::vector<size_t>& positions, const std::string& sOutputDir, const std::string& sPakName, const std::string& starpakSuffix, PartialPakOutput_t& output)
+{
+    RPakBuildContext_t* mapCtx = g_pBuildContext;
+    const std::vector<uint32_t>& buildOrder = assetGraph.GetBuildOrder();
+
+    // capture the pak's assets while the map's build context is still current
+    std::vector<AssetRecord_t> records(positions.size());
+    std::vector<bool> captured(positions.size(), false);
+
+    for (size_t i = 0; i < positions.size(); ++i)
+        captured[i] = RePak::CaptureAssetRecord(marks[positions[i]], marks[positions[i] + 1], assetEntries, records[i]);
+
+    RPakBuildContext_t pakCtx{};
+    pakCtx.CopyOptions(*mapCtx);
+
+    BuildContextScope ctxScope(pakCtx);
+
+    std::vector<RPakAssetEntryV8> pakEntries{};
+    std::vector<const AssetTypeHandler_t*> pakAssetTypes{};
+
+    for (size_t position : positions)
+    {
+        const AssetTypeHandler_t* handler = assetGraph.GetNode(buildOrder[position]).handler;
+
+        if (std::find(pakAssetTypes.begin(), pakAssetTypes.end(), handler) == pakAssetTypes.end())
+            pakAssetTypes.push_back(handler);
+    }
+
+    for (auto& it : pakAssetTypes)
+    {
+        if (it->BeginBatch)
+            it->BeginBatch(&pakEntries);
+    }
+
+    std::vector<BuildStateMark_t> pakMarks{};
+    bool bBuilt = true;
+
+    for (size_t i = 0; i < positions.size(); ++i)
+    {
+        pakMarks.push_back(RePak::MarkBuildState(pakEntries));
+
+        // handlers can skip assets
+        if (marks[positions[i]].assetCount == marks[positions[i] + 1].assetCount)
+            continue;
+
+        if (captured[i])
+        {
+            RePak::SpliceAssetRecord(records[i], pakEntries);
+            records[i] = {};
+            continue;
+        }
+
+        AssetGraphNode_t& node = assetGraph.GetNode(buildOrder[positions[i]]);
+
+        if (!node.handler->AddAsset(&pakEntries, (*node.mapEntry)["path"].GetString(), *node.mapEntry))
+        {
+            bBuilt = false;
+            break;
+        }
+    }
+
+    pakMarks.push_back(RePak::MarkBuildState(pakEntries));
+
+    for (auto& it : pakAssetTypes)
+    {
+        if (it->EndBatch)
+            it->EndBatch(&pakEntries);
+    }
+
+    if (!bBuilt)
+        return false;
+
+    RePak::SetStarpakSuffix(pakCtx.starpakPaths, starpakSuffix);
+    RePak::SetStarpakSuffix(pakCtx.optStarpakPaths, starpakSuffix);
+
+    // the asset graph's asset indices are those of the map's build, not this pak's
+    if (!RePak::FinalizeLayout(nullptr, pakMarks, pakEntries))
+        return false;
+
+    if (!RePak::WriteMapOutput(sOutputDir, sPakName, pakEntries, output.result))
+        return false;
+
+    Log("  %s.rpak: %zu assets, %zu pages, %zu segments, %" PRIu64 " bytes\n", sPakName.c_str(), pakEntries.size(), pakCtx.pages.size(),
+        pakCtx.segments.size(), output.result.rpakSize);
+
+    output.guids.clear();
+
+    for (auto& it : pakEntries)
+        output.guids.push_back(it.GUID);
+
+    output.starpakPath = pakCtx.starpakPaths.empty() ? "" : pakCtx.starpakPaths[0];
+
+    return true;
+}
+
+// purpose: write the rpaks of a split map along with a manifest of the assets in each of them
+// returns: true on success
+static bool WriteSplitPaks(AssetGraph& assetGraph, const std::vector<BuildStateMark_t>& marks, std::vector<RPakAssetEntryV8>& assetEntries,
+    const std::vector<SplitPak_t>& paks, const std::string& sOutputDir, const std::string& sRpakName, MapBuildResult_t& result)
+{
+    rapidjson::StringBuffer manifestJson{};
+    rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(manifestJson);
+
+    writer.StartObject();
+    writer.Key("rpak");
+    writer.String(sRpakName.c_str());
+    writer.Key("paks");
+    writer.StartArray();
+
+    result.rpakName = sRpakName;
+
+    for (size_t pakIdx = 0; pakIdx < paks.size(); ++pakIdx)
+    {
+        const std::string suffix = "_" + std::to_string(pakIdx);
+
+        PartialPakOutput_t output{};
+
+        if (!RePak::WritePartialMapOutput(assetGraph, marks, assetEntries, paks[pakIdx].positions, sOutputDir, sRpakName + suffix, suffix, output))
+            return false;
+
+        result.assetCount += output.result.assetCount;
+        result.rpakSize += output.result.rpakSize;
+        result.starpakSize += output.result.starpakSize;
+
+        writer.StartObject();
+        writer.Key("name");
+        writer.String((sRpakName + suffix + ".rpak").c_str());
+
+        if (!output.starpakPath.empty())
+        {
+            writer.Key("starpak");
+            writer.String(output.starpakPath.c_str());
+        }
+
+        writer.Key("assets");
+        writer.StartArray();
+
+        for (uint64_t it : output.guids)
+        {
+            char guid[32];
+            snprintf(guid, sizeof(guid), "0x%016llX", (unsigned long long)it);
+            writer.String(guid);
+        }
+
+        writer.EndArray();
+        writer.EndObject();
+    }
+
+    writer.EndArray();
+    writer.EndObject();
+
+    std::string manifestPath = sOutputDir + sRpakName + ".manifest.json";
+    std::ofstream manifest(manifestPath, std::ios::binary);
+
+    if (!manifest.is_open())
+    {
+        Error("failed to write pak manifest '%s'\n", manifestPath.c_str());
+        return false;
+    }
+
+    manifest.write(manifestJson.GetString(), manifestJson.GetSize());
+
+    Log("wrote pak manifest to %s\n", manifestPath.c_str());
+    return true;
+}
+
+// purpose: write the built assets of a map as a single rpak, or as several rpaks if they don't fit in the pak budget
+// marks must hold the build state before every asset in build order and after the last one (see RePak::BuildAssets)
+// returns: true on success
+bool RePak::WriteBudgetedMapOutput(AssetGraph& assetGraph, const std::vector<BuildStateMark_t>& marks, std::vector<RPakAssetEntryV8>& assetEntries,
+    const PakBudget_t& budget, const std::string& sOutputDir, const std::string& sRpakName, MapBuildResult_t& result)
+{
+    const char* limit = RePak::CheckPakBudget(GetBuildStats(marks.front(), marks.back()), budget);
+
+    if (!limit)
+    {
+        if (!RePak::FinalizeLayout(&assetGraph, marks, assetEntries))
+            return false;
+
+        return RePak::WriteMapOutput(sOutputDir, sRpakName, assetEntries, result);
+    }
+
+    std::vector<SplitPak_t> paks{};
+
+    if (!PlanSplitPaks(assetGraph, marks, budget, paks))
+        return false;
+
+    Log("rpak %s.rpak exceeds the %s limit, splitting it into %zu rpaks\n", sRpakName.c_str(), limit, paks.size());
+
+    std::filesystem::create_directories(sOutputDir);
+
+    return WriteSplitPaks(assetGraph, marks, assetEntries, paks, sOutputDir, sRpakName, result);
+}
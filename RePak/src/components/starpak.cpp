@@ -2,18 +2,16 @@
 #include "RePak.h"
 #include <Assets.h>
 
-static uint64_t nextStarpakOffset = 0x1000;
-
 // purpose: add new starpak file path to be used by the rpak
 // returns: void
 void RePak::AddStarpakReference(std::string path)
 {
-    for (auto& it : Assets::g_vsStarpakPaths)
+    for (auto& it : g_pBuildContext->starpakPaths)
     {
         if (it == path)
             return;
     }
-    Assets::g_vsStarpakPaths.push_back(path);
+    g_pBuildContext->starpakPaths.push_back(path);
 }
 
 // purpose: add data entry to be written to the starpak
@@ -23,11 +21,140 @@ uint64_t RePak::AddStarpakDataEntry(SRPkDataEntry block)
     size_t ns = Utils::PadBuffer((char**)&block.dataPtr, block.dataSize, 4096);
 
     block.dataSize = ns;
-    block.offset = nextStarpakOffset;
 
-    Assets::g_vSRPkDataEntries.push_back(block);
+    return RePak::AddPaddedStarpakDataEntry(block);
+}
+
+// purpose: add a data entry that was padded when it was first added, such as one from an asset record or an existing starpak
+// padding it again would grow it by another 4096 bytes every time it is added
+// returns: offset to data entry in starpak
+uint64_t RePak::AddPaddedStarpakDataEntry(SRPkDataEntry block)
+{
+    block.offset = g_pBuildContext->nextStarpakOffset;
 
-    nextStarpakOffset += block.dataSize;
+    g_pBuildContext->starpakEntries.push_back(block);
+
+    g_pBuildContext->nextStarpakOffset += block.dataSize;
 
     return block.offset;
-}
\ No newline at end of file
+}
+
+// purpose: set the offset that the next starpak data entry will be placed at
+// used when appending to an existing starpak
+void RePak::SetStarpakDataOffset(uint64_t offset)
+{
+    g_pBuildContext->nextStarpakOffset = offset;
+}
+
+// purpose: find where the data blocks of an existing starpak end
+// returns: offset of the starpak's entry table, or -1 if the file isn't a valid starpak
+uint64_t RePak::GetStarpakDataEnd(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+
+    if (!in.is_open())
+        return -1;
+
+    uint64_t fileSize = in.tellg();
+
+    if (fileSize < 0x1000 + sizeof(uint64_t))
+        return -1;
+
+    uint64_t entryCount = 0;
+    in.seekg(fileSize - sizeof(uint64_t));
+    in.read((char*)&entryCount, sizeof(entryCount));
+
+    uint64_t tableSize = entryCount * sizeof(SRPkFileEntry) + sizeof(uint64_t);
+
+    if (tableSize > fileSize - 0x1000)
+        return -1;
+
+    return fileSize - tableSize;
+}
+
+// purpose: write every starpak data entry as a new starpak
+void RePak::WriteStarpak(std::ostream& out)
+{
+    BufferedWriter writer(out);
+
+    int magic = 'kPRS';
+    int version = 1;
+    uint64_t entryCount = g_pBuildContext->starpakEntries.size();
+
+    writer.write(magic);
+    writer.write(version);
+
+    // data blocks in starpaks are all aligned to 4096 bytes, including the header which gets filled with 0xCB after the magic
+    // and version
+    writer.writePadding(4088, 0xCB);
+
+    std::vector<BufferedWriteBlock_t> blocks{};
+    std::vector<SRPkFileEntry> entries{};
+
+    for (auto& it : g_pBuildContext->starpakEntries)
+    {
+        blocks.push_back({ it.dataPtr, it.dataSize });
+        entries.push_back({ it.offset, it.dataSize });
+    }
+
+    writer.writeBlocks(blocks.data(), blocks.size());
+
+    // starpaks have a table of sorts at the end of the file, containing the offsets and data sizes for every data block
+    // as far as i'm aware, this isn't even used by the game, so i'm not entirely sure why it exists?
+    writer.writeVector(entries);
+    writer.write(entryCount);
+    writer.flush();
+}
+
+// purpose: add every starpak data entry to the end of an existing starpak
+// the data entries must have been placed after the starpak's existing data (see SetStarpakDataOffset),
+// the existing data blocks are left untouched and the entry table is rewritten after the new blocks
+// returns: true on success
+bool RePak::AppendStarpak(const std::string& path)
+{
+    uint64_t dataEnd = RePak::GetStarpakDataEnd(path);
+
+    if (dataEnd == (uint64_t)-1)
+    {
+        Error("'%s' is not a valid starpak\n", path.c_str());
+        return false;
+    }
+
+    std::fstream srpk(path, std::ios::binary | std::ios::in | std::ios::out);
+
+    if (!srpk.is_open())
+    {
+        Error("couldn't open starpak '%s'\n", path.c_str());
+        return false;
+    }
+
+    // keep the existing table so it can be written again after the new data
+    srpk.seekg(0, std::ios::end);
+    uint64_t fileSize = srpk.tellg();
+
+    std::vector<SRPkFileEntry> entries((fileSize - dataEnd - sizeof(uint64_t)) / sizeof(SRPkFileEntry));
+    srpk.seekg(dataEnd);
+    srpk.read((char*)entries.data(), entries.size() * sizeof(SRPkFileEntry));
+
+    srpk.seekp(dataEnd);
+
+    for (auto& it : g_pBuildContext->starpakEntries)
+    {
+        if (it.offset != (uint64_t)srpk.tellp())
+        {
+            Error("starpak data entry at offset %" PRIu64 " doesn't follow the existing data in '%s'\n", it.offset, path.c_str());
+            return false;
+        }
+
+        srpk.write((const char*)it.dataPtr, it.dataSize);
+        entries.push_back({ it.offset, it.dataSize });
+    }
+
+    uint64_t entryCount = entries.size();
+
+    srpk.write((const char*)entries.data(), entries.size() * sizeof(SRPkFileEntry));
+    srpk.write((const char*)&entryCount, sizeof(entryCount));
+    srpk.close();
+
+    return true;
+}
@@ -0,0 +1,214 @@
+#include "pch.h"
+#include "Assets.h"
+#include "BuildCache.h"
+#include "RPakFile.h"
+#include "SharedBuildState.h"
+#include "PakBudget.h"
+#include "AssetGraph.h"
+
+// purpose: rebuild the assets in a map file and replace them in an existing rpak
+// every other asset is copied over from the rpak as it is, so only the assets in the map file need their source files.
+// the rpak is then patched in place: the header is rewritten, and the rest of the file only from the first byte that changed.
+// new starpak data is appended to the rpak's existing starpak, leaving the data of the replaced assets unused in it.
+// the layout options of the map are applied the same way as in a normal build, with the rpak's asset order standing in for
+// the part of a load order that can't be worked out from the map
+// returns: exit code
+int RePak::UpdateRPak(const char* rpakPath, const char* mapFile)
+{
+    RPakFile_t pak{ };
+
+    if (!RePak::ReadRPakFile(rpakPath, pak))
+        return EXIT_FAILURE;
+
+    std::filesystem::path mapPath(mapFile);
+    std::vector<char> mapBuf{ };
+    rapidjson::Document doc{ };
+
+    if (!RePak::LoadMapFile(mapPath, mapBuf, doc))
+        return EXIT_FAILURE;
+
+    RePak::SetAssetsDir(doc, mapPath);
+    RePak::SetLayoutOptions(doc);
+    RePak::SetReproducibleOptions(doc);
+
+    // the map only holds the replaced assets, so a "graph" load order is taken from the rpak instead,
+    // which is also the order that a stable layout already put the assets in
+    AssetGraph emptyGraph{ };
+
+    if (!RePak::SetLoadOrder(doc, mapPath, emptyGraph))
+        return EXIT_FAILURE;
+
+    for (auto& it : pak.assets)
+        g_pBuildContext->loadOrder.emplace(it.GUID, (uint32_t)g_pBuildContext->loadOrder.size());
+
+    // find the asset in the rpak that each map file entry replaces
+    std::vector<rapidjson::Value*> replacements(pak.assets.size(), nullptr);
+    std::vector<const AssetTypeHandler_t*> handlers(pak.assets.size(), nullptr);
+    std::vector<const AssetTypeHandler_t*> usedAssetTypes{ };
+    size_t nReplacedCount = 0;
+
+    for (auto& file : doc["files"].GetArray())
+    {
+        rapidjson::Value::MemberIterator typeIt = file.FindMember("$type");
+        rapidjson::Value::MemberIterator pathIt = file.FindMember("path");
+
+        if (typeIt == file.MemberEnd() || pathIt == file.MemberEnd() || !pathIt->value.IsString())
+        {
+            Warning("Map file entry is missing a '$type' or 'path' field. Skipping asset...\n");
+            continue;
+        }
+
+        const char* assetPath = pathIt->value.GetString();
+        const AssetTypeHandler_t* handler = Assets::GetAssetTypeHandler(RePak::GetAssetTypeFourCC(typeIt->value));
+
+        if (!handler || !handler->GetGuid)
+        {
+            Warning("Unknown asset type for map file entry '%s'. Skipping asset...\n", assetPath);
+            continue;
+        }
+
+        uint32_t assetIdx = 0;
+
+        if (!RePak::GetAssetByGuid(&pak.assets, handler->GetGuid(assetPath, file), &assetIdx))
+        {
+            Error("asset '%s' is not in rpak '%s'. Only assets that are already in the rpak can be updated\n", assetPath, rpakPath);
+            return EXIT_FAILURE;
+        }
+
+        if (pak.assets[assetIdx].Magic != (uint32_t)handler->type)
+        {
+            Error("asset '%s' has a different type in rpak '%s'\n", assetPath, rpakPath);
+            return EXIT_FAILURE;
+        }
+
+        if (!replacements[assetIdx])
+            nReplacedCount++;
+
+        replacements[assetIdx] = &file;
+        handlers[assetIdx] = handler;
+
+        if (std::find(usedAssetTypes.begin(), usedAssetTypes.end(), handler) == usedAssetTypes.end())
+            usedAssetTypes.push_back(handler);
+    }
+
+    if (nReplacedCount == 0)
+    {
+        Warning("map file doesn't contain any assets to update\n");
+        return EXIT_SUCCESS;
+    }
+
+    Log("updating %zu asset(s) in rpak %s\n\n", nReplacedCount, rpakPath);
+
+    g_pBuildContext->starpakPaths = pak.starpakPaths;
+    g_pBuildContext->optStarpakPaths = pak.optStarpakPaths;
+
+    // place new starpak data after the data that is already in the rpak's starpak
+    std::filesystem::path rpakDir = std::filesystem::path(rpakPath).parent_path();
+    std::string sStarpakPath{ };
+
+    if (pak.starpakPaths.size() == 1)
+    {
+        sStarpakPath = (rpakDir / std::filesystem::path(pak.starpakPaths[0]).filename()).u8string();
+
+        uint64_t dataEnd = RePak::GetStarpakDataEnd(sStarpakPath);
+
+        // the assets that are kept still point into the starpak, so it can't be replaced with a new one
+        if (dataEnd == (uint64_t)-1)
+        {
+            Error("starpak '%s' of rpak '%s' is missing or isn't a valid starpak\n", sStarpakPath.c_str(), rpakPath);
+            return EXIT_FAILURE;
+        }
+
+        RePak::SetStarpakDataOffset(dataEnd);
+    }
+
+    // rebuild the pak's build state in the original asset order, so that everything in front of the first replaced asset stays the same
+    std::vector<RPakAssetEntryV8> assetEntries{ };
+    std::vector<BuildStateMark_t> marks{ };
+
+    for (auto& it : usedAssetTypes)
+    {
+        if (it->BeginBatch)
+            it->BeginBatch(&assetEntries);
+    }
+
+    for (uint32_t i = 0; i < pak.assets.size(); ++i)
+    {
+        marks.push_back(RePak::MarkBuildState(assetEntries));
+
+        if (replacements[i])
+        {
+            rapidjson::Value& file = *replacements[i];
+
+            if (!handlers[i]->AddAsset(&assetEntries, file["path"].GetString(), file) || assetEntries.size() != marks.back().assetCount + 1)
+            {
+                Error("failed to rebuild asset '%s'\n", file["path"].GetString());
+                return EXIT_FAILURE;
+            }
+
+            continue;
+        }
+
+        AssetRecord_t record{ };
+
+        if (!RePak::ExtractAssetRecord(pak, i, record))
+        {
+            Error("asset %" PRIx64 " in rpak '%s' shares pages with other assets, so the rpak can't be updated in place\n", pak.assets[i].GUID, rpakPath);
+            return EXIT_FAILURE;
+        }
+
+        RePak::SpliceAssetRecord(record, assetEntries);
+    }
+
+    marks.push_back(RePak::MarkBuildState(assetEntries));
+
+    for (auto& it : usedAssetTypes)
+    {
+        if (it->EndBatch)
+            it->EndBatch(&assetEntries);
+    }
+
+    if (g_pBuildContext->starpakPaths.size() > 1)
+    {
+        Error("updated assets use a different starpak than rpak '%s'\n", rpakPath);
+        return EXIT_FAILURE;
+    }
+
+    if (!RePak::CheckBuildBudget(assetEntries, RePak::GetPakBudget(doc)) || !RePak::FinalizeLayout(nullptr, marks, assetEntries))
+        return EXIT_FAILURE;
+
+    // keep every header field that isn't derived from the tables
+    RPakFileHeaderV8 rpakHeader = pak.header;
+    rpakHeader.CreatedTime = RePak::GetCreatedTime();
+
+    // the pages are in the image now, so only the image and the old rpak are held while it is patched
+    const std::string newData = RePak::WriteRPakImage(rpakHeader, assetEntries);
+    g_pBuildContext->ReleasePageData();
+
+    size_t nWritten = RePak::PatchFile(rpakPath, newData, pak.fileData.data(), pak.fileData.size(), sizeof(RPakFileHeaderV8));
+
+    if (nWritten == (size_t)-1)
+    {
+        Error("couldn't open rpak '%s' for writing\n", rpakPath);
+        return EXIT_FAILURE;
+    }
+
+    if (!g_pBuildContext->starpakEntries.empty())
+    {
+        if (sStarpakPath.empty())
+            sStarpakPath = (rpakDir / std::filesystem::path(g_pBuildContext->starpakPaths[0]).filename()).u8string();
+
+        // the rpak only has no starpak yet when none of its assets used one
+        if (FILE_EXISTS(sStarpakPath))
+        {
+            if (!RePak::AppendStarpak(sStarpakPath))
+                return EXIT_FAILURE;
+        }
+        else if (!RePak::WriteStarpakFile(sStarpakPath))
+            return EXIT_FAILURE;
+    }
+
+    Log("rewrote %zu of %zu bytes\n", nWritten, newData.size());
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,534 @@
+#include "pch.h"
+#include "Assets.h"
+#include "AssetGraph.h"
+#include "BuildCache.h"
+#include "SharedBuildState.h"
+#include "PakBudget.h"
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
+#include <chrono>
+#include <thread>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// time to wait after a change before rebuilding, so that a burst of writes to the same files only causes one rebuild
+#define WATCH_DEBOUNCE_MS 150
+
+// purpose: normalise a path so that paths from map files and from change notifications can be compared
+// paths are only case insensitive on windows, elsewhere two paths that differ in case are different files
+// returns: absolute path with forward slashes, in lower case on windows
+static std::string NormalisePath(const std::filesystem::path& path)
+{
+    std::string str = Utils::NormalisePath(path);
+#ifdef _WIN32
+    std::transform(str.begin(), str.end(), str.begin(), ::tolower);
+#endif
+    return str;
+}
+
+#ifdef _WIN32
+//
+// watches a directory tree for changed files
+//
+class DirectoryWatcher
+{
+    std::filesystem::path root;
+    HANDLE hDir = INVALID_HANDLE_VALUE;
+    OVERLAPPED overlapped{};
+    alignas(DWORD) uint8_t buffer[64 * 1024];
+
+    bool Arm()
+    {
+        ResetEvent(overlapped.hEvent);
+
+        return ReadDirectoryChangesW(hDir, buffer, sizeof(buffer), TRUE,
+            FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE, nullptr, &overlapped, nullptr);
+    }
+
+public:
+    ~DirectoryWatcher()
+    {
+        if (hDir != INVALID_HANDLE_VALUE)
+        {
+            CancelIo(hDir);
+            CloseHandle(hDir);
+        }
+
+        if (overlapped.hEvent)
+            CloseHandle(overlapped.hEvent);
+    }
+
+    bool Open(const std::filesystem::path& dir)
+    {
+        root = std::filesystem::absolute(dir);
+        hDir = CreateFileW(root.wstring().c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+            OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+
+        if (hDir == INVALID_HANDLE_VALUE)
+            return false;
+
+        overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+
+        return overlapped.hEvent && Arm();
+    }
+
+    HANDLE GetEvent() { return overlapped.hEvent; };
+
+    // purpose: collect the files that changed since the last call
+    // bOverflow is set if too many changes happened to list them all
+    void GetChanges(std::vector<std::string>& changes, bool& bOverflow)
+    {
+        DWORD nBytes = 0;
+
+        if (!GetOverlappedResult(hDir, &overlapped, &nBytes, FALSE))
+            return;
+
+        if (nBytes == 0)
+            bOverflow = true;
+
+        for (size_t offset = 0; offset < nBytes;)
+        {
+            FILE_NOTIFY_INFORMATION* info = reinterpret_cast<FILE_NOTIFY_INFORMATION*>(buffer + offset);
+            std::wstring name(info->FileName, info->FileNameLength / sizeof(WCHAR));
+
+            changes.push_back(NormalisePath(root / name));
+
+            if (info->NextEntryOffset == 0)
+                break;
+
+            offset += info->NextEntryOffset;
+        }
+
+        Arm();
+    }
+};
+#else
+//
+// watches a directory tree for changed files
+// inotify only watches single directories, so every directory in the tree gets its own watch
+//
+class DirectoryWatcher
+{
+    int fd = -1;
+    std::unordered_map<int, std::filesystem::path> dirs{}; // directory of each watch
+
+    void AddDirectory(const std::filesystem::path& dir)
+    {
+        int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+
+        if (wd != -1)
+            dirs[wd] = dir;
+    }
+
+public:
+    ~DirectoryWatcher()
+    {
+        if (fd != -1)
+            close(fd);
+    }
+
+    bool Open(const std::filesystem::path& dir)
+    {
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+        if (fd == -1)
+            return false;
+
+        std::filesystem::path root = std::filesystem::absolute(dir);
+        AddDirectory(root);
+
+        if (dirs.empty())
+            return false;
+
+        std::error_code ec;
+
+        for (auto& it : std::filesystem::recursive_directory_iterator(root, ec))
+        {
+            if (it.is_directory())
+                AddDirectory(it.path());
+        }
+
+        return true;
+    }
+
+    int GetFd() { return fd; };
+
+    // purpose: collect the files that changed since the last call
+    // bOverflow is set if too many changes happened to list them all
+    void GetChanges(std::vector<std::string>& changes, bool& bOverflow)
+    {
+        alignas(inotify_event) uint8_t buffer[64 * 1024];
+        ssize_t nBytes = 0;
+
+        while ((nBytes = read(fd, buffer, sizeof(buffer))) > 0)
+        {
+            for (ssize_t offset = 0; offset < nBytes;)
+            {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                offset += sizeof(inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW)
+                    bOverflow = true;
+
+                auto dirIt = dirs.find(event->wd);
+
+                if (dirIt == dirs.end() || event->len == 0)
+                    continue;
+
+                std::filesystem::path path = dirIt->second / event->name;
+
+                // directories that are added to the tree are watched as well
+                if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+                    AddDirectory(path);
+
+                changes.push_back(NormalisePath(path));
+            }
+        }
+    }
+};
+#endif
+
+// an asset from the map file, along with the last build of it
+struct WatchedAsset_t
+{
+    std::vector<std::string> sourceFiles; // normalised paths of every file the asset is built from
+    AssetRecord_t record;
+    bool bUpToDate = false; // false when the asset has to be built again on the next rebuild
+};
+
+//
+// state that is kept between rebuilds of a watched map file
+//
+class WatchSession
+{
+    std::filesystem::path mapPath;
+    std::string sMapPath;
+
+    std::vector<char> mapBuf;
+    rapidjson::Document doc;
+
+    std::string sRpakName;
+    std::string sOutputDir;
+
+    AssetGraph assetGraph;
+    std::vector<const AssetTypeHandler_t*> usedAssetTypes;
+
+    // assets are keyed by a hash of their map file entry, so they are kept when the map file changes
+    // as long as the entry itself stays the same
+    std::unordered_map<uint64_t, WatchedAsset_t> assets;
+    std::vector<uint64_t> nodeKeys;
+
+    // contents of the output files from the last rebuild
+    std::string lastImage;
+    uint64_t lastStarpakHash = 0;
+
+public:
+    WatchSession(const char* mapFile) : mapPath(mapFile), sMapPath(NormalisePath(mapFile)) {};
+
+    const std::string& GetMapPath() { return sMapPath; };
+
+    std::vector<std::filesystem::path> GetWatchedDirs()
+    {
+        std::filesystem::path mapDir = mapPath.has_parent_path() ? mapPath.parent_path() : ".";
+        return { mapDir, g_pBuildContext->assetsDir };
+    }
+
+    bool Load();
+    bool MarkChanged(const std::vector<std::string>& changes, bool bAll);
+    void Rebuild();
+};
+
+// purpose: parse the map file and build its asset graph
+// assets whose map file entries haven't changed since the last load keep their last build
+// returns: true on success
+bool WatchSession::Load()
+{
+    mapBuf.clear();
+    doc = rapidjson::Document{};
+    assetGraph = AssetGraph{};
+    usedAssetTypes.clear();
+    nodeKeys.clear();
+
+    if (!RePak::LoadMapFile(mapPath, mapBuf, doc))
+        return false;
+
+    sRpakName = RePak::GetRPakName(doc);
+    RePak::SetAssetsDir(doc, mapPath);
+    RePak::SetLayoutOptions(doc);
+    RePak::SetReproducibleOptions(doc);
+    RePak::SetOutputOptions(doc);
+    sOutputDir = RePak::GetOutputDir(doc, mapPath);
+
+    assetGraph.AddMapFileEntries(doc["files"], usedAssetTypes);
+
+    if (!assetGraph.Resolve())
+    {
+        Error("failed to resolve asset dependencies\n");
+        return false;
+    }
+
+    if (!RePak::SetLoadOrder(doc, mapPath, assetGraph))
+        return false;
+
+    std::unordered_map<uint64_t, WatchedAsset_t> oldAssets = std::move(assets);
+    assets.clear();
+
+    for (uint32_t i = 0; i < assetGraph.GetNodeCount(); ++i)
+    {
+        AssetGraphNode_t& node = assetGraph.GetNode(i);
+        const char* assetPath = (*node.mapEntry)["path"].GetString();
+
+        rapidjson::StringBuffer entryJson{};
+        rapidjson::Writer<rapidjson::StringBuffer> writer(entryJson);
+        node.mapEntry->Accept(writer);
+
+        uint64_t key = Utils::HashData(&node.handler->mapType, sizeof(node.handler->mapType));
+        key = Utils::HashData(entryJson.GetString(), entryJson.GetSize(), key);
+
+        nodeKeys.push_back(key);
+
+        auto it = oldAssets.find(key);
+
+        if (it != oldAssets.end())
+        {
+            assets.emplace(key, std::move(it->second));
+            continue;
+        }
+
+        WatchedAsset_t& asset = assets[key];
+
+        std::vector<std::string> sourceFiles{};
+
+        if (node.handler->GetSourceFiles)
+            node.handler->GetSourceFiles(assetPath, *node.mapEntry, sourceFiles);
+
+        for (auto& file : sourceFiles)
+            asset.sourceFiles.push_back(NormalisePath(file));
+    }
+
+    return true;
+}
+
+// purpose: mark every asset that is built from one of the changed files as out of date
+// returns: true if any asset was affected by the changes
+bool WatchSession::MarkChanged(const std::vector<std::string>& changes, bool bAll)
+{
+    bool bChanged = false;
+
+    for (auto& it : assets)
+    {
+        WatchedAsset_t& asset = it.second;
+
+        for (auto& file : asset.sourceFiles)
+        {
+            if (bAll || std::find(changes.begin(), changes.end(), file) != changes.end())
+            {
+                asset.bUpToDate = false;
+                bChanged = true;
+                break;
+            }
+        }
+    }
+
+    return bChanged;
+}
+
+// purpose: build the rpak, only running the handlers of assets that are out of date
+// every other asset is spliced in from its last build, and the output files are only rewritten from the first changed byte
+void WatchSession::Rebuild()
+{
+    auto start = std::chrono::steady_clock::now();
+
+    g_pBuildContext->Reset();
+
+    std::vector<RPakAssetEntryV8> assetEntries{ };
+    std::vector<BuildStateMark_t> marks{ };
+    size_t nRebuiltCount = 0;
+    bool bBuilt = true;
+
+    for (auto& it : usedAssetTypes)
+    {
+        if (it->BeginBatch)
+            it->BeginBatch(&assetEntries);
+    }
+
+    for (uint32_t nodeIdx : assetGraph.GetBuildOrder())
+    {
+        AssetGraphNode_t& node = assetGraph.GetNode(nodeIdx);
+        WatchedAsset_t& asset = assets[nodeKeys[nodeIdx]];
+
+        node.assetIdx = -1;
+        marks.push_back(RePak::MarkBuildState(assetEntries));
+
+        if (asset.bUpToDate)
+        {
+            node.assetIdx = RePak::SpliceAssetRecord(asset.record, assetEntries);
+            continue;
+        }
+
+        BuildStateMark_t mark = RePak::MarkBuildState(assetEntries);
+
+        if (!node.handler->AddAsset(&assetEntries, (*node.mapEntry)["path"].GetString(), *node.mapEntry))
+        {
+            bBuilt = false;
+            break;
+        }
+
+        nRebuiltCount++;
+
+        if (assetEntries.size() == mark.assetCount)
+            continue;
+
+        node.assetIdx = mark.assetCount;
+
+        // assets that can't be relocated are built again every time
+        asset.bUpToDate = RePak::CaptureAssetRecord(mark, assetEntries, asset.record);
+    }
+
+    marks.push_back(RePak::MarkBuildState(assetEntries));
+
+    for (auto& it : usedAssetTypes)
+    {
+        if (it->EndBatch)
+            it->EndBatch(&assetEntries);
+    }
+
+    // the last output is left as it is, and the failed asset is built again on the next change
+    // the layout is applied after the records are captured, so an asset's record never depends on where the layout put it
+    if (!bBuilt || !RePak::CheckBuildBudget(assetEntries, RePak::GetPakBudget(doc)) || !RePak::FinalizeLayout(&assetGraph, marks, assetEntries))
+    {
+        g_pBuildContext->Reset();
+        Warning("rebuild failed, waiting for changes...\n");
+        return;
+    }
+
+    std::filesystem::create_directories(sOutputDir);
+
+    RPakFileHeaderV8 rpakHeader{ };
+    rpakHeader.CreatedTime = RePak::GetCreatedTime();
+
+    std::string newImage = RePak::WriteRPakImage(rpakHeader, assetEntries);
+    size_t nWritten = RePak::PatchFile(sOutputDir + sRpakName + ".rpak", newImage, lastImage.data(), lastImage.size(), sizeof(RPakFileHeaderV8));
+
+    if (nWritten == (size_t)-1)
+        Error("couldn't write rpak %s.rpak\n", sRpakName.c_str());
+    else
+        lastImage = std::move(newImage);
+
+    // starpaks are usually far bigger than the rpak, so only write them when their data has changed
+    if (g_pBuildContext->starpakPaths.size() == 1)
+    {
+        uint64_t starpakHash = Utils::HashData(nullptr, 0);
+
+        for (auto& it : g_pBuildContext->starpakEntries)
+            starpakHash = Utils::HashData(it.dataPtr, it.dataSize, starpakHash);
+
+        // a starpak that couldn't be written is tried again on the next rebuild
+        if (starpakHash != lastStarpakHash)
+        {
+            std::filesystem::path path(g_pBuildContext->starpakPaths[0]);
+
+            if (RePak::WriteStarpakFile(sOutputDir + path.filename().u8string()))
+                lastStarpakHash = starpakHash;
+        }
+    }
+
+    g_pBuildContext->Reset();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    Log("rebuilt %zu of %zu asset(s) in %lld ms, wrote %zu bytes\n", nRebuiltCount, assetEntries.size(), (long long)elapsed.count(), nWritten == (size_t)-1 ? 0 : nWritten);
+}
+
+// purpose: block until files change in any of the watched directories
+// waits a little after the first change, so that every change from a single save is picked up together
+static void WaitForChanges(std::vector<std::unique_ptr<DirectoryWatcher>>& watchers, std::vector<std::string>& changes, bool& bOverflow)
+{
+#ifdef _WIN32
+    std::vector<HANDLE> events{};
+
+    for (auto& it : watchers)
+        events.push_back(it->GetEvent());
+
+    WaitForMultipleObjects(events.size(), events.data(), FALSE, INFINITE);
+    Sleep(WATCH_DEBOUNCE_MS);
+
+    for (auto& it : watchers)
+    {
+        if (WaitForSingleObject(it->GetEvent(), 0) == WAIT_OBJECT_0)
+            it->GetChanges(changes, bOverflow);
+    }
+#else
+    std::vector<pollfd> fds{};
+
+    for (auto& it : watchers)
+        fds.push_back({ it->GetFd(), POLLIN, 0 });
+
+    poll(fds.data(), fds.size(), -1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(WATCH_DEBOUNCE_MS));
+
+    // reads don't block, so every watcher can just be asked for its changes
+    for (auto& it : watchers)
+        it->GetChanges(changes, bOverflow);
+#endif
+}
+
+// purpose: keep a map file's rpak up to date with the map file and its asset sources until the process is closed
+// the parsed map file, the asset graph and the last build of every asset are kept in memory between builds,
+// so a change to a single source file only runs the handler of the assets built from it
+// returns: exit code
+int RePak::WatchMapFile(const char* mapFile)
+{
+    WatchSession session(mapFile);
+    bool bReload = true;
+
+    std::vector<std::unique_ptr<DirectoryWatcher>> watchers{};
+
+    for (;;)
+    {
+        if (bReload)
+        {
+            bReload = false;
+
+            if (session.Load())
+            {
+                Log("watching map file %s\n", mapFile);
+                session.Rebuild();
+            }
+            else
+                Warning("waiting for the map file to be fixed...\n");
+
+            // the assets directory may have changed with the map file
+            watchers.clear();
+
+            for (auto& dir : session.GetWatchedDirs())
+            {
+                auto watcher = std::make_unique<DirectoryWatcher>();
+
+                if (!watcher->Open(dir))
+                {
+                    Error("couldn't watch directory '%s'\n", dir.u8string().c_str());
+                    return EXIT_FAILURE;
+                }
+
+                watchers.push_back(std::move(watcher));
+            }
+        }
+
+        std::vector<std::string> changes{};
+        bool bOverflow = false;
+
+        WaitForChanges(watchers, changes, bOverflow);
+
+        if (bOverflow || std::find(changes.begin(), changes.end(), session.GetMapPath()) != changes.end())
+            bReload = true;
+
+        if (session.MarkChanged(changes, bOverflow) && !bReload)
+            session.Rebuild();
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,172 @@
+#include "pch.h"
+#include "BuildCache.h"
+#include "SharedBuildState.h"
+#include "ShardBuild.h"
+#include <thread>
+
+// purpose: parse the arguments of build-all and build every map file
+// RePak build-all [-j <threads>] [-inputcache <MB>] [-explain] <map files...>
+// returns: exit code
+static int BuildAllCommand(int argc, char** argv)
+{
+    std::vector<const char*> mapFiles{ };
+    uint32_t nThreads = std::thread::hardware_concurrency();
+    uint64_t nInputCacheSize = 1024;
+    bool bExplainCache = false;
+
+    for (int i = 2; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            nThreads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-inputcache") && i + 1 < argc)
+            nInputCacheSize = strtoull(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "-explain"))
+            bExplainCache = true;
+        else
+            mapFiles.push_back(argv[i]);
+    }
+
+    if (mapFiles.empty())
+    {
+        Error("invalid usage\n");
+        return EXIT_FAILURE;
+    }
+
+    return RePak::BuildAll(mapFiles, max(nThreads, 1u), nInputCacheSize * 1024 * 1024, bExplainCache);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        Error("invalid usage\n");
+        return EXIT_FAILURE;
+    }
+
+    // RePak build-all <map files...>
+    // builds every map file in this process, so the builds can share their caches
+    if (!strcmp(argv[1], "build-all"))
+        return BuildAllCommand(argc, argv);
+
+    RPakBuildContext_t ctx{ };
+    BuildContextScope ctxScope(ctx);
+
+    // RePak update <rpak> <map file>
+    if (!strcmp(argv[1], "update"))
+    {
+        if (argc < 4)
+        {
+            Error("invalid usage\n");
+            return EXIT_FAILURE;
+        }
+
+        return RePak::UpdateRPak(argv[2], argv[3]);
+    }
+
+    // RePak plan <map file>
+    // estimates the layout of the rpak from the headers of the source files, without building it
+    if (!strcmp(argv[1], "plan"))
+    {
+        if (argc < 3)
+        {
+            Error("invalid usage\n");
+            return EXIT_FAILURE;
+        }
+
+        return RePak::PlanMapFile(argv[2]);
+    }
+
+    // RePak build-shard <map file> <shard index> <shard count> <shard file>
+    // builds one shard of a sharded build, normally started by the process running the sharded build
+    if (!strcmp(argv[1], "build-shard"))
+    {
+        if (argc < 6)
+        {
+            Error("invalid usage\n");
+            return EXIT_FAILURE;
+        }
+
+        return RePak::BuildShard(argv[2], atoi(argv[3]), atoi(argv[4]), argv[5]) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // RePak link-shards <map file> <shard files...>
+    if (!strcmp(argv[1], "link-shards"))
+    {
+        if (argc < 4)
+        {
+            Error("invalid usage\n");
+            return EXIT_FAILURE;
+        }
+
+        MapBuildResult_t result{ };
+
+        return RePak::LinkShards(argv[2], std::vector<std::string>(argv + 3, argv + argc), result) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // RePak merge <rpaks...> -o <output rpak>
+    if (!strcmp(argv[1], "merge"))
+    {
+        std::vector<std::string> rpakPaths{ };
+        std::string outPath{ };
+
+        for (int i = 2; i < argc; ++i)
+        {
+            if (!strcmp(argv[i], "-o") && i + 1 < argc)
+                outPath = argv[++i];
+            else
+                rpakPaths.push_back(argv[i]);
+        }
+
+        if (rpakPaths.empty() || outPath.empty())
+        {
+            Error("invalid usage\n");
+            return EXIT_FAILURE;
+        }
+
+        return RePak::MergeRPaks(rpakPaths, outPath);
+    }
+
+    // RePak watch <map file>
+    if (!strcmp(argv[1], "watch"))
+    {
+        if (argc < 3)
+        {
+            Error("invalid usage\n");
+            return EXIT_FAILURE;
+        }
+
+        return RePak::WatchMapFile(argv[2]);
+    }
+
+    bool bExplainCache = false;
+    bool bVerifyRepro = false;
+    uint32_t nShardCount = 0;
+
+    for (int i = 2; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-explain"))
+            bExplainCache = true;
+        else if (!strcmp(argv[i], "-shards") && i + 1 < argc)
+            nShardCount = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-repro"))
+            ctx.bReproducible = true;
+        else if (!strcmp(argv[i], "-verify-repro"))
+            bVerifyRepro = true;
+        else
+            Warning("unknown command line argument '%s'\n", argv[i]);
+    }
+
+    // RePak <map file> -verify-repro [-shards <count>]
+    // builds the map twice and checks that both builds are identical
+    if (bVerifyRepro)
+        return RePak::VerifyReproducibleBuild(argv[1], nShardCount);
+
+    // RePak <map file> -shards <count>
+    // builds the map in separate processes, each holding only part of the pak in memory
+    if (nShardCount > 0)
+        return RePak::BuildMapFileSharded(argv[1], nShardCount);
+
+    MapBuildResult_t result{ };
+
+    return RePak::BuildMapFile(argv[1], bExplainCache, result) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
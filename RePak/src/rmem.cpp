@@ -1,2 +0,0 @@
-#include "pch.h"
-#include "rmem.h"
\ No newline at end of file